@@ -0,0 +1,84 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "alloc-count.h"
+
+// allocations and frees so far, relaxed as they're only ever summed up
+_Atomic uint64_t alloc_allocs = 0;
+_Atomic uint64_t alloc_frees = 0;
+
+
+/***** Helper function prototypes
+ */
+
+// the real allocator, as wrapped by the linker
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t align, size_t size);
+int __real_posix_memalign(void **ptr, size_t align, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void *__wrap_aligned_alloc(size_t align, size_t size);
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size);
+void __wrap_free(void *ptr);
+
+
+/***** Public functions
+ */
+
+void alloc_count(uint64_t *allocs, uint64_t *frees) {
+    *allocs = atomic_load_explicit(&alloc_allocs, memory_order_relaxed);
+    *frees = atomic_load_explicit(&alloc_frees, memory_order_relaxed);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * The wrappers the linker sends every allocation to, counting it before
+ * handing it on to the real allocator.
+ */
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&alloc_allocs, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t align, size_t size) {
+    atomic_fetch_add_explicit(&alloc_allocs, 1, memory_order_relaxed);
+    return __real_aligned_alloc(align, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size) {
+    atomic_fetch_add_explicit(&alloc_allocs, 1, memory_order_relaxed);
+    return __real_posix_memalign(ptr, align, size);
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr != NULL) {
+        atomic_fetch_add_explicit(&alloc_frees, 1, memory_order_relaxed);
+    }
+    __real_free(ptr);
+}
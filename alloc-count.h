@@ -0,0 +1,25 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The allocation counting module. Counts every heap allocation (and free) the
+ * program makes, eg. to check that nothing on the hot path allocates once
+ * the pools (see pool.h) are warmed up.
+ *
+ * The allocator is wrapped at link time, so anything linked with this needs
+ * to be linked with ALLOC_COUNT_LDFLAGS (see the Makefile), ie.
+ *   -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,...
+ * Note: only the program's own calls are counted, not the ones libc makes
+ *       itself (eg. in fopen or pthread_create).
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Gets the number of allocations (malloc, calloc, realloc, aligned_alloc and
+ * posix_memalign) and frees so far.
+ */
+void alloc_count(uint64_t *allocs, uint64_t *frees);
@@ -0,0 +1,417 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Hashcash (and SSTP) throughput benchmarks.
+ *
+ * Prints one "benchmark,value,unit" line per result, covering:
+ *   verify: hashcash_verify on its own
+ *   kernel/NAME: each search kernel the cpu supports, on one thread
+ *   solver/BALANCING/THREADS: the solver pool searching a fixed range of
+ *                             nonces (ie. the effective rate, so blocked is
+ *                             penalised for its threads overlapping)
+ *   tts/DIFFICULTY: the mean time to solution over a fixed corpus of seeds,
+ *                   on every solver thread
+ *   sstp/parse/TYPE, sstp/build/TYPE: sstp_parse and sstp_build on their own
+ *
+ * Usage: ./hashcash-bench [-t THREADS] [-d MS] [-c BASELINE] [-r PERCENT]
+ *   THREADS: the most solver threads to try, defaults to one per cpu.
+ *   MS: roughly how long each throughput measurement takes, defaults to 500.
+ *   BASELINE: the saved output of an earlier run to compare against, any
+ *             result worse by more than PERCENT (default 10) is reported as a
+ *             regression and the exit status is 1.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "hashcash.h"
+#include "solver.h"
+#include "sha256.h"
+#include "sstp.h"
+
+#define MAX_RESULTS 256
+#define MAX_NAME_LEN 64
+#define BATCH 4096
+#define CORPUS_LEN 4
+
+char *kernels[] = { "scalar", "sse4", "avx2", "avx512" };
+char *balancings[] = { "blocked", "interspersed", "chunked" };
+char *sstp_msgs[] = {
+    "PING\r\n",
+    "WORK 1fffffff 0000000019d6689c085ae165831e934ff763ae46a218a6c172b3f1b60a8ce26f"
+        " 1000000023212399 01\r\n",
+    "SOLN 1fffffff 0000000019d6689c085ae165831e934ff763ae46a218a6c172b3f1b60a8ce26f"
+        " 1000000023212147\r\n"
+};
+uint32_t difficulties[] = {
+    0x1fffffff, 0x1f0fffff, 0x1effffff, 0x1e0fffff, 0x1dffffff
+};
+
+/*
+ * A single benchmark result.
+ */
+typedef struct {
+    char name[MAX_NAME_LEN];
+    double value;
+    char unit[MAX_NAME_LEN];
+} Result;
+
+Result results[MAX_RESULTS];
+int results_len = 0;
+
+
+/***** Helper function prototypes
+ */
+
+double bench_verify(double seconds);
+double bench_kernel(double seconds);
+double bench_solver(SolverBalancing balancing, int threads, uint64_t count);
+double bench_tts(uint32_t difficulty);
+double bench_parse(char *src, double seconds);
+double bench_build(char *src, double seconds);
+void corpus_seed(int i, BYTE *seed);
+void report(char *name, double value, char *unit);
+int compare(char *path, double tolerance);
+double now(void);
+
+
+/***** Main functions
+ */
+
+int main(int argc, char *argv[]) {
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = 0.5;
+    char *baseline = NULL;
+    double tolerance = 0.1;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "t:d:c:r:"))) {
+        switch (opt) {
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'd':
+                seconds = atoi(optarg) / 1000.0;
+                break;
+            case 'c':
+                baseline = optarg;
+                break;
+            case 'r':
+                tolerance = atoi(optarg) / 100.0;
+                break;
+            default:
+                exit(1);
+        }
+    }
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+
+    printf("benchmark,value,unit\n");
+
+    report("verify", bench_verify(seconds), "hashes/s");
+
+    char name[MAX_NAME_LEN];
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (0 != hashcash_kernel_select(kernels[i])) {
+            continue;
+        }
+        snprintf(name, MAX_NAME_LEN, "kernel/%s", kernels[i]);
+        report(name, bench_kernel(seconds), "hashes/s");
+    }
+
+    // the rest uses the default kernel, sizing the solver ranges off its rate
+    hashcash_kernel_select(NULL);
+    double rate = bench_kernel(seconds);
+
+    solver_init(max_threads);
+    for (size_t i = 0; i < sizeof(balancings) / sizeof(balancings[0]); i++) {
+        for (int threads = 1; threads <= max_threads; threads++) {
+            snprintf(name, MAX_NAME_LEN, "solver/%s/%d", balancings[i], threads);
+            report(name, bench_solver(solver_parse_balancing(balancings[i]),
+                        threads, rate * seconds * threads), "hashes/s");
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(difficulties) / sizeof(difficulties[0]); i++) {
+        snprintf(name, MAX_NAME_LEN, "tts/%08" PRIx32, difficulties[i]);
+        report(name, bench_tts(difficulties[i]), "s");
+    }
+
+    for (size_t i = 0; i < sizeof(sstp_msgs) / sizeof(sstp_msgs[0]); i++) {
+        snprintf(name, MAX_NAME_LEN, "sstp/parse/%.4s", sstp_msgs[i]);
+        report(name, bench_parse(sstp_msgs[i], seconds), "msgs/s");
+        snprintf(name, MAX_NAME_LEN, "sstp/build/%.4s", sstp_msgs[i]);
+        report(name, bench_build(sstp_msgs[i], seconds), "msgs/s");
+    }
+
+    if (baseline != NULL) {
+        return compare(baseline, tolerance);
+    }
+
+    return 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Measures hashcash_verify for about the given time.
+ * Returns the hashes per second.
+ */
+double bench_verify(double seconds) {
+    BYTE seed[32];
+    BYTE target[32];
+    corpus_seed(0, seed);
+    memset(target, 0, 32); // never satisfied
+
+    uint64_t nonce = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < BATCH / 16; i++) {
+            hashcash_verify(target, seed, nonce++);
+        }
+    } while ((elapsed = now() - start) < seconds);
+
+    return nonce / elapsed;
+}
+
+/*
+ * Measures the active search kernel, on one thread, for about the given time.
+ * Returns the hashes per second.
+ */
+double bench_kernel(double seconds) {
+    BYTE seed[32];
+    BYTE target[32];
+    corpus_seed(0, seed);
+    memset(target, 0, 32); // never satisfied
+
+    HashcashSearch search;
+    hashcash_search_init(&search, target, seed);
+
+    uint64_t nonce = 0;
+    uint64_t solution;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < 16; i++) {
+            hashcash_search(&search, nonce, BATCH, &solution);
+            nonce += BATCH;
+        }
+    } while ((elapsed = now() - start) < seconds);
+
+    return nonce / elapsed;
+}
+
+/*
+ * Has the solver pool search the last count nonces, with no solution in them.
+ * Returns the nonces searched per second.
+ */
+double bench_solver(SolverBalancing balancing, int threads, uint64_t count) {
+    BYTE seed[32];
+    BYTE target[32];
+    corpus_seed(0, seed);
+    memset(target, 0, 32); // never satisfied
+
+    if (count < BATCH) {
+        count = BATCH;
+    }
+
+    SolverJob job;
+    hashcash_search_init(&job.search, target, seed);
+    job.start = UINT64_MAX - count + 1;
+    job.thread_count = threads;
+    job.balancing = balancing;
+    job.abort = 0;
+    job.solution_found = 0;
+    job.solution = 0;
+    job.on_done = NULL;
+    job.data = NULL;
+    job.trace_id = 0;
+
+    double start = now();
+    solver_submit(&job);
+    solver_wait(&job);
+
+    return count / (now() - start);
+}
+
+/*
+ * Solves a WORK job for each seed of the corpus, at the given difficulty, on
+ * every solver thread.
+ * Returns the mean time to solution in seconds.
+ */
+double bench_tts(uint32_t difficulty) {
+    BYTE seed[32];
+    BYTE target[32];
+    hashcash_calc_target(target, difficulty);
+
+    double total = 0;
+    for (int i = 0; i < CORPUS_LEN; i++) {
+        corpus_seed(i, seed);
+
+        SolverJob job;
+        hashcash_search_init(&job.search, target, seed);
+        job.start = 0;
+        job.thread_count = solver_thread_count();
+        job.balancing = CHUNKED;
+        job.abort = 0;
+        job.solution_found = 0;
+        job.solution = 0;
+        job.on_done = NULL;
+        job.data = NULL;
+        job.trace_id = i;
+
+        double start = now();
+        solver_submit(&job);
+        solver_wait(&job);
+        total += now() - start;
+
+        if (!job.solution_found
+                || !hashcash_verify(target, seed, job.solution)) {
+            fprintf(stderr, "ERROR: bad solution for %08" PRIx32 "\n",
+                    difficulty);
+            exit(1);
+        }
+    }
+
+    return total / CORPUS_LEN;
+}
+
+/*
+ * Measures sstp_parse on the given msg for about the given time.
+ * Returns the msgs parsed per second.
+ */
+double bench_parse(char *src, double seconds) {
+    int len = strlen(src);
+    volatile uint64_t sink = 0; // so the parsing isn't optimised away
+    SSTPMsg msg;
+
+    uint64_t count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < BATCH; i++) {
+            sstp_parse(src, len, &msg);
+            sink += msg.work.nonce + msg.type;
+        }
+        count += BATCH;
+    } while ((elapsed = now() - start) < seconds);
+
+    return count / elapsed;
+}
+
+/*
+ * Measures sstp_build on the given (parsed) msg for about the given time.
+ * Returns the msgs built per second.
+ */
+double bench_build(char *src, double seconds) {
+    volatile uint64_t sink = 0; // so the building isn't optimised away
+    char buf[MAX_MSG_LEN + 1];
+    SSTPMsg msg;
+    sstp_parse(src, strlen(src), &msg);
+
+    uint64_t count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < BATCH; i++) {
+            sink += sstp_build(&msg, buf) + buf[HEADER_LEN];
+        }
+        count += BATCH;
+    } while ((elapsed = now() - start) < seconds);
+
+    return count / elapsed;
+}
+
+/*
+ * The i-th seed of the fixed corpus, sha256 of i.
+ */
+void corpus_seed(int i, BYTE *seed) {
+    BYTE data[4] = { i >> 24, i >> 16, i >> 8, i };
+
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, 4);
+    sha256_final(&ctx, seed);
+}
+
+/*
+ * Prints out and remembers a result.
+ */
+void report(char *name, double value, char *unit) {
+    printf("%s,%.6g,%s\n", name, value, unit);
+    fflush(stdout);
+
+    if (results_len < MAX_RESULTS) {
+        Result *r = results + results_len++;
+        snprintf(r->name, MAX_NAME_LEN, "%s", name);
+        r->value = value;
+        snprintf(r->unit, MAX_NAME_LEN, "%s", unit);
+    }
+}
+
+/*
+ * Compares the results against the ones in the given baseline file, printing
+ * out (to stderr) every result worse by more than the given fraction.
+ * Returns 1 if there were any, 0 if not.
+ */
+int compare(char *path, double tolerance) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror("ERROR: opening baseline");
+        return 1;
+    }
+
+    int regressions = 0;
+    char line[256];
+    char name[MAX_NAME_LEN];
+    char unit[MAX_NAME_LEN];
+    double base;
+    while (NULL != fgets(line, sizeof(line), f)) {
+        if (3 != sscanf(line, "%63[^,],%lf,%63s", name, &base, unit)) {
+            continue; // the header, or junk
+        }
+
+        for (int i = 0; i < results_len; i++) {
+            Result *r = results + i;
+            if (0 != strcmp(r->name, name) || 0 != strcmp(r->unit, unit)) {
+                continue;
+            }
+
+            // rates should go up, times down
+            double change = base != 0 ? (r->value - base) / base : 0;
+            int worse = 0 == strcmp(unit, "s")
+                ? change > tolerance
+                : change < -tolerance;
+
+            fprintf(stderr, "%s: %.6g -> %.6g %s (%+.1f%%)%s\n", name, base,
+                    r->value, unit, 100 * change, worse ? " REGRESSION" : "");
+            regressions += worse;
+        }
+    }
+
+    fclose(f);
+
+    fprintf(stderr, "%d regression(s)\n", regressions);
+    return regressions > 0;
+}
+
+/*
+ * The current (monotonic) time in seconds.
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
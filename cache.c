@@ -0,0 +1,226 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+
+/***** Private structs
+ */
+
+/*
+ * A cached solution, chained into its hash bucket and also in the LRU list.
+ */
+typedef struct Entry Entry;
+struct Entry {
+    CacheKey key;
+    uint64_t solution;
+    Entry *next; // next in the bucket
+    Entry *newer; // neighbours in the LRU list
+    Entry *older;
+};
+
+struct Cache {
+    Entry **buckets;
+    int bucket_count;
+    int capacity;
+
+    // every entry is allocated up front, the first used of them are in use
+    Entry *entries;
+    int used;
+
+    // most recently used first
+    Entry *newest;
+    Entry *oldest;
+
+    pthread_mutex_t mutex;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+
+/***** Helper function prototypes
+ */
+
+Entry **find(Cache *cache, CacheKey *key);
+void lru_unlink(Cache *cache, Entry *entry);
+void lru_push(Cache *cache, Entry *entry);
+uint32_t hash_key(CacheKey *key);
+
+
+/***** Public functions
+ */
+
+Cache *cache_init(int capacity) {
+    assert(capacity > 0);
+
+    Cache *cache = (Cache *) malloc(sizeof(Cache));
+    assert(cache);
+
+    cache->bucket_count = capacity;
+    cache->buckets = (Entry **) calloc(capacity, sizeof(Entry *));
+    assert(cache->buckets);
+    cache->capacity = capacity;
+
+    cache->entries = (Entry *) malloc(capacity * sizeof(Entry));
+    assert(cache->entries);
+    cache->used = 0;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+int cache_key_equal(CacheKey *a, CacheKey *b) {
+    return a->difficulty == b->difficulty && a->start == b->start
+        && 0 == memcmp(a->seed, b->seed, 32);
+}
+
+int cache_get(Cache *cache, CacheKey *key, uint64_t *solution) {
+    pthread_mutex_lock(&cache->mutex);
+
+    Entry *entry = *find(cache, key);
+    if (entry != NULL) {
+        *solution = entry->solution;
+
+        // move it to the front of the LRU list
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return entry != NULL;
+}
+
+void cache_put(Cache *cache, CacheKey *key, uint64_t solution) {
+    pthread_mutex_lock(&cache->mutex);
+
+    Entry *entry = *find(cache, key);
+    if (entry != NULL) {
+        // already cached (any solution is as good as another)
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+
+    if (cache->used >= cache->capacity) {
+        // evict the least recently used, reusing its entry
+        entry = cache->oldest;
+        lru_unlink(cache, entry);
+        Entry **prev = find(cache, &entry->key);
+        *prev = entry->next;
+    } else {
+        entry = cache->entries + cache->used++;
+    }
+
+    entry->key = *key;
+    entry->solution = solution;
+    lru_push(cache, entry);
+
+    Entry **bucket = cache->buckets + hash_key(key) % cache->bucket_count;
+    entry->next = *bucket;
+    *bucket = entry;
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void cache_stats(Cache *cache, uint64_t *hits, uint64_t *misses) {
+    pthread_mutex_lock(&cache->mutex);
+    *hits = cache->hits;
+    *misses = cache->misses;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void cache_destroy(Cache *cache) {
+    free(cache->entries);
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Returns the link pointing to the entry with the given key, which points to
+ * NULL if there isn't one.
+ * Note: must be called with the mutex held.
+ */
+Entry **find(Cache *cache, CacheKey *key) {
+    Entry **link = cache->buckets + hash_key(key) % cache->bucket_count;
+    while (*link != NULL && !cache_key_equal(&(*link)->key, key)) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+/*
+ * Takes the given entry out of the LRU list.
+ * Note: must be called with the mutex held.
+ */
+void lru_unlink(Cache *cache, Entry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+/*
+ * Adds the given entry to the front of the LRU list, as the most recently
+ * used.
+ * Note: must be called with the mutex held.
+ */
+void lru_push(Cache *cache, Entry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/*
+ * FNV-1a over the fields of the key.
+ */
+uint32_t hash_key(CacheKey *key) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((key->difficulty >> (8 * i)) & 0xff)) * 16777619u;
+    }
+    for (int i = 0; i < 32; i++) {
+        hash = (hash ^ key->seed[i]) * 16777619u;
+    }
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ ((key->start >> (8 * i)) & 0xff)) * 16777619u;
+    }
+
+    return hash;
+}
@@ -0,0 +1,62 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * A thread safe, bounded cache of solved WORK jobs, evicting the least
+ * recently used one when full.
+ * Every entry is allocated up front, so storing a solution never allocates.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+/*
+ * What identifies a WORK job (the worker count doesn't change what a valid
+ * solution is).
+ */
+typedef struct {
+    uint32_t difficulty;
+    BYTE seed[32];
+    uint64_t start;
+} CacheKey;
+
+/*
+ * Struct for a cache.
+ * Internals are private.
+ */
+typedef struct Cache Cache;
+
+/*
+ * Create a new empty cache, holding at most capacity solutions.
+ */
+Cache *cache_init(int capacity);
+
+/*
+ * Returns true if the two keys are for the same job.
+ */
+int cache_key_equal(CacheKey *a, CacheKey *b);
+
+/*
+ * Looks up the solution for the given job, counting a hit or a miss.
+ * Returns 1 and sets solution if it's cached, 0 if not.
+ */
+int cache_get(Cache *cache, CacheKey *key, uint64_t *solution);
+
+/*
+ * Stores the solution for the given job.
+ */
+void cache_put(Cache *cache, CacheKey *key, uint64_t solution);
+
+/*
+ * Gets the number of cache_get hits and misses so far.
+ */
+void cache_stats(Cache *cache, uint64_t *hits, uint64_t *misses);
+
+/*
+ * Used to deallocate the given cache.
+ */
+void cache_destroy(Cache *cache);
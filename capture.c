@@ -0,0 +1,169 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+// the size of a record without its payload
+#define RECORD_HEADER_LEN (8 + 8 + 1 + 1 + 1)
+
+// how much is buffered before it's written out, and how often it's written
+// out anyway
+#define BUFFER_LEN (256 * 1024)
+#define FLUSH_MS 100
+
+int capture_enabled = 0;
+
+// the capture file, everything is protected by the mutex
+FILE *capture_file = NULL;
+uint64_t capture_start = 0;
+pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/***** Helper function prototypes
+ */
+
+void *capture_writer(void *_);
+uint64_t capture_now(void);
+
+
+/***** Public functions
+ */
+
+int capture_init(char *path) {
+    if (capture_enabled) { return 0; }
+
+    capture_file = fopen(path, "wb");
+    if (capture_file == NULL) {
+        perror("ERROR: opening capture file");
+        return 1;
+    }
+    setvbuf(capture_file, NULL, _IOFBF, BUFFER_LEN);
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capture_file);
+
+    capture_start = capture_now();
+    capture_enabled = 1;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, capture_writer, NULL);
+    atexit(capture_flush);
+
+    return 0;
+}
+
+void capture_record(uint64_t conn, CaptureEvent event, SSTPMsgType type,
+        char *payload, int payload_len) {
+    if (!capture_enabled) {
+        return;
+    }
+    if (payload == NULL || type == MALFORMED) {
+        payload_len = 0;
+    }
+
+    char record[RECORD_HEADER_LEN + MAX_PAYLOAD_LEN];
+    memcpy(record + 8, &conn, 8);
+    record[16] = event;
+    record[17] = type;
+    record[18] = payload_len;
+    memcpy(record + RECORD_HEADER_LEN, payload, payload_len);
+
+    // the time is taken under the lock, so the records are in order
+    pthread_mutex_lock(&capture_mutex);
+    uint64_t ns = capture_now() - capture_start;
+    memcpy(record, &ns, 8);
+    fwrite(record, 1, RECORD_HEADER_LEN + payload_len, capture_file);
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+void capture_flush(void) {
+    if (!capture_enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&capture_mutex);
+    fflush(capture_file);
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+FILE *capture_open(char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    char magic[CAPTURE_MAGIC_LEN];
+    if (CAPTURE_MAGIC_LEN != fread(magic, 1, CAPTURE_MAGIC_LEN, file)
+            || 0 != memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN)) {
+        fclose(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+int capture_read(FILE *file, CaptureRecord *record) {
+    char header[RECORD_HEADER_LEN];
+    size_t n = fread(header, 1, RECORD_HEADER_LEN, file);
+    if (n == 0) {
+        return 0;
+    }
+    if (n != RECORD_HEADER_LEN) {
+        return -1;
+    }
+
+    memcpy(&record->ns, header, 8);
+    memcpy(&record->conn, header + 8, 8);
+    record->event = header[16];
+    record->type = header[17];
+    record->payload_len = (unsigned char) header[18];
+
+    if (record->event > CAPTURE_OUT || record->type > MALFORMED
+            || record->payload_len > MAX_PAYLOAD_LEN
+            || (size_t) record->payload_len != fread(record->payload, 1,
+                record->payload_len, file)) {
+        return -1;
+    }
+    record->payload[record->payload_len] = '\0';
+
+    return 1;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * The background thread, which writes the capture out every so often.
+ */
+void *capture_writer(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    struct timespec interval = { 0, FLUSH_MS * 1000000L };
+    while (1) {
+        nanosleep(&interval, NULL);
+        capture_flush();
+    }
+
+    return NULL;
+}
+
+/*
+ * The current (monotonic) time in nanoseconds.
+ */
+uint64_t capture_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
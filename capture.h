@@ -0,0 +1,86 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The capture module. Records every msg the server receives and sends (and
+ * every connection opening and closing), with when it happened, to a compact
+ * binary file that sstp-replay can play back against a server.
+ *
+ * The file is CAPTURE_MAGIC followed by one record per event, each a fixed
+ * header (in the machine's byte order):
+ *   time (8 bytes): nanoseconds since the capture started
+ *   connection (8 bytes): the connection's id
+ *   event (1 byte): a CaptureEvent
+ *   type (1 byte): the msg's SSTPMsgType
+ *   payload length (1 byte)
+ * followed by the msg's payload (without a null terminator).
+ * A MALFORMED msg's payload isn't kept, only that it was malformed.
+ *
+ * The file is written out every so often (and at exit), so everything up to
+ * a moment ago is there even if the server is killed.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sstp.h"
+
+#define CAPTURE_MAGIC "SSTPCAP1"
+#define CAPTURE_MAGIC_LEN 8
+
+typedef enum {
+    CAPTURE_OPEN,  // a client connected
+    CAPTURE_CLOSE, // and disconnected
+    CAPTURE_IN,    // a msg from the client
+    CAPTURE_OUT    // a msg to the client
+} CaptureEvent;
+
+/*
+ * A single record, as read back by capture_read.
+ */
+typedef struct {
+    uint64_t ns;
+    uint64_t conn;
+    CaptureEvent event;
+    SSTPMsgType type;
+    int payload_len;
+    char payload[MAX_PAYLOAD_LEN + 1]; // null terminated
+} CaptureRecord;
+
+// whether the server is capturing
+extern int capture_enabled;
+
+/*
+ * Starts capturing to the given file.
+ * Returns non-zero if the file couldn't be opened.
+ */
+int capture_init(char *path);
+
+/*
+ * Records an event, if capturing, payload can be NULL if there is none.
+ * Note: thread safe.
+ */
+void capture_record(uint64_t conn, CaptureEvent event, SSTPMsgType type,
+        char *payload, int payload_len);
+
+/*
+ * Writes out everything captured so far.
+ * Note: also done at exit.
+ */
+void capture_flush(void);
+
+/*
+ * Opens the given capture to be read.
+ * Returns NULL if it couldn't be opened or isn't a capture.
+ */
+FILE *capture_open(char *path);
+
+/*
+ * Reads the next record from the given capture.
+ * Returns 1 on success, 0 at the end of the capture, and -1 if it's cut off
+ * or corrupt.
+ */
+int capture_read(FILE *file, CaptureRecord *record);
@@ -4,3 +4,4 @@ def pytest_addoption(parser):
     parser.addoption('--digitalis', action='store_true', help='connect to digitalis')
     parser.addoption('--digitalis2', action='store_true', help='connect to digitalis2')
     parser.addoption('--port', action='store', type=int, help='which port to use')
+    parser.addoption('--metrics-port', action='store', type=int, help='the port the server serves its metrics on (its -m option)')
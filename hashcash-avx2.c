@@ -0,0 +1,17 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The 8 lane AVX2 search kernel.
+ * Built with the matching instruction set enabled (see the Makefile), and only
+ * ever called when the cpu supports it.
+ *
+ */
+
+#ifdef __AVX2__
+
+#define KERNEL_NAME hashcash_kernel_avx2
+#define KERNEL_LANES 8
+#include "hashcash-kernel.h"
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The 16 lane AVX-512 search kernel.
+ * Built with the matching instruction set enabled (see the Makefile), and only
+ * ever called when the cpu supports it.
+ *
+ */
+
+#ifdef __AVX512F__
+
+#define KERNEL_NAME hashcash_kernel_avx512
+#define KERNEL_LANES 16
+#include "hashcash-kernel.h"
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Internals of the hashcash module, shared between hashcash.c and the
+ * vectorized search kernels (hashcash-sse4.c, hashcash-avx2.c and
+ * hashcash-avx512.c).
+ *
+ * The search kernel is written once, over a vector of KERNEL_LANES words, and
+ * each of those files instantiates it by defining KERNEL_NAME and KERNEL_LANES
+ * before including this header.
+ * Each lane hashes one of KERNEL_LANES consecutive nonces.
+ *
+ */
+
+#pragma once
+
+#include <string.h>
+#include <stdint.h>
+
+#include "sha256.h"
+#include "hashcash.h"
+
+// the most lanes any kernel has
+#define MAX_KERNEL_LANES 16
+
+/*
+ * A search kernel.
+ * Computes the double sha256 for each of the nonces start, start + 1, ...
+ * (one per lane), but only compares the first word of each hash against the
+ * first word of the target (the digest is never serialized).
+ * Returns a mask of the lanes whose first word is less than the target's,
+ * which are definitely solutions, and sets near to the mask of lanes whose
+ * first word is equal, which need the full comparison.
+ */
+typedef unsigned (*HashcashKernel)(HashcashSearch *search, uint64_t start,
+        unsigned *near);
+
+unsigned hashcash_kernel_sse4(HashcashSearch *search, uint64_t start,
+        unsigned *near);
+unsigned hashcash_kernel_avx2(HashcashSearch *search, uint64_t start,
+        unsigned *near);
+unsigned hashcash_kernel_avx512(HashcashSearch *search, uint64_t start,
+        unsigned *near);
+
+
+/***** sha256 rounds
+ * These work on both plain WORDs and vectors of WORDs.
+ */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x)  (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define EP1(x)  (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+// a single sha256 round, the caller rotates the variable names
+#define ROUND(a, b, c, d, e, f, g, h, i, w) do { \
+        __typeof__(h) t1 = (h) + EP1(e) + CH(e, f, g) + k[i] + (w); \
+        __typeof__(h) t2 = EP0(a) + MAJ(a, b, c); \
+        (d) += t1; \
+        (h) = t1 + t2; \
+    } while (0)
+
+// eight rounds starting at round i, W(i) gives the schedule word for round i
+#define ROUNDS8(i, W) do { \
+        ROUND(a, b, c, d, e, f, g, h, (i) + 0, W((i) + 0)); \
+        ROUND(h, a, b, c, d, e, f, g, (i) + 1, W((i) + 1)); \
+        ROUND(g, h, a, b, c, d, e, f, (i) + 2, W((i) + 2)); \
+        ROUND(f, g, h, a, b, c, d, e, (i) + 3, W((i) + 3)); \
+        ROUND(e, f, g, h, a, b, c, d, (i) + 4, W((i) + 4)); \
+        ROUND(d, e, f, g, h, a, b, c, (i) + 5, W((i) + 5)); \
+        ROUND(c, d, e, f, g, h, a, b, (i) + 6, W((i) + 6)); \
+        ROUND(b, c, d, e, f, g, h, a, (i) + 7, W((i) + 7)); \
+    } while (0)
+
+// message schedule expansion, for rounds 16 onwards
+#define EXPAND(w, i) \
+    ((w)[i] = SIG1((w)[(i) - 2]) + (w)[(i) - 7] + SIG0((w)[(i) - 15]) + (w)[(i) - 16])
+
+static const WORD k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const WORD iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+
+/***** The search kernel
+ */
+
+#ifdef KERNEL_LANES
+
+#if KERNEL_LANES == 1
+typedef WORD Vec;
+#define BROADCAST(x) (x)
+#else
+typedef WORD Vec __attribute__((vector_size(4 * KERNEL_LANES)));
+#define BROADCAST(x) ((Vec){ 0 } + (WORD) (x))
+#endif
+
+unsigned KERNEL_NAME(HashcashSearch *search, uint64_t start, unsigned *near) {
+    WORD *pre = search->schedule;
+    Vec w[64];
+    Vec hi, lo;
+
+    // spread the nonces over the lanes
+    WORD hi_lanes[KERNEL_LANES];
+    WORD lo_lanes[KERNEL_LANES];
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        uint64_t nonce = start + i;
+        hi_lanes[i] = nonce >> 32;
+        lo_lanes[i] = nonce & 0xffffffff;
+    }
+    memcpy(&hi, hi_lanes, sizeof(Vec));
+    memcpy(&lo, lo_lanes, sizeof(Vec));
+
+    // first hash, starting from the midstate
+    // finish off the partially precomputed schedule words
+    w[8] = hi;
+    w[9] = lo;
+    w[10] = BROADCAST(pre[10]); w[11] = BROADCAST(pre[11]);
+    w[12] = BROADCAST(pre[12]); w[13] = BROADCAST(pre[13]);
+    w[14] = BROADCAST(pre[14]); w[15] = BROADCAST(pre[15]);
+    w[16] = pre[16] + lo;
+    w[17] = BROADCAST(pre[17]);
+    w[18] = pre[18] + SIG1(w[16]);
+    w[19] = BROADCAST(pre[19]);
+    w[20] = pre[20] + SIG1(w[18]);
+    w[21] = BROADCAST(pre[21]);
+    w[22] = pre[22] + SIG1(w[20]);
+    w[23] = pre[23] + w[16] + SIG0(hi);
+    w[24] = pre[24] + SIG1(w[22]) + SIG0(lo) + hi;
+
+    Vec a = BROADCAST(search->midstate[0]), b = BROADCAST(search->midstate[1]),
+        c = BROADCAST(search->midstate[2]), d = BROADCAST(search->midstate[3]),
+        e = BROADCAST(search->midstate[4]), f = BROADCAST(search->midstate[5]),
+        g = BROADCAST(search->midstate[6]), h = BROADCAST(search->midstate[7]);
+
+#define W(i) ((i) < 25 ? w[i] : EXPAND(w, i))
+    ROUNDS8(8, W);
+    ROUNDS8(16, W);
+    ROUNDS8(24, W);
+    ROUNDS8(32, W);
+    ROUNDS8(40, W);
+    ROUNDS8(48, W);
+    ROUNDS8(56, W);
+#undef W
+
+    // second hash, over the first hash's digest
+    // which is a single block of: digest (8 words), padding, length (256 bits)
+    w[0] = a + iv[0]; w[1] = b + iv[1]; w[2] = c + iv[2]; w[3] = d + iv[3];
+    w[4] = e + iv[4]; w[5] = f + iv[5]; w[6] = g + iv[6]; w[7] = h + iv[7];
+    w[8] = BROADCAST(0x80000000);
+    w[9] = w[10] = w[11] = w[12] = w[13] = w[14] = BROADCAST(0);
+    w[15] = BROADCAST(32 * 8);
+
+    a = BROADCAST(iv[0]); b = BROADCAST(iv[1]);
+    c = BROADCAST(iv[2]); d = BROADCAST(iv[3]);
+    e = BROADCAST(iv[4]); f = BROADCAST(iv[5]);
+    g = BROADCAST(iv[6]); h = BROADCAST(iv[7]);
+
+#define W(i) ((i) < 16 ? w[i] : EXPAND(w, i))
+    ROUNDS8(0, W);
+    ROUNDS8(8, W);
+    ROUNDS8(16, W);
+    ROUNDS8(24, W);
+    ROUNDS8(32, W);
+    ROUNDS8(40, W);
+    ROUNDS8(48, W);
+    ROUNDS8(56, W);
+#undef W
+
+    // only the first word of the final state decides almost every nonce,
+    // so the rest of the final state is never added up
+    Vec first = a + iv[0];
+    Vec target = BROADCAST(search->target[0]);
+    __typeof__(first < target) below = first < target;
+    __typeof__(first < target) equal = first == target;
+
+    int32_t below_lanes[KERNEL_LANES];
+    int32_t equal_lanes[KERNEL_LANES];
+    memcpy(below_lanes, &below, sizeof(below_lanes));
+    memcpy(equal_lanes, &equal, sizeof(equal_lanes));
+
+    unsigned hits = 0;
+    *near = 0;
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        hits |= (unsigned) (below_lanes[i] != 0) << i;
+        *near |= (unsigned) (equal_lanes[i] != 0) << i;
+    }
+    return hits;
+}
+
+#endif // KERNEL_LANES
@@ -0,0 +1,17 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The 4 lane SSE4.1 search kernel.
+ * Built with the matching instruction set enabled (see the Makefile), and only
+ * ever called when the cpu supports it.
+ *
+ */
+
+#ifdef __SSE4_1__
+
+#define KERNEL_NAME hashcash_kernel_sse4
+#define KERNEL_LANES 4
+#include "hashcash-kernel.h"
+
+#endif
@@ -6,20 +6,61 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
-#include "uint256.h"
+#include "u256.h"
 #include "sha256.h"
 
 #include "hashcash.h"
 
+// the scalar kernel, ie. search_hash, is the single lane instantiation
+#define KERNEL_NAME search_hash
+#define KERNEL_LANES 1
+#include "hashcash-kernel.h"
+
+/*
+ * A search kernel and what's needed to pick it.
+ */
+typedef struct {
+    char *name;
+    int lanes;
+    HashcashKernel func;
+    int (*is_supported)(void);
+} KernelInfo;
+
+int always_supported(void);
+#if defined(__x86_64__)
+int sse4_supported(void);
+int avx2_supported(void);
+int avx512_supported(void);
+#endif
+
+// all the kernels, from most to least preferred
+static KernelInfo kernels[] = {
+#if defined(__x86_64__)
+    { "avx512", 16, hashcash_kernel_avx512, avx512_supported },
+    { "avx2",    8, hashcash_kernel_avx2,   avx2_supported },
+    { "sse4",    4, hashcash_kernel_sse4,   sse4_supported },
+#endif
+    { "scalar",  1, search_hash,            always_supported },
+};
+#define KERNELS_LEN (sizeof(kernels) / sizeof(kernels[0]))
+
+// the kernel used by hashcash_search
+static KernelInfo *active_kernel = NULL;
+
 
 /***** Helper function prototypes
  */
 
-void uint256_init_with_value(BYTE *uint256, uint64_t value);
 void concat(BYTE *dst, BYTE *seed, uint64_t nonce);
 void sha256twice(BYTE *hash, BYTE *data, int len);
+WORD load_be32(BYTE *src);
+unsigned search_hash(HashcashSearch *search, uint64_t start, unsigned *near);
+static inline int search_loop(HashcashSearch *search, uint64_t start,
+        uint64_t count, uint64_t *solution);
 
 
 /***** Public functions
@@ -38,36 +79,119 @@ int hashcash_verify(BYTE *target, BYTE *seed, uint64_t solution) {
 }
 
 void hashcash_calc_target(BYTE *target, uint32_t difficulty) {
-    BYTE alpha[32];
-    BYTE beta[32];
-    BYTE two[32];
+    // target = mantissa * 2^(8 * (exponent - 3)), ie. the mantissa shifted
+    // left by whole bytes
+    // exponents below 3 wrap around to a huge shift, which leaves zero, same
+    // as the original 2^(8 * (exponent - 3)) overflowing did
+    uint32_t shift = 8 * ((difficulty >> 24) - 3);
+    U256 mantissa = u256_from_u64(difficulty & 0xffffff);
 
-    uint256_init_with_value(beta, difficulty & 0xffffff);
+    u256_to_bytes(u256_shl(mantissa, shift), target);
+}
 
-    uint256_init_with_value(two, 2);
-    uint256_exp(alpha, two, 8 * ((difficulty >> 24) - 3));
+double hashcash_expected_hashes(BYTE *target) {
+    // only needs to be roughly right, so doubles will do
+    double t = 0;
+    for (int i = 0; i < 32; i++) {
+        t = t * 256 + target[i];
+    }
 
-    uint256_mul(target, beta, alpha);
+    return 1.157920892373162e77 / (t + 1); // 2^256
 }
 
 
-/***** Helper functions
- */
+void hashcash_search_init(HashcashSearch *search, BYTE *target, BYTE *seed) {
+    WORD *w = search->schedule;
+    int i;
 
-/*
- * Initializes the given uint256 values with the given initial value.
- */
-void uint256_init_with_value(BYTE *uint256, uint64_t value) {
-    if (uint256 == NULL) {
-        return;
+    memcpy(search->seed_bytes, seed, 32);
+    memcpy(search->target_bytes, target, 32);
+
+    for (i = 0; i < 8; i++) {
+        search->target[i] = load_be32(target + 4 * i);
     }
 
-    for (int i = 31; i >= 0; i--) {
-        uint256[i] = value & 0xff;
-        value = value >> 8;
+    // the first hash is over a single block:
+    //      seed (8 words), nonce (2 words), padding, length (320 bits)
+    for (i = 0; i < 8; i++) {
+        w[i] = load_be32(seed + 4 * i);
     }
+    w[8] = w[9] = 0; // the nonce
+    w[10] = 0x80000000;
+    w[11] = w[12] = w[13] = w[14] = 0;
+    w[15] = 40 * 8;
+
+    // precompute what doesn't depend on the nonce (w[8] and w[9]) from the
+    // start of the expanded schedule
+    // whole words are stored for w17, w19 and w21, the rest are partial sums
+    // that search_hash finishes off
+    w[16] = SIG1(w[14]) + SIG0(w[1]) + w[0];
+    w[17] = SIG1(w[15]) + w[10] + SIG0(w[2]) + w[1];
+    w[18] = w[11] + SIG0(w[3]) + w[2];
+    w[19] = SIG1(w[17]) + w[12] + SIG0(w[4]) + w[3];
+    w[20] = w[13] + SIG0(w[5]) + w[4];
+    w[21] = SIG1(w[19]) + w[14] + SIG0(w[6]) + w[5];
+    w[22] = w[15] + SIG0(w[7]) + w[6];
+    w[23] = SIG1(w[21]) + w[7];
+    w[24] = w[17];
+
+    // the first eight rounds only read the seed, so run them now
+    WORD a = iv[0], b = iv[1], c = iv[2], d = iv[3],
+         e = iv[4], f = iv[5], g = iv[6], h = iv[7];
+#define W(i) w[i]
+    ROUNDS8(0, W);
+#undef W
+    search->midstate[0] = a;
+    search->midstate[1] = b;
+    search->midstate[2] = c;
+    search->midstate[3] = d;
+    search->midstate[4] = e;
+    search->midstate[5] = f;
+    search->midstate[6] = g;
+    search->midstate[7] = h;
+}
+
+int hashcash_search_verify(HashcashSearch *search, uint64_t nonce) {
+    return search_loop(search, nonce, 1, &nonce);
+}
+
+int hashcash_search(HashcashSearch *search, uint64_t start, uint64_t count,
+        uint64_t *solution) {
+    return search_loop(search, start, count, solution);
+}
+
+int hashcash_kernel_select(char *name) {
+    if (name == NULL) {
+        name = getenv("HASHCASH_KERNEL");
+    }
+    int pick_best = name == NULL || 0 == strcmp(name, "auto");
+
+    for (size_t i = 0; i < KERNELS_LEN; i++) {
+        if ((pick_best || 0 == strcmp(name, kernels[i].name))
+                && kernels[i].is_supported()) {
+            active_kernel = kernels + i;
+            return 0;
+        }
+    }
+
+    // unknown or unsupported, so fall back to the best one
+    if (active_kernel == NULL) {
+        hashcash_kernel_select("auto");
+    }
+    return -1;
 }
 
+char *hashcash_kernel_name(void) {
+    if (active_kernel == NULL) {
+        hashcash_kernel_select(NULL);
+    }
+    return active_kernel->name;
+}
+
+
+/***** Helper functions
+ */
+
 /*
  * Helper function to concatenate the given seed and nonce value,
  * and copy the result into the destination array.
@@ -103,3 +227,77 @@ void sha256twice(BYTE *hash, BYTE *data, int len) {
     sha256_update(&ctx, hash, 32);
     sha256_final(&ctx, hash);
 }
+
+/*
+ * Reads a big-endian word from the given bytes.
+ */
+WORD load_be32(BYTE *src) {
+    return ((WORD) src[0] << 24) | ((WORD) src[1] << 16)
+        | ((WORD) src[2] << 8) | (WORD) src[3];
+}
+
+/*
+ * The search loop behind hashcash_search.
+ * A hash whose first word is below the target's is a solution without looking
+ * any further, one whose first word is equal (a near hit, one in 2^32 nonces,
+ * and the only kind there is when the target's first word is zero) gets the
+ * full comparison.
+ */
+static inline int search_loop(HashcashSearch *search, uint64_t start,
+        uint64_t count, uint64_t *solution) {
+    if (active_kernel == NULL) {
+        hashcash_kernel_select(NULL);
+    }
+
+    HashcashKernel func = active_kernel->func;
+    int lanes = active_kernel->lanes;
+    unsigned hits;
+    unsigned near;
+    uint64_t i = 0;
+
+    while (i < count) {
+        // finish off with the scalar kernel when there aren't enough nonces
+        // left to fill every lane
+        if (count - i < (uint64_t) lanes) {
+            func = search_hash;
+            lanes = 1;
+        }
+
+        hits = func(search, start + i, &near);
+
+        // the lanes are in nonce order, so the first match is the lowest
+        for (int lane = 0; (hits | near) >> lane; lane++) {
+            uint64_t nonce = start + i + lane;
+            if (((hits >> lane) & 1) || (((near >> lane) & 1)
+                        && hashcash_verify(search->target_bytes,
+                            search->seed_bytes, nonce))) {
+                *solution = nonce;
+                return 1;
+            }
+        }
+        i += lanes;
+    }
+
+    return 0;
+}
+
+/*
+ * Cpu feature checks for each kernel.
+ */
+int always_supported(void) {
+    return 1;
+}
+#if defined(__x86_64__)
+int sse4_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+int avx2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+int avx512_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
@@ -9,6 +9,32 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include "sha256.h"
+
+/*
+ * A search that has been prepared for a single seed and target.
+ * Everything in the double sha256 that doesn't depend on the nonce is
+ * computed once up front, so that testing each nonce only does the rounds
+ * that actually change.
+ */
+typedef struct {
+    // the target as big-endian words, so it compares directly against the
+    // state words of the final hash
+    WORD target[8];
+
+    // the original seed and target, for the full comparison on a near hit
+    BYTE seed_bytes[32];
+    BYTE target_bytes[32];
+
+    // the state of the first hash after the rounds that only read the seed
+    WORD midstate[8];
+
+    // the nonce independent (parts of the) first hash's message schedule
+    WORD schedule[25];
+} HashcashSearch;
+
 /*
  * Verifies that the given solution is indeed valid for the given seed and
  * target.
@@ -20,3 +46,45 @@ int hashcash_verify(BYTE *target, BYTE *seed, uint64_t solution);
  * Converts the given difficulty value into the target (a uint256).
  */
 void hashcash_calc_target(BYTE *target, uint32_t difficulty);
+
+/*
+ * The expected number of hashes needed to find a solution below the given
+ * target, ie. 2^256 / (target + 1).
+ */
+double hashcash_expected_hashes(BYTE *target);
+
+/*
+ * Prepares the given search for the given target and seed.
+ */
+void hashcash_search_init(HashcashSearch *search, BYTE *target, BYTE *seed);
+
+/*
+ * Same as hashcash_verify but for a prepared search.
+ * Returns 1 if the nonce is a valid solution and 0 otherwise.
+ */
+int hashcash_search_verify(HashcashSearch *search, uint64_t nonce);
+
+/*
+ * Searches the count nonces starting at start for a valid solution.
+ * The nonces are tested in order, using the selected kernel.
+ * Returns 1 and sets solution to the first valid nonce if there is one,
+ * otherwise returns 0.
+ */
+int hashcash_search(HashcashSearch *search, uint64_t start, uint64_t count,
+        uint64_t *solution);
+
+/*
+ * Selects the kernel used by hashcash_search by name:
+ *   "scalar", "sse4" (4 lanes), "avx2" (8 lanes) or "avx512" (16 lanes).
+ * If name is NULL the HASHCASH_KERNEL environment variable is used instead,
+ * and if that isn't set (or is "auto"), the fastest kernel supported by the
+ * cpu is picked.
+ * Returns 0 on success and -1 if the kernel is unknown or the cpu doesn't
+ * support it (in which case the fastest supported kernel is kept).
+ */
+int hashcash_kernel_select(char *name);
+
+/*
+ * The name of the selected kernel.
+ */
+char *hashcash_kernel_name(void);
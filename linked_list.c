@@ -10,13 +10,17 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "pool.h"
 #include "linked_list.h"
 
+// every list and node comes from (and goes back to) these
+Pool list_pool = POOL_INITIALIZER(sizeof(LinkedList), _Alignof(LinkedList));
+Pool node_pool = POOL_INITIALIZER(sizeof(Node), _Alignof(Node));
+
 Node *_new_node();
 
 LinkedList *linked_list_init() {
-    LinkedList *ll = (LinkedList*)malloc(sizeof(LinkedList));
-    assert(ll);
+    LinkedList *ll = (LinkedList*)pool_alloc(&list_pool);
 
     ll->head = NULL;
     ll->tail = NULL;
@@ -123,7 +127,7 @@ void *linked_list_pop(LinkedList *ll, Node *node) {
         ll->tail = prev;
     }
 
-    free(node);
+    pool_free(&node_pool, node);
 
     ll->len--;
 
@@ -135,7 +139,7 @@ void linked_list_destroy(LinkedList *ll) {
         linked_list_pop_start(ll);
     }
 
-    free(ll);
+    pool_free(&list_pool, ll);
 }
 
 void linked_list_print(LinkedList *ll, void (*print_node)(void*)) {
@@ -158,8 +162,7 @@ void linked_list_print(LinkedList *ll, void (*print_node)(void*)) {
  * Simple helper to allocate a new node
  */
 Node *_new_node() {
-    Node *n = (Node*)malloc(sizeof(Node));
-    assert(n);
+    Node *n = (Node*)pool_alloc(&node_pool);
 
     n->next = NULL;
     n->prev = NULL;
@@ -5,6 +5,8 @@
  * A generic doubly linked list implementation. Uses a Node struct as the
  * elements of the list, each Node having a void* field called data for
  * external data.
+ * The lists and nodes come from pools (see pool.h), so pushing and popping
+ * doesn't go to the heap once they're warmed up.
  *
  */
 
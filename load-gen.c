@@ -0,0 +1,676 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * SSTP load generator.
+ *
+ * Opens a number of connections to a running server, spread over a few
+ * threads (each with an epoll instance of its own), and keeps each of them
+ * busy with a mix of PING, SOLN, WORK and ABRT msgs, with up to WINDOW of
+ * them in flight (pipelined) at once.
+ * Every reply is checked against the msg it answers, and every solution the
+ * server sends back is checked with hashcash_verify.
+ * Prints one "benchmark,value,unit" line per result (the same as
+ * hashcash-bench):
+ *   load/TYPE/rate: the replies to TYPE msgs received per second
+ *   load/TYPE/p50, p99 and p999: the latency from sending a TYPE msg to its
+ *                                reply
+ *   load/all/rate: every reply received per second
+ *   load/errors: the replies that were wrong, and connections that were lost
+ *   load/stale: SOLNs for WORK that had already been aborted
+ *   load/unanswered: msgs still in flight at the end
+ * Exits with 1 if there were any errors.
+ *
+ * Usage: ./sstp-load-gen [-a ADDRESS] [-c CONNECTIONS] [-t THREADS] [-d MS]
+ *                        [-w WINDOW] [-m MIX] [-r RATE] [-x DIFFICULTY] PORT
+ *   PORT: the port the server is listening on.
+ *   ADDRESS: the server's (ipv4) address, defaults to 127.0.0.1.
+ *   CONNECTIONS: how many connections to open, defaults to 100.
+ *   THREADS: how many threads drive the connections, defaults to 2.
+ *   MS: how long to send msgs for, defaults to 5000.
+ *   WINDOW: how many msgs each connection has in flight at once, defaults
+ *           to 1 (ie. no pipelining).
+ *   MIX: the relative rates of each msg, a comma separated list of
+ *        ping=N, soln=N, work=N and abrt=N (the ones left out aren't sent),
+ *        defaults to ping=70,soln=20,work=8,abrt=2.
+ *   RATE: the most msgs sent per second (over every connection), defaults to
+ *         0, ie. as fast as the replies come back.
+ *   DIFFICULTY: of the WORK and SOLN msgs, defaults to 1fffffff (about 256
+ *               hashes each).
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sstp.h"
+#include "sstp-socket-wrapper.h"
+#include "hashcash.h"
+#include "metrics.h"
+
+#define MAX_THREADS 256
+#define MAX_WINDOW 64
+#define MAX_EVENTS 64
+
+// how many kinds of msgs there are (the last one being MALFORMED)
+#define MSG_TYPES (MALFORMED + 1)
+
+// how many (pre-solved) SOLN msgs are sent
+#define SOLN_COUNT 16
+
+// what a SOLN reply has in common with its WORK, the difficulty and seed
+#define PREFIX_LEN (8 + 1 + 64)
+
+char *type_names[] = {
+    "PING", "PONG", "OKAY", "ERRO", "SOLN", "WORK", "ABRT", "MALFORMED"
+};
+char *type_labels[] = {
+    "type=\"PING\"", "type=\"PONG\"", "type=\"OKAY\"", "type=\"ERRO\"",
+    "type=\"SOLN\"", "type=\"WORK\"", "type=\"ABRT\"",
+    "type=\"MALFORMED\""
+};
+
+/*
+ * A msg in flight.
+ */
+typedef struct {
+    SSTPMsgType type;
+    uint64_t sent_at;
+
+    // for WORK
+    char payload[MAX_PAYLOAD_LEN + 1];
+    uint64_t start;
+} Request;
+
+/*
+ * A single connection to the server.
+ */
+typedef struct {
+    int sockfd;
+    SSTPSocketWrapper *sstp;
+    int dead;
+
+    // the msgs in flight, in the order they were sent
+    Request requests[MAX_WINDOW];
+    int len;
+} LoadConn;
+
+/*
+ * A thread driving some of the connections, and what it saw.
+ */
+typedef struct {
+    pthread_t tid;
+    int conn_count;
+    LoadConn *conns;
+    uint64_t random;
+    double budget; // how many msgs it can send, if the rate is limited
+
+    long replies[MSG_TYPES]; // by the type of msg they answered
+    long errors;
+    long stale;
+    long unanswered;
+} Worker;
+
+// the configuration
+struct sockaddr_in server_addr;
+int window = 1;
+int mix[MSG_TYPES];
+int mix_total = 0;
+double rate = 0;
+uint64_t duration = 5000000000;
+uint32_t difficulty = 0x1fffffff;
+int thread_count = 2;
+
+// the SOLN msgs (which all have valid solutions) to send
+char solns[SOLN_COUNT][MAX_PAYLOAD_LEN + 1];
+
+// the latency of each msg type
+Metric *latency[MSG_TYPES];
+
+pthread_barrier_t connected;
+
+
+/***** Helper function prototypes
+ */
+
+int parse_mix(char *names);
+void make_solns(void);
+void *drive(void *pworker);
+int connect_to(void);
+void fill(Worker *worker, LoadConn *conn);
+void send_next(Worker *worker, LoadConn *conn);
+SSTPMsgType pick_type(Worker *worker);
+void receive(Worker *worker, LoadConn *conn);
+void reply(Worker *worker, LoadConn *conn, SSTPMsg *msg);
+void reply_soln(Worker *worker, LoadConn *conn, SSTPMsg *msg);
+void answered(Worker *worker, LoadConn *conn, int i);
+void conn_fail(Worker *worker, LoadConn *conn);
+void random_seed(Worker *worker, BYTE *seed, char *hex);
+uint64_t next_random(uint64_t *state);
+
+
+/***** Main functions
+ */
+
+int main(int argc, char *argv[]) {
+    char *address = "127.0.0.1";
+    int conn_count = 100;
+    char *mix_names = "ping=70,soln=20,work=8,abrt=2";
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "a:c:t:d:w:m:r:x:"))) {
+        switch (opt) {
+            case 'a':
+                address = optarg;
+                break;
+            case 'c':
+                conn_count = atoi(optarg);
+                break;
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 'd':
+                duration = atol(optarg) * (uint64_t) 1000000;
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'm':
+                mix_names = optarg;
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'x':
+                difficulty = strtoul(optarg, NULL, 16);
+                break;
+            default:
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "ERROR: no port provided\n");
+        exit(1);
+    }
+    if (conn_count < 1 || thread_count < 1 || thread_count > MAX_THREADS
+            || window < 1 || window > MAX_WINDOW || duration == 0
+            || rate < 0) {
+        fprintf(stderr, "ERROR: connections must be positive, threads 1-%d, "
+                "window 1-%d, and the time and rate positive\n",
+                MAX_THREADS, MAX_WINDOW);
+        exit(1);
+    }
+    if (0 != parse_mix(mix_names)) {
+        fprintf(stderr, "ERROR: bad mix\n");
+        exit(1);
+    }
+    if (thread_count > conn_count) {
+        thread_count = conn_count;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind]));
+    if (1 != inet_pton(AF_INET, address, &server_addr.sin_addr)) {
+        fprintf(stderr, "ERROR: bad address\n");
+        exit(1);
+    }
+
+    // there could be a lot of connections
+    struct rlimit limit;
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit)
+            && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    make_solns();
+    for (int t = 0; t < MSG_TYPES; t++) {
+        latency[t] = metrics_register(METRIC_HISTOGRAM, "load_latency_seconds",
+                type_labels[t], "Time from sending a msg to its reply.");
+    }
+
+    // split up the connections between the threads
+    Worker *workers = calloc(thread_count, sizeof(Worker));
+    assert(workers);
+    pthread_barrier_init(&connected, NULL, thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].conn_count = conn_count / thread_count
+            + (i < conn_count % thread_count);
+        workers[i].random = metrics_now() * (2 * i + 1) | 1;
+        pthread_create(&workers[i].tid, NULL, drive, (void *) (workers + i));
+    }
+
+    Worker total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(workers[i].tid, NULL);
+        for (int t = 0; t < MSG_TYPES; t++) {
+            total.replies[t] += workers[i].replies[t];
+        }
+        total.errors += workers[i].errors;
+        total.stale += workers[i].stale;
+        total.unanswered += workers[i].unanswered;
+    }
+
+    printf("benchmark,value,unit\n");
+
+    double seconds = duration / 1e9;
+    long replies = 0;
+    for (int t = 0; t < MSG_TYPES; t++) {
+        if (mix[t] == 0) {
+            continue;
+        }
+        replies += total.replies[t];
+
+        printf("load/%s/rate,%.6g,msgs/s\n", type_names[t],
+                total.replies[t] / seconds);
+        printf("load/%s/p50,%.6g,us\n", type_names[t],
+                metrics_quantile(latency[t], 0.5) * 1e6);
+        printf("load/%s/p99,%.6g,us\n", type_names[t],
+                metrics_quantile(latency[t], 0.99) * 1e6);
+        printf("load/%s/p999,%.6g,us\n", type_names[t],
+                metrics_quantile(latency[t], 0.999) * 1e6);
+    }
+    printf("load/all/rate,%.6g,msgs/s\n", replies / seconds);
+    printf("load/errors,%ld,replies\n", total.errors);
+    printf("load/stale,%ld,replies\n", total.stale);
+    printf("load/unanswered,%ld,msgs\n", total.unanswered);
+
+    return total.errors > 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Sets the mix from the given comma separated list of TYPE=WEIGHT.
+ * Returns non-zero if it's not valid.
+ */
+int parse_mix(char *names) {
+    memset(mix, 0, sizeof(mix));
+    mix_total = 0;
+
+    char *end;
+    for (char *name = names; *name != '\0'; name = end) {
+        end = strchr(name, ',');
+        size_t len = end != NULL ? (size_t) (end - name) : strlen(name);
+        end = name + len + (end != NULL);
+
+        char *equals = memchr(name, '=', len);
+        if (equals == NULL || equals - name != 4) {
+            return -1;
+        }
+
+        int weight = atoi(equals + 1);
+        if (0 == strncmp(name, "ping", 4)) {
+            mix[PING] = weight;
+        } else if (0 == strncmp(name, "soln", 4)) {
+            mix[SOLN] = weight;
+        } else if (0 == strncmp(name, "work", 4)) {
+            mix[WORK] = weight;
+        } else if (0 == strncmp(name, "abrt", 4)) {
+            mix[ABRT] = weight;
+        } else {
+            return -1;
+        }
+        if (weight < 0) {
+            return -1;
+        }
+    }
+
+    for (int t = 0; t < MSG_TYPES; t++) {
+        mix_total += mix[t];
+    }
+
+    return mix_total > 0 ? 0 : -1;
+}
+
+/*
+ * Solves a few random seeds, for the SOLN msgs.
+ */
+void make_solns(void) {
+    BYTE target[32];
+    hashcash_calc_target(target, difficulty);
+
+    Worker worker;
+    worker.random = metrics_now() | 1;
+
+    for (int i = 0; i < SOLN_COUNT; i++) {
+        BYTE seed[32];
+        char *payload = solns[i];
+        snprintf(payload, 9, "%08x", difficulty);
+        payload[8] = ' ';
+        random_seed(&worker, seed, payload + 8 + 1);
+        payload[PREFIX_LEN] = ' ';
+
+        HashcashSearch search;
+        hashcash_search_init(&search, target, seed);
+        uint64_t solution;
+        if (!hashcash_search(&search, 0, UINT64_MAX, &solution)) {
+            fprintf(stderr, "ERROR: no solution for the SOLN msgs\n");
+            exit(1);
+        }
+        assert(hashcash_verify(target, seed, solution));
+
+        sstp_hex64(solution, payload + PREFIX_LEN + 1);
+        payload[SOLN_PAYLOAD_LEN] = '\0';
+    }
+}
+
+/*
+ * A thread, which connects its share of the connections and keeps them busy
+ * until the time is up.
+ */
+void *drive(void *pworker) {
+    Worker *worker = (Worker *) pworker;
+
+    int epfd = epoll_create1(0);
+    assert(epfd >= 0);
+
+    worker->conns = calloc(worker->conn_count, sizeof(LoadConn));
+    assert(worker->conns);
+    for (int i = 0; i < worker->conn_count; i++) {
+        LoadConn *conn = worker->conns + i;
+        conn->sockfd = connect_to();
+        if (conn->sockfd < 0) {
+            perror("ERROR: connecting");
+            conn->dead = 1;
+            worker->errors++;
+            continue;
+        }
+        fcntl(conn->sockfd, F_SETFL,
+                fcntl(conn->sockfd, F_GETFL) | O_NONBLOCK);
+        conn->sstp = sstp_init(conn->sockfd);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->sockfd, &event);
+    }
+
+    // every thread starts sending together
+    pthread_barrier_wait(&connected);
+
+    uint64_t now = metrics_now();
+    uint64_t end = now + duration;
+    uint64_t last = now;
+    double thread_rate = rate / thread_count;
+
+    for (int i = 0; i < worker->conn_count; i++) {
+        fill(worker, worker->conns + i);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while ((now = metrics_now()) < end) {
+        // let the limited rate's worth of msgs out, spread between every
+        // connection with room for them
+        if (rate > 0) {
+            worker->budget += thread_rate * (now - last) / 1e9;
+            if (worker->budget > thread_rate / 100 + 1) {
+                worker->budget = thread_rate / 100 + 1;
+            }
+            last = now;
+
+            for (int i = 0; i < worker->conn_count && worker->budget >= 1;
+                    i++) {
+                fill(worker, worker->conns + i);
+            }
+        }
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, rate > 0 ? 1 : 10);
+        for (int i = 0; i < n; i++) {
+            LoadConn *conn = (LoadConn *) events[i].data.ptr;
+            if (conn->dead) {
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT && 0 != sstp_flush(conn->sstp)) {
+                conn_fail(worker, conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                receive(worker, conn);
+            }
+            fill(worker, conn);
+        }
+    }
+
+    // whatever's left never got a reply in time
+    for (int i = 0; i < worker->conn_count; i++) {
+        LoadConn *conn = worker->conns + i;
+        worker->unanswered += conn->len;
+        if (conn->sockfd >= 0) {
+            sstp_destroy(conn->sstp);
+            close(conn->sockfd);
+        }
+    }
+    free(worker->conns);
+    close(epfd);
+
+    return NULL;
+}
+
+/*
+ * Opens a connection to the server.
+ * Returns the socket, or -1 if it couldn't connect.
+ */
+int connect_to(void) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (0 != connect(sockfd, (struct sockaddr *) &server_addr,
+                sizeof(server_addr))) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/*
+ * Sends the given connection as many msgs as fit in its window (and the
+ * rate allows), all at once.
+ */
+void fill(Worker *worker, LoadConn *conn) {
+    if (conn->dead || conn->len >= window) {
+        return;
+    }
+
+    sstp_cork(conn->sstp);
+    while (conn->len < window && (rate == 0 || worker->budget >= 1)) {
+        send_next(worker, conn);
+        worker->budget -= rate > 0;
+    }
+    if (0 != sstp_uncork(conn->sstp)) {
+        conn_fail(worker, conn);
+    }
+}
+
+/*
+ * Sends the connection a random msg from the mix.
+ */
+void send_next(Worker *worker, LoadConn *conn) {
+    Request *req = conn->requests + conn->len++;
+    req->type = pick_type(worker);
+    char *payload = NULL;
+
+    switch (req->type) {
+        case SOLN:
+            payload = solns[next_random(&worker->random) % SOLN_COUNT];
+            break;
+        case WORK: {
+            // a random seed every time, so the server can't just cache it
+            BYTE seed[32];
+            payload = req->payload;
+            snprintf(payload, 9, "%08x", difficulty);
+            payload[8] = ' ';
+            random_seed(worker, seed, payload + 8 + 1);
+            payload[PREFIX_LEN] = ' ';
+            req->start = next_random(&worker->random) >> 4;
+            sstp_hex64(req->start, payload + PREFIX_LEN + 1);
+            memcpy(payload + SOLN_PAYLOAD_LEN, " 01", 4);
+            break;
+        }
+        default:
+            break;
+    }
+
+    req->sent_at = metrics_now();
+    sstp_write(conn->sstp, req->type, payload);
+}
+
+/*
+ * Picks a msg type at random, weighted by the mix.
+ */
+SSTPMsgType pick_type(Worker *worker) {
+    int pick = next_random(&worker->random) % mix_total;
+
+    int t = 0;
+    while (pick >= mix[t]) {
+        pick -= mix[t++];
+    }
+    return t;
+}
+
+/*
+ * Handles every reply the connection has received so far.
+ */
+void receive(Worker *worker, LoadConn *conn) {
+    SSTPMsg msg;
+
+    int res;
+    while (SSTP_AGAIN != (res = sstp_try_read(conn->sstp, &msg))) {
+        if (res <= 0) {
+            conn_fail(worker, conn);
+            return;
+        }
+        reply(worker, conn, &msg);
+    }
+}
+
+/*
+ * Checks a single reply against the msg it answers.
+ */
+void reply(Worker *worker, LoadConn *conn, SSTPMsg *msg) {
+    if (msg->type == SOLN) {
+        reply_soln(worker, conn, msg);
+        return;
+    }
+
+    // everything but WORK is answered in the order it was sent
+    int i = 0;
+    while (i < conn->len && conn->requests[i].type == WORK) {
+        i++;
+    }
+    if (i == conn->len) {
+        worker->errors++;
+        return;
+    }
+
+    SSTPMsgType type = conn->requests[i].type;
+    if (msg->type != (type == PING ? PONG : OKAY)) {
+        worker->errors++;
+        memmove(conn->requests + i, conn->requests + i + 1,
+                (conn->len - i - 1) * sizeof(Request));
+        conn->len--;
+        return;
+    }
+    answered(worker, conn, i);
+
+    // and once an ABRT is answered, none of the WORK sent before it will be
+    if (type == ABRT) {
+        memmove(conn->requests, conn->requests + i,
+                (conn->len - i) * sizeof(Request));
+        conn->len -= i;
+    }
+}
+
+/*
+ * Checks a SOLN reply, which has to solve the WORK it answers.
+ */
+void reply_soln(Worker *worker, LoadConn *conn, SSTPMsg *msg) {
+    BYTE target[32];
+    hashcash_calc_target(target, msg->work.difficulty);
+    if (!hashcash_verify(target, msg->work.seed, msg->work.nonce)) {
+        worker->errors++;
+        return;
+    }
+
+    for (int i = 0; i < conn->len; i++) {
+        Request *req = conn->requests + i;
+        if (req->type == WORK
+                && 0 == strncmp(req->payload, msg->payload, PREFIX_LEN)) {
+            if (msg->work.nonce < req->start) {
+                worker->errors++;
+            }
+            answered(worker, conn, i);
+            return;
+        }
+    }
+
+    // the WORK had been aborted, but it got answered anyway (eg. from the
+    // server's cache)
+    worker->stale++;
+}
+
+/*
+ * Records the reply to the connection's i-th msg in flight.
+ */
+void answered(Worker *worker, LoadConn *conn, int i) {
+    Request *req = conn->requests + i;
+    metrics_observe(latency[req->type], metrics_now() - req->sent_at);
+    worker->replies[req->type]++;
+
+    memmove(req, req + 1, (conn->len - i - 1) * sizeof(Request));
+    conn->len--;
+}
+
+/*
+ * Gives up on a connection the server closed (or that failed).
+ */
+void conn_fail(Worker *worker, LoadConn *conn) {
+    conn->dead = 1;
+    worker->errors++;
+    worker->unanswered += conn->len;
+    conn->len = 0;
+}
+
+/*
+ * Makes up a random seed, as bytes and as 64 hex digits (not
+ * null-terminated).
+ */
+void random_seed(Worker *worker, BYTE *seed, char *hex) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t value = next_random(&worker->random);
+        sstp_hex64(value, hex + 16 * i);
+        for (int b = 0; b < 8; b++) {
+            seed[8 * i + b] = value >> (56 - 8 * b);
+        }
+    }
+}
+
+/*
+ * The next number from the given xorshift generator.
+ */
+uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
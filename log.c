@@ -6,12 +6,25 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
-#include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "server.h"
+#include "pool.h"
+#include "thread-ring.h"
 
 #include "log.h"
 
@@ -22,9 +35,26 @@
 #define TIME_FORMAT "%Y-%m-%d %H:%M:%S"
 #define TIME_LEN 19
 
-// global file descriptor and mutex
-FILE *log_fd = NULL;
-pthread_mutex_t mutex;
+// how much each thread can have logged before the writer gets to it (a power
+// of two), and the longest message (with its header) that is kept
+#define RING_LEN (64 * 1024)
+#define MAX_RECORD_LEN 1024
+
+// how much the writer writes out at once
+#define OUT_LEN (64 * 1024)
+
+// how long the writer lets messages build up for, unless a ring is getting
+// full, and how long it sleeps when there's nothing to write
+#define FLUSH_MS 10
+#define IDLE_MS 1000
+
+// marks the rest of a ring as unused, the next record is at the start
+#define WRAP UINT32_MAX
+
+// what the writer is up to
+#define WRITER_AWAKE 0
+#define WRITER_BATCHING 1
+#define WRITER_IDLE 2
 
 
 /***** Private structs
@@ -32,52 +62,165 @@ pthread_mutex_t mutex;
 
 struct Logger {
     char header[HEADER_LEN];
+    int header_len;
 };
 
+/*
+ * A single logged message in a ring, followed by its text (the logger's
+ * header and the message), padded to 8 bytes.
+ */
+typedef struct {
+    uint32_t len; // of the text, or WRAP
+    uint32_t seconds; // when it was logged
+} Record;
+
+/*
+ * A thread's messages waiting to be written out, only ever appended to by its
+ * thread and drained by the writer.
+ */
+typedef struct {
+    ThreadRing base;
+    char buf[RING_LEN];
+} Ring;
+
+// the configuration
+int log_sinks = 0;
+LogLevel log_level = LOG_DEBUG;
+int log_file = -1;
+
+// every thread's ring, whose mutex also guards the output
+ThreadRings rings = THREAD_RINGS_INITIALIZER(sizeof(Ring));
+
+// every connection's logger
+Pool logger_pool = POOL_INITIALIZER(sizeof(Logger), _Alignof(Logger));
+
+// what's being written out, and the time string of the last message
+char out[OUT_LEN];
+int out_len = 0;
+uint32_t cached_seconds = 0;
+char cached_time[TIME_LEN + 1];
+
+// for waking up the writer
+_Atomic uint32_t writer_word = 0;
+_Atomic int writer_state = WRITER_AWAKE;
+
 
 /***** Helper function prototypes
  */
 
-void get_time_str(char *dst, int maxlen);
+void ring_push(Ring *ring, uint32_t seconds, char *header, size_t header_len,
+        char *msg, size_t msg_len);
+void *log_writer(void *_);
+size_t log_drain(void);
+size_t ring_drain(void *pring);
+void out_line(uint32_t seconds, char *text, size_t len);
+void out_flush(void);
+void write_all(int fd, char *buf, size_t len);
+void get_time_str(uint32_t seconds, char *dst, int maxlen);
 
 
 /***** Public functions
  */
 
-void log_global_init() {
-    if (log_fd != NULL) { return; }
-    log_fd = fopen(LOG_FILE_PATH, "w");
+void log_global_init(int sinks, LogLevel level) {
+    if (log_sinks != 0) { return; }
+
+    log_level = level;
+    if (sinks & LOG_FILE) {
+        log_file = open(LOG_FILE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log_file < 0) {
+            perror("ERROR: opening log file");
+            sinks &= ~LOG_FILE;
+        }
+    }
+    if (sinks == 0) {
+        return;
+    }
+
+    thread_rings_init(&rings);
+    log_sinks = sinks;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, log_writer, NULL);
+    atexit(log_flush);
+}
 
-    pthread_mutex_init(&mutex, NULL);
+int log_parse_level(char *name) {
+    if (0 == strcmp(name, "debug")) {
+        return LOG_DEBUG;
+    } else if (0 == strcmp(name, "info")) {
+        return LOG_INFO;
+    } else if (0 == strcmp(name, "warn")) {
+        return LOG_WARN;
+    } else if (0 == strcmp(name, "error")) {
+        return LOG_ERROR;
+    } else {
+        return -1;
+    }
+}
+
+int log_parse_sinks(char *names) {
+    if (0 == strcmp(names, "none")) {
+        return 0;
+    }
+
+    int sinks = 0;
+    char *end;
+    for (char *name = names; *name != '\0'; name = end) {
+        end = strchr(name, ',');
+        size_t len = end != NULL ? (size_t) (end - name) : strlen(name);
+        end = name + len + (end != NULL);
+
+        if (len == 6 && 0 == strncmp(name, "stdout", len)) {
+            sinks |= LOG_STDOUT;
+        } else if (len == 4 && 0 == strncmp(name, "file", len)) {
+            sinks |= LOG_FILE;
+        } else {
+            return -1;
+        }
+    }
+
+    return sinks;
 }
 
 Logger *log_init(Connection conn) {
-    Logger *logger = malloc(sizeof(Logger));
-    assert(NULL != logger);
+    Logger *logger = (Logger *) pool_alloc(&logger_pool);
 
-    sprintf(logger->header, "[ %%s %15s (%3d) ] ", conn.ip, conn.sockfd);
+    logger->header_len = snprintf(logger->header, HEADER_LEN, "%15s (%3d) ] ",
+            conn.ip, conn.sockfd);
 
     return logger;
 }
 
 void log_print(Logger *logger, char *msg) {
-    char datetime[TIME_LEN + 1];
-    get_time_str(datetime, TIME_LEN + 1);
+    log_print_level(logger, LOG_INFO, msg);
+}
+
+void log_print_level(Logger *logger, LogLevel level, char *msg) {
+    if (!log_enabled(level)) {
+        return;
+    }
 
-    printf(logger->header, datetime);
-    printf(msg);
-    printf("\n");
+    ring_push((Ring *) thread_ring_get(&rings), time(NULL), logger->header,
+            logger->header_len, msg, strlen(msg));
+}
 
-    pthread_mutex_lock(&mutex);
-    fprintf(log_fd, logger->header, datetime);
-    fprintf(log_fd, msg);
-    fprintf(log_fd, "\n");
-    fflush(log_fd);
-    pthread_mutex_unlock(&mutex);
+int log_enabled(LogLevel level) {
+    return log_sinks != 0 && level >= log_level;
+}
+
+void log_flush(void) {
+    if (log_sinks == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&rings.mutex);
+    log_drain();
+    pthread_mutex_unlock(&rings.mutex);
 }
 
 void log_destroy(Logger *logger) {
-    free(logger);
+    pool_free(&logger_pool, logger);
 }
 
 
@@ -85,14 +228,195 @@ void log_destroy(Logger *logger) {
  */
 
 /*
- * Simple helper function to grab the current time with a pretty format.
+ * Appends a message to the given (the calling thread's) ring, or drops it if
+ * there's no room.
+ */
+void ring_push(Ring *ring, uint32_t seconds, char *header, size_t header_len,
+        char *msg, size_t msg_len) {
+    if (header_len + msg_len > MAX_RECORD_LEN) {
+        msg_len = MAX_RECORD_LEN - header_len;
+    }
+    size_t len = header_len + msg_len;
+    size_t need = sizeof(Record) + ((len + 7) & ~(size_t) 7);
+
+    size_t tail = atomic_load_explicit(&ring->base.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->base.head, memory_order_acquire);
+
+    // records don't wrap around, so skip whatever's left at the end if it
+    // doesn't fit there
+    size_t pos = tail & (RING_LEN - 1);
+    size_t skip = need > RING_LEN - pos ? RING_LEN - pos : 0;
+    if (tail + skip + need - head > RING_LEN) {
+        atomic_fetch_add_explicit(&ring->base.dropped, 1,
+                memory_order_relaxed);
+        return;
+    }
+    if (skip > 0) {
+        ((Record *) (ring->buf + pos))->len = WRAP;
+        tail += skip;
+        pos = 0;
+    }
+
+    Record *record = (Record *) (ring->buf + pos);
+    record->len = len;
+    record->seconds = seconds;
+    memcpy((char *) (record + 1), header, header_len);
+    memcpy((char *) (record + 1) + header_len, msg, msg_len);
+
+    tail += need;
+    atomic_store_explicit(&ring->base.tail, tail, memory_order_release);
+
+    // only bother the writer if it's got nothing else to do, or the ring is
+    // filling up faster than it batches them
+    int state = atomic_load_explicit(&writer_state, memory_order_relaxed);
+    if ((state == WRITER_IDLE
+                || (state == WRITER_BATCHING && tail - head > RING_LEN / 2))
+            && WRITER_AWAKE != atomic_exchange(&writer_state, WRITER_AWAKE)) {
+        atomic_fetch_add(&writer_word, 1);
+        syscall(SYS_futex, (uint32_t *) &writer_word, FUTEX_WAKE_PRIVATE, 1,
+                NULL, NULL, 0);
+    }
+}
+
+/*
+ * The writer thread, which drains every ring every so often.
+ */
+void *log_writer(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    while (1) {
+        pthread_mutex_lock(&rings.mutex);
+        size_t drained = log_drain();
+        pthread_mutex_unlock(&rings.mutex);
+
+        // a missed wake up only holds the messages up until the timeout
+        int state = drained > 0 ? WRITER_BATCHING : WRITER_IDLE;
+        int ms = drained > 0 ? FLUSH_MS : IDLE_MS;
+        struct timespec timeout = { ms / 1000, (ms % 1000) * 1000000L };
+
+        uint32_t word = atomic_load(&writer_word);
+        atomic_store(&writer_state, state);
+        syscall(SYS_futex, (uint32_t *) &writer_word, FUTEX_WAIT_PRIVATE,
+                word, &timeout, NULL, 0);
+        atomic_store(&writer_state, WRITER_AWAKE);
+    }
+
+    return NULL;
+}
+
+/*
+ * Writes out everything in every ring, freeing the rings of exited threads.
+ * Returns the number of bytes drained.
+ * Note: must be called with rings.mutex held.
+ */
+size_t log_drain(void) {
+    size_t drained = thread_rings_drain(&rings, ring_drain);
+
+    out_flush();
+
+    return drained;
+}
+
+/*
+ * Moves everything in the given ring to the output.
+ * Returns the number of bytes drained.
+ */
+size_t ring_drain(void *pring) {
+    Ring *ring = (Ring *) pring;
+    size_t head = atomic_load_explicit(&ring->base.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->base.tail, memory_order_acquire);
+    size_t start = head;
+
+    while (head != tail) {
+        size_t pos = head & (RING_LEN - 1);
+        Record *record = (Record *) (ring->buf + pos);
+        if (record->len == WRAP) {
+            head += RING_LEN - pos;
+            continue;
+        }
+
+        out_line(record->seconds, (char *) (record + 1), record->len);
+        head += sizeof(Record) + ((record->len + 7) & ~(size_t) 7);
+    }
+    atomic_store_explicit(&ring->base.head, head, memory_order_release);
+
+    uint64_t dropped = atomic_exchange(&ring->base.dropped, 0);
+    if (dropped > 0) {
+        char text[HEADER_LEN];
+        int len = snprintf(text, HEADER_LEN, "%15s (%3d) ] %" PRIu64
+                " Log Messages Dropped", "0.0.0.0", -1, dropped);
+        out_line(time(NULL), text, len);
+    }
+
+    return tail - start;
+}
+
+/*
+ * Adds a line to the output, "[ TIME TEXT\n".
+ */
+void out_line(uint32_t seconds, char *text, size_t len) {
+    if (out_len + 2 + TIME_LEN + 1 + len + 1 > OUT_LEN) {
+        out_flush();
+    }
+
+    // formatting the time is slow, but it only changes once a second
+    if (seconds != cached_seconds) {
+        get_time_str(seconds, cached_time, TIME_LEN + 1);
+        cached_seconds = seconds;
+    }
+
+    out[out_len++] = '[';
+    out[out_len++] = ' ';
+    memcpy(out + out_len, cached_time, TIME_LEN);
+    out_len += TIME_LEN;
+    out[out_len++] = ' ';
+    memcpy(out + out_len, text, len);
+    out_len += len;
+    out[out_len++] = '\n';
+}
+
+/*
+ * Writes the output out to every sink.
+ */
+void out_flush(void) {
+    if (out_len == 0) {
+        return;
+    }
+
+    if (log_sinks & LOG_STDOUT) {
+        write_all(STDOUT_FILENO, out, out_len);
+    }
+    if (log_sinks & LOG_FILE) {
+        write_all(log_file, out, out_len);
+    }
+    out_len = 0;
+}
+
+/*
+ * Writes all of the given buffer to the given file, giving up on errors.
+ */
+void write_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * Simple helper function to format the given time with a pretty format.
  */
-void get_time_str(char *dst, int maxlen) {
-    time_t rawtime;
-    struct tm *timeinfo;
+void get_time_str(uint32_t seconds, char *dst, int maxlen) {
+    time_t rawtime = seconds;
+    struct tm timeinfo;
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    localtime_r(&rawtime, &timeinfo);
 
-    strftime(dst, maxlen, TIME_FORMAT, timeinfo);
+    strftime(dst, maxlen, TIME_FORMAT, &timeinfo);
 }
@@ -4,12 +4,34 @@
  *
  * The module that provides thread-safe per-client logging functionality.
  *
+ * Logging never blocks the caller: each thread appends its messages to a ring
+ * of its own (without any locking, see thread-ring.h), and a single writer
+ * thread drains every ring and writes them out to the sinks in batches.
+ * Messages from the same thread stay in order, but messages from different
+ * threads can be interleaved a little out of order.
+ * If a thread's ring is full its messages are dropped (and counted), rather
+ * than waiting on the writer.
+ *
  */
 
 #pragma once
 
 #include "server.h"
 
+// where the log goes, or'd together
+#define LOG_STDOUT 1
+#define LOG_FILE 2 // log.txt
+
+/*
+ * How important a message is, anything below the minimum level is ignored.
+ */
+typedef enum {
+    LOG_DEBUG, // every msg sent and received
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} LogLevel;
+
 /*
  * The struct that represents a logger
  * primarily stores the details about a client.
@@ -18,9 +40,23 @@
 typedef struct Logger Logger;
 
 /*
- * Does the global initialization.
+ * Does the global initialization, starting up the writer thread.
+ * sinks is where the log goes (see LOG_STDOUT and LOG_FILE), and level the
+ * least important messages that are logged.
+ */
+void log_global_init(int sinks, LogLevel level);
+
+/*
+ * Returns the level with the given name (debug, info, warn or error), or -1 if
+ * there isn't one.
+ */
+int log_parse_level(char *name);
+
+/*
+ * Returns the sinks in the given comma separated list (of stdout and file), 0
+ * for "none", or -1 if there's an unknown one.
  */
-void log_global_init();
+int log_parse_sinks(char *names);
 
 /*
  * Initializes a Logger struct
@@ -28,10 +64,27 @@ void log_global_init();
 Logger *log_init(Connection conn);
 
 /*
- * Logs out the given message.
+ * Logs out the given message, at LOG_INFO.
  */
 void log_print(Logger *logger, char *msg);
 
+/*
+ * Logs out the given message, at the given level.
+ */
+void log_print_level(Logger *logger, LogLevel level, char *msg);
+
+/*
+ * Whether messages at the given level are logged, eg. to skip formatting
+ * ones that aren't.
+ */
+int log_enabled(LogLevel level);
+
+/*
+ * Writes out everything logged so far, without waiting for the writer thread.
+ * Note: also done at exit.
+ */
+void log_flush(void);
+
 /*
  * Destroys the Logger.
  */
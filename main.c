@@ -4,11 +4,49 @@
  *
  * Hashcash proof-of-work solver server.
  *
- * Usage: ./server PORT_NUMBER
+ * Usage: ./server [-k KERNEL] [-b BALANCING] [-s POLICY] [-n BACKEND]
+ *                 [-i IO_THREADS] [-l LEVEL] [-o SINKS] [-m METRICS_PORT]
+ *                 [-t TRACE_FILE] [-c CAPTURE_FILE] [-p PLACEMENT]
+ *                 [-r IO_CPUS] PORT_NUMBER
  *   PORT_NUMBER: port number to connect to,
+ *   KERNEL: which hashcash search kernel to use (scalar, sse4, avx2 or avx512),
+ *           overrides the HASHCASH_KERNEL environment variable,
+ *           defaults to the fastest one the cpu supports.
+ *   BALANCING: how each job's nonces are split between its solver threads
+ *              (blocked, interspersed or chunked), defaults to chunked.
+ *   POLICY: which client's queued job runs next (rr, wfq, sewf or oldest),
+ *           see scheduler.h, defaults to wfq.
+ *   BACKEND: how connections are served (threads, epoll or uring), ie. a
+ *            thread per connection, or IO_THREADS threads each with an epoll
+ *            or io_uring instance, defaults to epoll.
+ *            uring falls back to epoll if the kernel doesn't support it.
+ *   IO_THREADS: how many threads handle all the connections, defaults to 2,
+ *               0 is the same as the threads backend.
+ *   LEVEL: the least important messages that are logged (debug, info, warn
+ *          or error), defaults to debug, ie. every msg sent and received.
+ *   SINKS: where the log goes, a comma separated list of stdout and file
+ *          (log.txt), or none, defaults to stdout,file.
+ *   METRICS_PORT: the local (127.0.0.1) port to serve the metrics on, in the
+ *                 Prometheus text format (eg. curl localhost:METRICS_PORT),
+ *                 they aren't served by default.
+ *   TRACE_FILE: where to record every tracepoint (see trace.h) to, as a
+ *               Chrome trace, they aren't recorded by default.
+ *   CAPTURE_FILE: where to capture every msg sent and received to (see
+ *                 capture.h), eg. to be played back with sstp-replay, they
+ *                 aren't captured by default.
+ *   PLACEMENT: where the solver threads are pinned (spread, compact or none),
+ *              see solver.h, defaults to spread, ie. a thread per physical
+ *              core before any SMT siblings.
+ *   IO_CPUS: the cpus (a cpu list, eg. 0-1) to keep every other thread
+ *            (handling connections, logging and the like) on, which the
+ *            solver threads then stay off, they aren't reserved by default.
+ *
+ * Where the threads ended up is logged at startup.
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,89 +54,246 @@
 #include <pthread.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "uint256.h"
 #include "log.h"
 #include "server.h"
 #include "sstp-socket-wrapper.h"
 #include "hashcash.h"
+#include "linked_list.h"
 #include "queue.h"
+#include "solver.h"
+#include "scheduler.h"
+#include "cache.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "pool.h"
+#include "alloc-count.h"
+#include "topology.h"
 
-// Which load balancing method to use?
-//
-// INTERSPERSED
-// eg:
-//      thread 0: 0, 2, 4, ... (ie. all even numbers)
-//      thread 1: 1, 3, 5, ... (ie. all odd numbers)
-//
-// BLOCKED
-// eg: (assuming a search space of size 1 byte)
-//      thread 0:   0,   1,   2, ... (ie.   0-127)
-//      thread 1: 128, 129, 130, ... (ie. 128-255)
-//
-#define USE_BLOCKED_LOAD_BALANCING
-
-
-#define MAX_WORKERS 0xff
 #define MAX_LOG_LEN 512
 
+// how many times the job the scheduler picks can be passed over for ones that
+// fit on the idle solver threads, before it gets to wait for the threads
+#define MAX_BYPASS 8
+
+// how many solved jobs to remember
+#define CACHE_SIZE 4096
+
+// how many jobs (and job done wake ups) the work queue holds before the
+// clients have to wait for the work consumer to catch up
+#define WORK_QUEUE_LEN 4096
+
+// how many kinds of msgs there are (the last one being MALFORMED)
+#define MSG_TYPES (MALFORMED + 1)
 
 /*
- * The struct that represents a job.
+ * A client's tombstone for the jobs it has put on the work queue.
+ * Every ABRT (and the disconnect) moves the epoch on, which cancels every job
+ * queued before it without having to find them in the queue.
+ * Shared by the client and its queued jobs, the last one to let go frees it.
  */
 typedef struct {
+    _Atomic unsigned epoch;
+    _Atomic int refs;
+} Tombstone;
+
+
+/*
+ * The struct that represents a connected client.
+ */
+typedef struct {
+    Connection conn;
+    Logger *logger;
+    SSTPSocketWrapper *sstp;
+    pthread_mutex_t write_mutex;
+    Tombstone *tombstone;
+
+    // every job of the client's that has made it off the work queue, and
+    // that the client still wants, protected by jobs_mutex
+    LinkedList *jobs;
+
+    // solutions for already solved WORK msgs, that wait until every msg
+    // that came in with them is handled (as if they had been queued)
+    LinkedList *cached_replies;
+} Client;
+
+/*
+ * The struct that represents a job.
+ */
+typedef struct WorkJob {
+    // unique to the job, unlike the struct itself which is recycled (its
+    // tracepoints are recorded with it)
+    uint64_t id;
+
     // the client that owns this job
     Connection conn;
     Logger *logger;
     SSTPSocketWrapper *sstp;
     pthread_mutex_t *write_mutex;
 
-    // the WORK information
-    SSTPMsg msg; // the original work message
-    uint32_t difficulty;
+    // the WORK information, and its difficulty and seed as sent (the SOLN
+    // echoes them back)
+    SSTPWork work;
+    char prefix[WORK_PREFIX_LEN];
     BYTE target[32];
-    BYTE seed[32];
-    uint64_t start;
-    uint8_t worker_count;
-    uint64_t solution;
 
-    // flags
-    char abort;
-    char solution_found;
+    // the search handed to the solver pool
+    // (also holds the abort flag and the solution)
+    SolverJob solve;
+
+    // set once the client doesn't want the solution anymore
+    // (the search itself is only aborted once nobody wants it)
+    volatile char cancelled;
+
+    // while on the work queue, the job is cancelled if its client's tombstone
+    // has moved on from the epoch it was queued in
+    Tombstone *tombstone;
+    unsigned epoch;
+
+    // the job's node in its client's jobs, protected by jobs_mutex
+    // (NULL once it's cancelled)
+    LinkedList *client_jobs;
+    Node *client_node;
+
+    // the job actually searching for this one, if it was merged into it
+    struct WorkJob *leader;
+
+    // when it was queued, and (for the job actually searching) started
+    uint64_t queued_at;
+    uint64_t solving_at;
+
+    // for the job actually searching, protected by jobs_mutex
+    Node *node; // the job's node in active_jobs or done_jobs
+    Node *inflight_node; // the job's node in inflight_jobs
+    LinkedList *followers; // identical jobs merged into this one
 } WorkJob;
 
-// the global work queue and active job
+// how each job's nonces are split between its solver threads
+SolverBalancing balancing = CHUNKED;
+
+// which queued job runs next
+SchedulerPolicy policy = FAIR_SHARE;
+
+// how connections are served
+typedef enum { THREADS, EPOLL, URING } Backend;
+Backend backend = EPOLL;
+
+// how many threads handle the connections, 0 for a thread per connection
+int io_threads = 2;
+
+// where the solver threads are pinned
+SolverPlacement placement = SPREAD;
+
+// the global work queue, which is drained into the per-client queues of the
+// scheduler, the jobs currently on the solver pool and the ones waiting to be
+// replied to
+// (the queue also gets a NULL job whenever a job is done, unless it is full)
 Queue *work_queue = NULL;
-WorkJob *active_job = NULL;
-pthread_mutex_t active_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+Scheduler *scheduler = NULL;
+LinkedList *active_jobs = NULL;
+LinkedList *done_jobs = NULL;
+pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// every job that is queued, active or done (but not yet replied to), that
+// identical jobs can be merged into
+LinkedList *inflight_jobs = NULL;
+
+// the id the next job queued gets
+_Atomic uint64_t next_job_id = 1;
+
+// the solutions of recently solved jobs
+Cache *solution_cache = NULL;
+
+// where the connections, clients, jobs and cached replies come from
+Pool connection_pool = POOL_INITIALIZER(sizeof(Connection),
+        _Alignof(Connection));
+Pool client_pool = POOL_INITIALIZER(sizeof(Client), _Alignof(Client));
+Pool tombstone_pool = POOL_INITIALIZER(sizeof(Tombstone),
+        _Alignof(Tombstone));
+Pool job_pool = POOL_INITIALIZER(sizeof(WorkJob), SOLVER_CACHE_LINE);
+Pool reply_pool = POOL_INITIALIZER(SOLN_PAYLOAD_LEN + 1, 1);
+
+// for when a job's logger is unsafe to use
+Logger *server_logger = NULL;
+
+// the server's metrics
+Metric *jobs_queued = NULL;
+Metric *jobs_cached = NULL;
+Metric *jobs_merged = NULL;
+Metric *jobs_solved = NULL;
+Metric *jobs_unsolved = NULL;
+Metric *jobs_aborted = NULL;
+Metric *connections = NULL;
+Metric *connections_total = NULL;
+Metric *msgs_received[MSG_TYPES];
+Metric *msgs_sent[MSG_TYPES];
+Metric *queue_wait_time = NULL;
+Metric *solve_time = NULL;
+Metric *soln_verify_time = NULL;
 
 
 /***** Helper function prototypes
  */
 
 // Main functions
-void *work_solver_thread(void *pstart);
 void *work_consumer(void *_);
 void *client_handler(void *pconn);
 void handler_thread_spawner(Connection conn);
+void log_placement(void);
+
+// Client helper functions
+void *client_open(Connection conn);
+int client_readable(Connection conn, void *pclient);
+int client_received(Connection conn, void *pclient, char *buf, int len);
+int client_writable(Connection conn, void *pclient);
+void client_close(Connection conn, void *pclient);
+void client_handle(Client *client, SSTPMsg *msg);
 
 // WORK helper functions
-void work_parse(char *msg, uint32_t *difficulty, BYTE *seed, uint64_t *start,
-        uint8_t *worker_count);
-void work_enqueue(Connection *conn, pthread_mutex_t *write_mutex,
-        SSTPSocketWrapper *sstp, Logger *logger, SSTPMsg msg);
-void work_abort(Connection conn);
-void work_abort_iter(void *pjob, void *pconn);
+void work_dispatch(void);
+void work_finish(void *pjob);
+void work_reply(WorkJob *job);
+void work_send(WorkJob *job);
+void work_skip(void *pjob, void *_);
+void work_requeue(void *pjob, void *_);
+WorkJob *work_live(WorkJob *job);
+WorkJob *work_find_identical(WorkJob *job);
+int work_cached(SSTPMsg *msg, LinkedList *replies);
+void work_send_cached(uint64_t id, pthread_mutex_t *write_mutex,
+        SSTPSocketWrapper *sstp, Logger *logger, LinkedList *replies);
+void work_enqueue(Client *client, SSTPMsg *msg);
+int work_dequeued(WorkJob *job);
+void work_abort(Client *client);
+void work_unlink(WorkJob *job);
+void tombstone_release(Tombstone *tombstone);
 
 // SOLN helper functions
-void soln_parse(char *msg, uint32_t *difficulty, BYTE *seed, uint64_t *solution);
-int soln_verify(char *soln_msg);
+int soln_verify(SSTPWork *soln);
+
+// Metrics helper functions
+void metrics_init_server(void);
+double metrics_queued_jobs(void *_);
+void metrics_count_depth(uint64_t client, int depth, void *pcount);
+void metrics_client_depths(MetricSamples *samples, void *_);
+void metrics_sample_depth(uint64_t client, int depth, void *psamples);
+double metrics_active_jobs(void *_);
+double metrics_cache_hits(void *_);
+double metrics_cache_misses(void *_);
+double metrics_heap_allocs(void *_);
+double metrics_heap_frees(void *_);
 
 // SSTP logging helper functions
 void sstp_log(Logger *logger, char *prefix, SSTPMsgType type, char *payload);
-int sstp_log_read(SSTPSocketWrapper *sstp, Logger *logger, SSTPMsg *msg);
-int sstp_log_write(pthread_mutex_t *write_mutex, SSTPSocketWrapper *sstp,
-        Logger *logger, SSTPMsgType type, char payload[]);
+int sstp_log_read(uint64_t id, SSTPSocketWrapper *sstp, Logger *logger,
+        SSTPMsg *msg);
+int sstp_log_try_read(uint64_t id, SSTPSocketWrapper *sstp, Logger *logger,
+        SSTPMsg *msg);
+int sstp_log_write(uint64_t id, pthread_mutex_t *write_mutex,
+        SSTPSocketWrapper *sstp, Logger *logger, SSTPMsgType type,
+        char payload[]);
 
 
 /***** Main functions
@@ -106,211 +301,272 @@ int sstp_log_write(pthread_mutex_t *write_mutex, SSTPSocketWrapper *sstp,
 
 int main(int argc, char *argv[]) {
     int port;
+    char *kernel = NULL;
+    LogLevel log_level = LOG_DEBUG;
+    int log_sinks = LOG_STDOUT | LOG_FILE;
+    int metrics_port = 0;
+    char *trace_path = NULL;
+    char *capture_path = NULL;
+    char *io_cpus = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "k:b:s:n:i:l:o:m:t:c:p:r:"))) {
+        switch (opt) {
+            case 'k':
+                kernel = optarg;
+                break;
+            case 'b':
+                if (-1 == (opt = solver_parse_balancing(optarg))) {
+                    fprintf(stderr, "ERROR: unknown load balancing\n");
+                    exit(1);
+                }
+                balancing = opt;
+                break;
+            case 's':
+                if (-1 == (opt = scheduler_parse_policy(optarg))) {
+                    fprintf(stderr, "ERROR: unknown scheduling policy\n");
+                    exit(1);
+                }
+                policy = opt;
+                break;
+            case 'n':
+                if (0 == strcmp(optarg, "threads")) {
+                    backend = THREADS;
+                } else if (0 == strcmp(optarg, "epoll")) {
+                    backend = EPOLL;
+                } else if (0 == strcmp(optarg, "uring")) {
+                    backend = URING;
+                } else {
+                    fprintf(stderr, "ERROR: unknown backend\n");
+                    exit(1);
+                }
+                break;
+            case 'i':
+                io_threads = atoi(optarg);
+                break;
+            case 'l':
+                if (-1 == (opt = log_parse_level(optarg))) {
+                    fprintf(stderr, "ERROR: unknown log level\n");
+                    exit(1);
+                }
+                log_level = opt;
+                break;
+            case 'o':
+                if (-1 == (log_sinks = log_parse_sinks(optarg))) {
+                    fprintf(stderr, "ERROR: unknown log sink\n");
+                    exit(1);
+                }
+                break;
+            case 'm':
+                metrics_port = atoi(optarg);
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'c':
+                capture_path = optarg;
+                break;
+            case 'p':
+                if (-1 == (opt = solver_parse_placement(optarg))) {
+                    fprintf(stderr, "ERROR: unknown placement\n");
+                    exit(1);
+                }
+                placement = opt;
+                break;
+            case 'r':
+                io_cpus = optarg;
+                break;
+            default:
+                exit(1);
+        }
+    }
 
-    if (argc < 2) {
+    if (optind >= argc) {
         fprintf(stderr, "ERROR: no port provided\n");
         exit(1);
     }
 
-    port = atoi(argv[1]);
+    port = atoi(argv[optind]);
 
-    log_global_init();
+    if (0 != hashcash_kernel_select(kernel)) {
+        fprintf(stderr, "ERROR: unknown or unsupported kernel, using %s\n",
+                hashcash_kernel_name());
+    }
 
-    // create the work queue and consumer
-    work_queue = queue_init();
-    pthread_t tid;
-    pthread_create(&tid, NULL, work_consumer, NULL);
+    if (0 != solver_set_placement(placement, io_cpus)) {
+        fprintf(stderr, "ERROR: invalid cpu list\n");
+        exit(1);
+    }
 
-    server(port, handler_thread_spawner);
+    // every thread started from here on (other than the solver threads)
+    // stays on the reserved cpus, so the topology (of every cpu the process
+    // can run on) is read before this thread is narrowed down to them
+    if (io_cpus != NULL) {
+        TopologyCpu *all;
+        topology_cpus(&all);
+
+        cpu_set_t cpus;
+        topology_parse_cpus(io_cpus, &cpus);
+        if (0 != pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            fprintf(stderr, "ERROR: couldn't reserve the cpus for I/O\n");
+        }
+    }
 
-    return 0;
-}
+    log_global_init(log_sinks, log_level);
+    if (trace_path != NULL && 0 != trace_init(trace_path)) {
+        exit(1);
+    }
+    if (capture_path != NULL && 0 != capture_init(capture_path)) {
+        exit(1);
+    }
 
-/*
- * Thread that actually finds a valid proof-of-work nonce value.
- */
-void *work_solver_thread(void *pstart) {
-    uint64_t nonce = *((uint64_t *)pstart);
-    uint64_t initial_nonce = nonce;
-    free(pstart);
+    // start up the solver threads, one per (unreserved) cpu
+    solver_init(0);
 
-    while (!hashcash_verify(active_job->target, active_job->seed, nonce)
-            && !active_job->abort && !active_job->solution_found) {
-#ifdef USE_BLOCKED_LOAD_BALANCING
-        nonce++;
-#else
-        // skip over the numbers other threads will handle
-        nonce += active_job->worker_count;
-#endif
-        // stop if nonce rolled over
-        if (nonce < initial_nonce) {
-            break;
-        }
+    // create the work queue and consumer
+    work_queue = queue_init(WORK_QUEUE_LEN);
+    scheduler = scheduler_init(policy, MAX_BYPASS);
+    active_jobs = linked_list_init();
+    done_jobs = linked_list_init();
+    inflight_jobs = linked_list_init();
+    solution_cache = cache_init(CACHE_SIZE);
+
+    metrics_init_server();
+    if (metrics_port > 0 && 0 != metrics_serve(metrics_port)) {
+        fprintf(stderr, "ERROR: couldn't serve the metrics\n");
     }
-    if (!active_job->abort && !active_job->solution_found
-            && nonce > initial_nonce) {
-        active_job->solution_found = 1;
-        active_job->solution = nonce;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, work_consumer, NULL);
+
+    ConnectionEvents events = {
+        client_open, client_readable, client_received, client_writable,
+        client_close
+    };
+    if (io_threads <= 0 || backend == THREADS) {
+        server(port, handler_thread_spawner);
+    } else if (backend == URING
+            && SERVER_UNSUPPORTED != server_uring(port, io_threads, &events)) {
+        // it only returns if the server couldn't be started
+    } else {
+        if (backend == URING) {
+            fprintf(stderr, "ERROR: io_uring unavailable, using epoll\n");
+        }
+        server_reactor(port, io_threads, &events);
     }
 
-    return NULL;
+    return 0;
 }
 
 /*
- * Handles work jobs that land in the work queue.
+ * Handles work jobs that land in the work queue, running as many of them at
+ * once as fit on the solver threads.
  */
 void *work_consumer(void *_) {
     (void)_; // purposefully unused, so silence the compiler
 
-    pthread_t workers[MAX_WORKERS];
-    int i;
-    uint64_t *pstart;
-
     // create a server logger
-    // for when active_job->logger is unsafe to use
     Connection server_conn;
+    server_conn.id = 0;
     server_conn.sockfd = -1;
     strcpy(server_conn.ip, "0.0.0.0");
-    Logger *server_logger = log_init(server_conn);
+    server_logger = log_init(server_conn);
+
+    char buf[MAX_LOG_LEN];
+    snprintf(buf, MAX_LOG_LEN, "Using the %s Search Kernel on %d Solver Threads",
+            hashcash_kernel_name(), solver_thread_count());
+    log_print(server_logger, buf);
+    log_placement();
 
     while (1) {
-        pthread_mutex_lock(&active_job_mutex);
-        active_job = queue_dequeue(work_queue);
-        pthread_mutex_unlock(&active_job_mutex);
-
-        if (!active_job->abort) {
-#ifdef USE_BLOCKED_LOAD_BALANCING
-            uint64_t start_diff = UINT64_MAX - active_job->start;
-            start_diff /= active_job->worker_count;
-#endif
-
-            // solve the work, spawning workers if necessary
-            for (i = 0; i < active_job->worker_count - 1; i++) {
-                log_print(active_job->logger, "Spawning Worker Thread");
-
-                // each thread starts on a different initial nonce
-                pstart = (uint64_t *) malloc(sizeof(uint64_t));
-                assert(pstart);
-
-#ifdef USE_BLOCKED_LOAD_BALANCING
-                *pstart = active_job->start;
-                active_job->start += start_diff;
-#else
-                *pstart = active_job->start++;
-#endif
-
-                pthread_create(workers + i, NULL, work_solver_thread, (void *) pstart);
-            }
+        // wait for new jobs or for jobs to be done
+        queue_wait(work_queue);
+
+        pthread_mutex_lock(&jobs_mutex);
 
-            // the consumer also handles one portion of the work
-            pstart = (uint64_t *) malloc(sizeof(uint64_t));
-            assert(pstart);
-            *pstart = active_job->start;
-            work_solver_thread((void *) pstart);
-
-            // join all the worker threads (if any)
-            for (i = 0; i < active_job->worker_count - 1; i++) {
-                log_print(active_job->abort
-                        ? server_logger
-                        : active_job->logger,
-                        "Joining Worker Thread");
-                pthread_join(workers[i], NULL);
+        WorkJob *job;
+        while (queue_try_dequeue(work_queue, (void **) &job)) {
+            if (job == NULL) {
+                continue;
             }
+            TRACE(queue_dequeue, TRACE_ASYNC_STEP, job->id);
 
-            // did we actually find the solution or abort?
-            pthread_mutex_lock(&active_job_mutex);
-            if (!active_job->abort) {
-                if (active_job->solution_found) {
-                    // found the solution so send it to the client
-                    sprintf(active_job->msg.payload + 8 + 1 + 64 + 1,
-                            "%016" PRIx64, active_job->solution);
-                    sstp_log_write(active_job->write_mutex, active_job->sstp,
-                            active_job->logger, SOLN, active_job->msg.payload);
-                } else {
-                    log_print(server_logger, "No Solution Found");
-                }
-            } else {
-                log_print(server_logger, "Aborting Active Job");
+            if (!work_dequeued(job)) {
+                work_skip(job, NULL);
+                continue;
             }
-        } else {
-            log_print(server_logger, "Skipping Aborted Job");
+            job->client_node = linked_list_push_end(job->client_jobs, job);
+
+            // let the same search answer every identical job
+            WorkJob *leader = work_find_identical(job);
+            if (leader != NULL) {
+                job->leader = leader;
+                linked_list_push_end(leader->followers, job);
+                metrics_add(jobs_merged, 1);
+                log_print(job->logger, "Merged With Identical Work");
+                continue;
+            }
+
+            job->followers = linked_list_init();
+            job->inflight_node = linked_list_push_end(inflight_jobs, job);
+
+            int depth = scheduler_push(scheduler, job->conn.id, job,
+                    job->solve.thread_count,
+                    hashcash_expected_hashes(job->target));
+
+            snprintf(buf, MAX_LOG_LEN, "Queued Work (%d Pending)", depth);
+            log_print(job->logger, buf);
         }
 
-        free(active_job);
-        active_job = NULL;
-        pthread_mutex_unlock(&active_job_mutex);
+        // fill up the freed solver threads before replying to anyone
+        work_dispatch();
+
+        while (!linked_list_is_empty(done_jobs)) {
+            work_reply(linked_list_pop_start(done_jobs));
+        }
+
+        pthread_mutex_unlock(&jobs_mutex);
     }
 
     return NULL;
 }
 
 /*
- * Handles communication with each individual client (ie each connection).
+ * Handles communication with each individual client (ie each connection), on
+ * a thread of its own.
  */
 void *client_handler(void *pconn) {
     Connection conn = *((Connection *) pconn);
-    free(pconn);
+    pool_free(&connection_pool, pconn);
 
-    Logger *logger = log_init(conn);
-    SSTPSocketWrapper *sstp = sstp_init(conn.sockfd);
-    pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-    log_print(logger, "Connected");
+    Client *client = client_open(conn);
 
     SSTPMsg msg;
 
     int res;
-    while (0 != (res = sstp_log_read(sstp, logger, &msg))) {
+    while (0 != (res = sstp_log_read(client->conn.id, client->sstp,
+                    client->logger, &msg))) {
         if (res < 0) {
             perror("ERROR: reading from socket");
             break;
         }
 
-        switch (msg.type) {
-            case PING:
-                sstp_log_write(&write_mutex, sstp, logger, PONG, NULL);
-                break;
-            case PONG:
-                sstp_log_write(&write_mutex, sstp, logger, ERRO,
-                        "PONG msgs are reserved for the server.");
-                break;
-            case OKAY:
-                sstp_log_write(&write_mutex, sstp, logger, ERRO,
-                        "OKAY msgs are reserved for the server.");
-                break;
-            case ERRO:
-                sstp_log_write(&write_mutex, sstp, logger, ERRO,
-                        "ERRO msgs are reserved for the server.");
-                break;
-            case SOLN:
-                if (soln_verify(msg.payload)) {
-                    sstp_log_write(&write_mutex, sstp, logger, OKAY, NULL);
-                } else {
-                    sstp_log_write(&write_mutex, sstp, logger, ERRO,
-                        "Not a valid solution.");
-                }
-                break;
-            case WORK:
-                work_enqueue(&conn, &write_mutex, sstp, logger, msg);
-                break;
-            case ABRT:
-                work_abort(conn);
-                sstp_log_write(&write_mutex, sstp, logger, OKAY, NULL);
-                break;
-            default:
-                sstp_log_write(&write_mutex, sstp, logger, ERRO,
-                        "Malformed message.");
-                break;
+        // hold back the replies while there's more to reply to
+        int more = sstp_has_input(client->sstp);
+        if (more) {
+            sstp_cork(client->sstp);
         }
-    }
 
-    log_print(logger, "Disconnected");
+        client_handle(client, &msg);
 
-    // clean up
-    work_abort(conn);
-    sstp_destroy(sstp);
-    log_destroy(logger);
-    close(conn.sockfd);
+        if (!more) {
+            work_send_cached(client->conn.id, &client->write_mutex,
+                    client->sstp, client->logger, client->cached_replies);
+            sstp_uncork(client->sstp);
+        }
+    }
+
+    client_close(conn, client);
 
     return NULL;
 }
@@ -321,8 +577,7 @@ void *client_handler(void *pconn) {
  */
 void handler_thread_spawner(Connection conn) {
     // alloc to passing the connection to the thread
-    Connection *pconn = malloc(sizeof(Connection));
-    assert(NULL != pconn);
+    Connection *pconn = (Connection *) pool_alloc(&connection_pool);
     *pconn = conn;
 
     // threads should be created detached, as they don't return anything
@@ -338,123 +593,763 @@ void handler_thread_spawner(Connection conn) {
     pthread_attr_destroy(&attr);
 }
 
+/*
+ * Logs where each solver thread was pinned, and the cpus every other thread
+ * runs on.
+ */
+void log_placement(void) {
+    char buf[MAX_LOG_LEN];
+
+    for (int i = 0; i < solver_thread_count(); i++) {
+        TopologyCpu *cpu = topology_cpu(solver_thread_cpu(i));
+        if (cpu == NULL) {
+            snprintf(buf, MAX_LOG_LEN, "Solver Thread %d Not Pinned", i);
+        } else {
+            snprintf(buf, MAX_LOG_LEN,
+                    "Solver Thread %d on CPU %d (Package %d, Core %d, "
+                    "Sibling %d, Node %d)", i, cpu->cpu, cpu->package,
+                    cpu->core, cpu->sibling, cpu->node);
+        }
+        log_print(server_logger, buf);
+    }
+
+    // the I/O threads share this thread's affinity
+    cpu_set_t cpus;
+    char list[MAX_LOG_LEN / 2];
+    if (0 == pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+        topology_format_cpus(&cpus, list, sizeof(list));
+        snprintf(buf, MAX_LOG_LEN, "I/O Threads on CPUs %s", list);
+        log_print(server_logger, buf);
+    }
+}
+
 
 /***** Helper functions
  */
 
-/******** WORK msg helper functions
+/******** Client helper functions
+ */
+
+/*
+ * Sets up a newly connected client.
+ */
+void *client_open(Connection conn) {
+    Client *client = (Client *) pool_alloc(&client_pool);
+
+    client->conn = conn;
+    client->logger = log_init(conn);
+    client->sstp = sstp_init(conn.sockfd);
+    pthread_mutex_init(&client->write_mutex, NULL);
+    client->tombstone = (Tombstone *) pool_alloc(&tombstone_pool);
+    atomic_init(&client->tombstone->epoch, 0);
+    atomic_init(&client->tombstone->refs, 1);
+    client->jobs = linked_list_init();
+    client->cached_replies = linked_list_init();
+
+    metrics_add(connections, 1);
+    metrics_add(connections_total, 1);
+    capture_record(conn.id, CAPTURE_OPEN, MALFORMED, NULL, 0);
+    log_print(client->logger, "Connected");
+
+    return client;
+}
+
+/*
+ * Handles every msg the (non-blocking) client has sent so far.
+ * Returns 0 once the client has disconnected.
+ */
+int client_readable(Connection conn, void *pclient) {
+    (void)conn; // purposefully unused, the client has its own copy
+    Client *client = (Client *) pclient;
+
+    SSTPMsg msg;
+
+    // the replies all go out together
+    sstp_cork(client->sstp);
+
+    int res;
+    while (SSTP_AGAIN != (res = sstp_log_try_read(client->conn.id,
+                    client->sstp, client->logger, &msg))) {
+        if (res == 0) {
+            sstp_uncork(client->sstp);
+            return 0;
+        }
+        if (res < 0) {
+            perror("ERROR: reading from socket");
+            sstp_uncork(client->sstp);
+            return 0;
+        }
+
+        client_handle(client, &msg);
+    }
+
+    // caught up with the client
+    work_send_cached(client->conn.id, &client->write_mutex, client->sstp,
+            client->logger, client->cached_replies);
+    sstp_uncork(client->sstp);
+
+    return 1;
+}
+
+/*
+ * Handles every msg in the data received from the client.
+ * Returns 0 if the client should be disconnected.
+ */
+int client_received(Connection conn, void *pclient, char *buf, int len) {
+    (void)conn; // purposefully unused, the client has its own copy
+    Client *client = (Client *) pclient;
+
+    SSTPMsg msg;
+
+    // the replies all go out together
+    sstp_cork(client->sstp);
+
+    while (SSTP_AGAIN != sstp_feed(client->sstp, &buf, &len, &msg)) {
+        metrics_add(msgs_received[msg.type], 1);
+        capture_record(client->conn.id, CAPTURE_IN, msg.type, msg.payload,
+                msg.payload_len);
+        sstp_log(client->logger, "Recieved: ", msg.type, msg.payload);
+        client_handle(client, &msg);
+    }
+
+    // caught up with the client
+    work_send_cached(client->conn.id, &client->write_mutex, client->sstp,
+            client->logger, client->cached_replies);
+
+    return 0 == sstp_uncork(client->sstp);
+}
+
+/*
+ * Sends whatever is still queued for the client.
+ * Returns 0 if the client should be disconnected.
+ */
+int client_writable(Connection conn, void *pclient) {
+    (void)conn; // purposefully unused, the client has its own copy
+    Client *client = (Client *) pclient;
+
+    return 0 == sstp_flush(client->sstp);
+}
+
+/*
+ * Cleans up after a disconnected client.
  */
+void client_close(Connection conn, void *pclient) {
+    Client *client = (Client *) pclient;
+
+    metrics_add(connections, -1);
+    capture_record(client->conn.id, CAPTURE_CLOSE, MALFORMED, NULL, 0);
+    log_print(client->logger, "Disconnected");
+
+    // clean up
+    work_abort(client);
+    tombstone_release(client->tombstone);
+    linked_list_destroy(client->jobs);
+    while (!linked_list_is_empty(client->cached_replies)) {
+        pool_free(&reply_pool, linked_list_pop_start(client->cached_replies));
+    }
+    linked_list_destroy(client->cached_replies);
+    sstp_destroy(client->sstp);
+    log_destroy(client->logger);
+    pthread_mutex_destroy(&client->write_mutex);
+    close(conn.sockfd);
+    pool_free(&client_pool, client);
+}
 
 /*
- * Parse the given WORK message.
+ * Responds to a single msg from the client.
  */
-void work_parse(char *msg, uint32_t *difficulty, BYTE *seed, uint64_t *start,
-        uint8_t *worker_count) {
-    // read everything but the worker count
-    soln_parse(msg, difficulty, seed, start);
-    msg += 8 + 1 + 64 + 1 + 16 + 1;
+void client_handle(Client *client, SSTPMsg *msg) {
+    pthread_mutex_t *write_mutex = &client->write_mutex;
+    SSTPSocketWrapper *sstp = client->sstp;
+    Logger *logger = client->logger;
+    uint64_t id = client->conn.id;
+
+    TRACE(sstp_read, TRACE_INSTANT, client->conn.id);
+
+    switch (msg->type) {
+        case PING:
+            sstp_log_write(id, write_mutex, sstp, logger, PONG, NULL);
+            break;
+        case PONG:
+            sstp_log_write(id, write_mutex, sstp, logger, ERRO,
+                    "PONG msgs are reserved for the server.");
+            break;
+        case OKAY:
+            sstp_log_write(id, write_mutex, sstp, logger, ERRO,
+                    "OKAY msgs are reserved for the server.");
+            break;
+        case ERRO:
+            sstp_log_write(id, write_mutex, sstp, logger, ERRO,
+                    "ERRO msgs are reserved for the server.");
+            break;
+        case SOLN: {
+            uint64_t start = metrics_now();
+            int valid = soln_verify(&msg->work);
+            metrics_observe(soln_verify_time, metrics_now() - start);
 
-    // read worker count
-    *worker_count = strtoul(msg, NULL, 16);
+            if (valid) {
+                sstp_log_write(id, write_mutex, sstp, logger, OKAY, NULL);
+            } else {
+                sstp_log_write(id, write_mutex, sstp, logger, ERRO,
+                    "Not a valid solution.");
+            }
+            break;
+        }
+        case WORK:
+            if (!work_cached(msg, client->cached_replies)) {
+                work_enqueue(client, msg);
+            }
+            break;
+        case ABRT:
+            work_abort(client);
+            sstp_log_write(id, write_mutex, sstp, logger, OKAY, NULL);
+            break;
+        default:
+            sstp_log_write(id, write_mutex, sstp, logger, ERRO,
+                    "Malformed message.");
+            break;
+    }
 }
 
+
+/******** WORK msg helper functions
+ */
+
 /*
- * Queue the given WORK msg in the work queue.
+ * If the given WORK has already been solved, adds its SOLN payload to the
+ * given replies, skipping the work queue.
+ * Returns true if it was.
  */
-void work_enqueue(Connection *conn, pthread_mutex_t *write_mutex,
-        SSTPSocketWrapper *sstp, Logger *logger, SSTPMsg msg) {
-    WorkJob *job = (WorkJob *) malloc(sizeof(WorkJob));
-    assert(job);
+int work_cached(SSTPMsg *msg, LinkedList *replies) {
+    SSTPWork *work = &msg->work;
+    CacheKey key;
+    key.difficulty = work->difficulty;
+    memcpy(key.seed, work->seed, 32);
+    key.start = work->nonce;
 
-    job->conn = *conn;
-    job->logger = logger;
-    job->sstp = sstp;
-    job->write_mutex = write_mutex;
+    uint64_t solution;
+    if (!cache_get(solution_cache, &key, &solution)) {
+        return 0;
+    }
+
+    char *payload = (char *) pool_alloc(&reply_pool);
+    sstp_soln_payload(msg->payload, solution, payload);
+
+    linked_list_push_end(replies, payload);
+    metrics_add(jobs_cached, 1);
 
-    job->msg = msg;
+    return 1;
+}
 
-    work_parse(msg.payload, &job->difficulty, job->seed, &job->start, &job->worker_count);
-    hashcash_calc_target(job->target, job->difficulty);
+/*
+ * Sends off (and frees) the given SOLN payloads.
+ */
+void work_send_cached(uint64_t id, pthread_mutex_t *write_mutex,
+        SSTPSocketWrapper *sstp, Logger *logger, LinkedList *replies) {
+    while (!linked_list_is_empty(replies)) {
+        char *payload = linked_list_pop_start(replies);
+        sstp_log_write(id, write_mutex, sstp, logger, SOLN, payload);
+        pool_free(&reply_pool, payload);
+    }
+}
+
+/*
+ * Queue the given WORK in the work queue.
+ */
+void work_enqueue(Client *client, SSTPMsg *msg) {
+    SSTPWork *work = &msg->work;
+
+    // the search has its own cache lines
+    WorkJob *job = (WorkJob *) pool_alloc(&job_pool);
+
+    job->id = atomic_fetch_add_explicit(&next_job_id, 1, memory_order_relaxed);
+    job->conn = client->conn;
+    job->logger = client->logger;
+    job->sstp = client->sstp;
+    job->write_mutex = &client->write_mutex;
+
+    job->work = *work;
+    memcpy(job->prefix, msg->payload, WORK_PREFIX_LEN);
+    hashcash_calc_target(job->target, work->difficulty);
+
+    hashcash_search_init(&job->solve.search, job->target, work->seed);
+    job->solve.start = work->nonce;
+    job->solve.balancing = balancing;
+    job->solve.solution = 0;
+    job->solve.abort = 0;
+    job->solve.solution_found = 0;
+    job->cancelled = 0;
+    job->client_jobs = client->jobs;
+    job->client_node = NULL;
+    job->leader = NULL;
+    job->tombstone = client->tombstone;
+    atomic_fetch_add(&job->tombstone->refs, 1);
+    job->epoch = atomic_load(&job->tombstone->epoch);
+    job->solve.on_done = work_finish;
+    job->solve.data = job;
+    job->solve.trace_id = job->id;
+
+    // clamp to what the pool can actually give the job
+    job->solve.thread_count = work->worker_count;
+    if (job->solve.thread_count > solver_thread_count()) {
+        job->solve.thread_count = solver_thread_count();
+    }
+    if (job->solve.thread_count < 1) {
+        job->solve.thread_count = 1;
+    }
 
-    job->solution = 0;
-    job->abort = 0;
-    job->solution_found = 0;
+    job->node = NULL;
+    job->inflight_node = NULL;
+    job->followers = NULL;
 
+    metrics_add(jobs_queued, 1);
+    job->queued_at = metrics_now();
+    TRACE(work_enqueue, TRACE_ASYNC_BEGIN, job->id);
     queue_enqueue(work_queue, job);
 }
 
 /*
- * Aborts all queued (and active) work jobs for the given connection (client).
- * Note: uses the socket file descriptor of each connection to uniquely identify
- *       them.
+ * Takes the given job off the work queue, letting go of its client's
+ * tombstone.
+ * Returns false if the job was cancelled while on the queue.
  */
-void work_abort(Connection conn) {
-    // abort the active job (if any)
-    pthread_mutex_lock(&active_job_mutex);
-    if (active_job != NULL && active_job->conn.sockfd == conn.sockfd) {
-        active_job->abort = 1;
+int work_dequeued(WorkJob *job) {
+    if (job->epoch != atomic_load(&job->tombstone->epoch)) {
+        job->cancelled = 1;
     }
-    pthread_mutex_unlock(&active_job_mutex);
+    tombstone_release(job->tombstone);
+    job->tombstone = NULL;
 
-    // abort all other jobs
-    queue_iter(work_queue, work_abort_iter, (void *) &conn);
+    return !job->cancelled;
 }
 
 /*
- * Iterator over the work queue that aborts each job.
+ * Starts queued jobs on the idle solver threads, in the order the scheduler
+ * picks them.
+ * Note: must be called with jobs_mutex held.
  */
-void work_abort_iter(void *pjob, void *pconn) {
+void work_dispatch(void) {
+    int idle = solver_idle_count();
+
+    WorkJob *job;
+    while (NULL != (job = scheduler_pop(scheduler, idle))) {
+        // solve the work on the solver pool
+        job->node = linked_list_push_end(active_jobs, job);
+        idle -= job->solve.thread_count;
+
+        job->solving_at = metrics_now();
+        metrics_observe(queue_wait_time, job->solving_at - job->queued_at);
+
+        WorkJob *live = work_live(job);
+        log_print(live != NULL ? live->logger : server_logger, "Solving Work");
+        solver_submit(&job->solve);
+    }
+}
+
+/*
+ * Called by the solver pool once a job is done, to hand it back to the
+ * scheduler.
+ * Note: the solver threads don't reply themselves, so a slow client can't
+ *       hold one up.
+ */
+void work_finish(void *pjob) {
     WorkJob *job = (WorkJob *) pjob;
-    Connection *conn = (Connection *) pconn;
-    if (job->conn.sockfd == conn->sockfd) {
-        job->abort = 1;
+
+    metrics_observe(solve_time, metrics_now() - job->solving_at);
+
+    pthread_mutex_lock(&jobs_mutex);
+    linked_list_pop(active_jobs, job->node);
+    job->node = linked_list_push_end(done_jobs, job);
+    pthread_mutex_unlock(&jobs_mutex);
+
+    // wake the consumer up, without ever blocking a solver thread: if the
+    // queue is full the consumer is bound to wake up anyway, and it goes
+    // through done_jobs every time it does
+    queue_try_enqueue(work_queue, NULL);
+}
+
+/*
+ * Sends off the solution of the given done job to every client that still
+ * wants it, and frees it (and the jobs merged into it).
+ * Note: must be called with jobs_mutex held.
+ */
+void work_reply(WorkJob *job) {
+    linked_list_pop(inflight_jobs, job->inflight_node);
+
+    if (job->solve.solution_found) {
+        CacheKey key = { job->work.difficulty, {0}, job->work.nonce };
+        memcpy(key.seed, job->work.seed, 32);
+        cache_put(solution_cache, &key, job->solve.solution);
+    }
+
+    while (!linked_list_is_empty(job->followers)) {
+        WorkJob *follower = linked_list_pop_start(job->followers);
+        follower->solve.solution_found = job->solve.solution_found;
+        follower->solve.solution = job->solve.solution;
+        work_send(follower);
+        work_unlink(follower);
+        TRACE(work_done, TRACE_ASYNC_END, follower->id);
+        pool_free(&job_pool, follower);
+    }
+    linked_list_destroy(job->followers);
+
+    work_send(job);
+    work_unlink(job);
+    TRACE(work_done, TRACE_ASYNC_END, job->id);
+    pool_free(&job_pool, job);
+}
+
+/*
+ * Sends off the solution of the given job, if its client still wants it.
+ */
+void work_send(WorkJob *job) {
+    // did we actually find the solution or abort?
+    if (!job->cancelled) {
+        if (job->solve.solution_found) {
+            // found the solution so send it to the client
+            char payload[SOLN_PAYLOAD_LEN + 1];
+            sstp_soln_payload(job->prefix, job->solve.solution, payload);
+            sstp_log_write(job->conn.id, job->write_mutex, job->sstp,
+                    job->logger, SOLN, payload);
+            metrics_add(jobs_solved, 1);
+        } else {
+            metrics_add(jobs_unsolved, 1);
+            log_print(server_logger, "No Solution Found");
+        }
+    } else {
+        metrics_add(jobs_aborted, 1);
+        log_print(server_logger, "Aborting Active Job");
     }
 }
 
+/*
+ * Frees the given aborted job (and the jobs merged into it) that never made it
+ * to the solver pool.
+ */
+void work_skip(void *pjob, void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    WorkJob *job = (WorkJob *) pjob;
 
-/******** SOLN msg helper functions
+    if (job->followers != NULL) {
+        while (!linked_list_is_empty(job->followers)) {
+            work_skip(linked_list_pop_start(job->followers), NULL);
+        }
+        linked_list_destroy(job->followers);
+    }
+
+    metrics_add(jobs_aborted, 1);
+    log_print(server_logger, "Skipping Aborted Job");
+    TRACE(work_done, TRACE_ASYNC_END, job->id);
+    pool_free(&job_pool, job);
+}
+
+/*
+ * Queues a job dropped from the scheduler up again for the next client that
+ * still wants it, or frees it if there are none.
+ * Note: must be called with jobs_mutex held.
  */
+void work_requeue(void *pjob, void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    WorkJob *job = (WorkJob *) pjob;
+
+    WorkJob *live = work_live(job);
+    if (live == NULL) {
+        linked_list_pop(inflight_jobs, job->inflight_node);
+        work_skip(job, NULL);
+        return;
+    }
+
+    scheduler_push(scheduler, live->conn.id, job, job->solve.thread_count,
+            hashcash_expected_hashes(job->target));
+}
 
 /*
- * Parse the given SOLN message.
+ * Returns the first of the given job and the jobs merged into it that hasn't
+ * been cancelled, or NULL if they all have.
+ * Note: must be called with jobs_mutex held.
  */
-void soln_parse(char *msg, uint32_t *difficulty, BYTE *seed, uint64_t *solution) {
-    // read difficulty
-    sscanf(msg, "%" PRIx32, difficulty);
-    msg += 8 + 1;
+WorkJob *work_live(WorkJob *job) {
+    if (!job->cancelled) {
+        return job;
+    }
 
-    // read seed
-    char copy[65]; // create a copy as the string needs to be modified
-    strncpy(copy, msg, 64);
-    copy[64] = '\0';
-    // the actual reading
-    int j = 32;
-    for (int i = 62; i >= 0; i -= 2) {
-        copy[i+2] = '\0';
-        seed[--j] = strtoul(copy + i, NULL, 16);
+    for (Node *n = job->followers->head; n != NULL; n = n->next) {
+        WorkJob *follower = (WorkJob *) n->data;
+        if (!follower->cancelled) {
+            return follower;
+        }
     }
-    msg += 64 + 1;
 
-    // read solution
-    sscanf(msg, "%" PRIx64, solution);
+    return NULL;
 }
 
+/*
+ * Returns the (still searching) job identical to the given one, if there is
+ * one.
+ * Note: must be called with jobs_mutex held.
+ */
+WorkJob *work_find_identical(WorkJob *job) {
+    for (Node *n = inflight_jobs->head; n != NULL; n = n->next) {
+        WorkJob *other = (WorkJob *) n->data;
+        if (!solver_aborted(&other->solve)
+                && other->work.difficulty == job->work.difficulty
+                && other->work.nonce == job->work.nonce
+                && 0 == memcmp(other->work.seed, job->work.seed, 32)) {
+            return other;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Aborts all queued (and active) work jobs for the given client.
+ * Note: only looks at the client's own jobs, which are tracked by its
+ *       connection id, so a reused socket can't take anyone else's with it.
+ */
+void work_abort(Client *client) {
+    // kill every job still on the work queue, the work consumer skips them
+    // as it gets to them
+    atomic_fetch_add(&client->tombstone->epoch, 1);
+
+    pthread_mutex_lock(&jobs_mutex);
+
+    // cancel the client's part in every queued, active and done (but not yet
+    // replied to) job, only stopping the search once nobody wants it
+    while (!linked_list_is_empty(client->jobs)) {
+        WorkJob *job = (WorkJob *) linked_list_pop_start(client->jobs);
+        job->client_node = NULL;
+        job->cancelled = 1;
+
+        WorkJob *leader = job->leader != NULL ? job->leader : job;
+        if (work_live(leader) == NULL) {
+            solver_abort(&leader->solve);
+        }
+    }
+
+    // drop the queued jobs, handing the ones other clients still want over
+    // to them
+    scheduler_drop(scheduler, client->conn.id, work_requeue, NULL);
+
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
+/*
+ * Takes the given (replied to) job out of its client's jobs.
+ * Note: must be called with jobs_mutex held.
+ */
+void work_unlink(WorkJob *job) {
+    if (job->client_node != NULL) {
+        linked_list_pop(job->client_jobs, job->client_node);
+        job->client_node = NULL;
+    }
+}
+
+/*
+ * Lets go of the given tombstone, freeing it if nothing else holds it.
+ */
+void tombstone_release(Tombstone *tombstone) {
+    if (1 == atomic_fetch_sub(&tombstone->refs, 1)) {
+        pool_free(&tombstone_pool, tombstone);
+    }
+}
+
+
+/******** SOLN msg helper functions
+ */
+
 /*
  * Verify the given SOLN message.
  * Returns 1 if it is valid and 0 otherwise.
  */
-int soln_verify(char *soln_msg) {
-    uint32_t difficulty;
-    BYTE seed[32];
-    uint64_t solution;
+int soln_verify(SSTPWork *soln) {
+    BYTE target[32];
 
-    soln_parse(soln_msg, &difficulty, seed, &solution);
+    hashcash_calc_target(target, soln->difficulty);
 
-    BYTE target[32];
+    return hashcash_verify(target, soln->seed, soln->nonce);
+}
+
+
+/******** Metrics helper functions
+ */
+
+/*
+ * Registers the server's metrics.
+ */
+void metrics_init_server(void) {
+    char *help = "Jobs by what happened to them.";
+    jobs_queued = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"queued\"", help);
+    jobs_cached = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"cached\"", help);
+    jobs_merged = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"merged\"", help);
+    jobs_solved = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"solved\"", help);
+    jobs_unsolved = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"unsolved\"", help);
+    jobs_aborted = metrics_register(METRIC_COUNTER, "server_jobs_total",
+            "state=\"aborted\"", help);
+
+    metrics_register_func(METRIC_GAUGE, "server_jobs_pending", "",
+            "Jobs waiting in the scheduler for solver threads.",
+            metrics_queued_jobs, NULL);
+    metrics_register_samples(METRIC_GAUGE, "server_client_jobs_pending",
+            "Jobs waiting in the scheduler, by the connection that sent them.",
+            metrics_client_depths, NULL);
+    metrics_register_func(METRIC_GAUGE, "server_jobs_active", "",
+            "Jobs being searched by the solver pool.",
+            metrics_active_jobs, NULL);
+
+    connections = metrics_register(METRIC_GAUGE, "server_connections", "",
+            "Connected clients.");
+    connections_total = metrics_register(METRIC_COUNTER,
+            "server_connections_total", "", "Clients that have connected.");
+
+    // a counter for each kind of msg, each way
+    char *labels[2][MSG_TYPES] = {
+        {
+            "direction=\"in\",type=\"PING\"",
+            "direction=\"in\",type=\"PONG\"",
+            "direction=\"in\",type=\"OKAY\"",
+            "direction=\"in\",type=\"ERRO\"",
+            "direction=\"in\",type=\"SOLN\"",
+            "direction=\"in\",type=\"WORK\"",
+            "direction=\"in\",type=\"ABRT\"",
+            "direction=\"in\",type=\"MALFORMED\""
+        }, {
+            "direction=\"out\",type=\"PING\"",
+            "direction=\"out\",type=\"PONG\"",
+            "direction=\"out\",type=\"OKAY\"",
+            "direction=\"out\",type=\"ERRO\"",
+            "direction=\"out\",type=\"SOLN\"",
+            "direction=\"out\",type=\"WORK\"",
+            "direction=\"out\",type=\"ABRT\"",
+            "direction=\"out\",type=\"MALFORMED\""
+        }
+    };
+    for (int i = 0; i < MSG_TYPES; i++) {
+        msgs_received[i] = metrics_register(METRIC_COUNTER,
+                "sstp_messages_total", labels[0][i],
+                "SSTP msgs by direction and type.");
+        msgs_sent[i] = metrics_register(METRIC_COUNTER,
+                "sstp_messages_total", labels[1][i],
+                "SSTP msgs by direction and type.");
+    }
+
+    queue_wait_time = metrics_register(METRIC_HISTOGRAM,
+            "server_queue_wait_seconds", "",
+            "Time WORK msgs wait before their search starts.");
+    solve_time = metrics_register(METRIC_HISTOGRAM, "server_solve_seconds",
+            "", "Time the solver pool spends on each job.");
+    soln_verify_time = metrics_register(METRIC_HISTOGRAM,
+            "server_soln_verify_seconds", "",
+            "Time taken to verify each SOLN msg.");
+
+    metrics_register_func(METRIC_COUNTER, "server_cache_hits_total", "",
+            "WORK msgs answered from the solution cache.",
+            metrics_cache_hits, NULL);
+    metrics_register_func(METRIC_COUNTER, "server_cache_misses_total", "",
+            "WORK msgs not in the solution cache.",
+            metrics_cache_misses, NULL);
+
+    metrics_register_func(METRIC_COUNTER, "server_heap_allocations_total", "",
+            "Heap allocations the server has made.", metrics_heap_allocs,
+            NULL);
+    metrics_register_func(METRIC_COUNTER, "server_heap_frees_total", "",
+            "Heap allocations the server has freed.", metrics_heap_frees,
+            NULL);
+}
+
+/*
+ * Read by the metrics, for the number of jobs waiting in the scheduler.
+ */
+double metrics_queued_jobs(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    int count = 0;
+    pthread_mutex_lock(&jobs_mutex);
+    scheduler_iter(scheduler, metrics_count_depth, &count);
+    pthread_mutex_unlock(&jobs_mutex);
+
+    return count;
+}
 
-    hashcash_calc_target(target, difficulty);
+/*
+ * Adds a client's queue depth to the count.
+ */
+void metrics_count_depth(uint64_t client, int depth, void *pcount) {
+    (void)client; // purposefully unused, so silence the compiler
+    *((int *) pcount) += depth;
+}
+
+/*
+ * Read by the metrics, for the number of jobs each client has waiting in the
+ * scheduler (only the clients with any).
+ */
+void metrics_client_depths(MetricSamples *samples, void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    pthread_mutex_lock(&jobs_mutex);
+    scheduler_iter(scheduler, metrics_sample_depth, samples);
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
+/*
+ * Writes out a client's queue depth, labelled by its connection id.
+ */
+void metrics_sample_depth(uint64_t client, int depth, void *psamples) {
+    char labels[64];
+    snprintf(labels, sizeof(labels), "client=\"%" PRIu64 "\"", client);
+    metrics_sample((MetricSamples *) psamples, labels, depth);
+}
+
+/*
+ * Read by the metrics, for the number of jobs on the solver pool.
+ */
+double metrics_active_jobs(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    pthread_mutex_lock(&jobs_mutex);
+    int count = active_jobs->len;
+    pthread_mutex_unlock(&jobs_mutex);
+
+    return count;
+}
+
+/*
+ * Read by the metrics, for the solution cache's hits and misses.
+ */
+double metrics_cache_hits(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    uint64_t hits, misses;
+    cache_stats(solution_cache, &hits, &misses);
+    return hits;
+}
+
+double metrics_cache_misses(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    uint64_t hits, misses;
+    cache_stats(solution_cache, &hits, &misses);
+    return misses;
+}
+
+/*
+ * Read by the metrics, for the heap allocations (see alloc-count.h).
+ */
+double metrics_heap_allocs(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    uint64_t allocs, frees;
+    alloc_count(&allocs, &frees);
+    return allocs;
+}
 
-    return hashcash_verify(target, seed, solution);
+double metrics_heap_frees(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+    uint64_t allocs, frees;
+    alloc_count(&allocs, &frees);
+    return frees;
 }
 
 
@@ -465,6 +1360,10 @@ int soln_verify(char *soln_msg) {
  * Helper to log sstp messages.
  */
 void sstp_log(Logger *logger, char *prefix, SSTPMsgType type, char *payload) {
+    if (!log_enabled(LOG_DEBUG)) {
+        return;
+    }
+
     char *header;
     switch (type) {
         case PING: header = "PING"; break;
@@ -497,31 +1396,58 @@ void sstp_log(Logger *logger, char *prefix, SSTPMsgType type, char *payload) {
                     prefix, header, payload);
             break;
     }
-    log_print(logger, buf);
+    log_print_level(logger, LOG_DEBUG, buf);
 }
 
 /*
- * Wrapper around sstp_read that logs the call.
+ * Wrapper around sstp_read that logs (and captures) the call, for the
+ * connection with the given id.
  */
-int sstp_log_read(SSTPSocketWrapper *sstp, Logger *logger, SSTPMsg *msg) {
+int sstp_log_read(uint64_t id, SSTPSocketWrapper *sstp, Logger *logger,
+        SSTPMsg *msg) {
     int res = sstp_read(sstp, msg);
     if (res > 0) { // log only if successful
+        metrics_add(msgs_received[msg->type], 1);
+        capture_record(id, CAPTURE_IN, msg->type, msg->payload,
+                msg->payload_len);
+        sstp_log(logger, "Recieved: ", msg->type, msg->payload);
+    }
+    return res;
+}
+
+/*
+ * Wrapper around sstp_try_read that logs (and captures) the call.
+ */
+int sstp_log_try_read(uint64_t id, SSTPSocketWrapper *sstp, Logger *logger,
+        SSTPMsg *msg) {
+    int res = sstp_try_read(sstp, msg);
+    if (res > 0) { // log only if successful
+        metrics_add(msgs_received[msg->type], 1);
+        capture_record(id, CAPTURE_IN, msg->type, msg->payload,
+                msg->payload_len);
         sstp_log(logger, "Recieved: ", msg->type, msg->payload);
     }
     return res;
 }
 
 /*
- * Wrapper around sstp_write that logs the call.
+ * Wrapper around sstp_write that logs (and captures) the call.
  */
-int sstp_log_write(pthread_mutex_t *write_mutex, SSTPSocketWrapper *sstp,
-        Logger *logger, SSTPMsgType type, char payload[]) {
+int sstp_log_write(uint64_t id, pthread_mutex_t *write_mutex,
+        SSTPSocketWrapper *sstp, Logger *logger, SSTPMsgType type,
+        char payload[]) {
 
     pthread_mutex_lock(write_mutex);
 
     int res = sstp_write(sstp, type, payload);
+    TRACE(sstp_write, TRACE_INSTANT, id);
     if (res == 0) { // log only if successful
+        metrics_add(msgs_sent[type], 1);
+        capture_record(id, CAPTURE_OUT, type, payload,
+                payload != NULL ? strlen(payload) : 0);
         sstp_log(logger, "Sending:  ", type, payload);
+    } else if (res == SSTP_FULL) {
+        log_print_level(logger, LOG_WARN, "Not Reading Replies, Disconnecting");
     }
 
     pthread_mutex_unlock(write_mutex);
@@ -0,0 +1,504 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define CACHE_LINE 64
+
+// how many ways each counter and histogram is split (a power of two), threads
+// beyond this many share shards
+#define SHARDS 16
+
+#define MAX_METRICS 128
+
+// the histogram buckets: values below SUB_COUNT get a bucket each, and every
+// power of two above that is split into SUB_COUNT buckets, up to 2^MAX_EXP ns
+// (over an hour)
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_EXP 42
+#define BUCKETS ((MAX_EXP - SUB_BITS + 1) * SUB_COUNT)
+
+#define CONNECTION_BACKLOG 4
+#define REQUEST_LEN 1024
+
+double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+
+/***** Private structs
+ */
+
+/*
+ * A thread's share of a counter.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic int64_t value;
+} CounterShard;
+
+/*
+ * A thread's share of a histogram.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t buckets[BUCKETS];
+} HistogramShard;
+
+struct MetricSamples {
+    FILE *out;
+    Metric *metric;
+};
+
+struct Metric {
+    MetricType type;
+    char *name;
+    char *labels;
+    char *help;
+
+    // for the ones read from elsewhere (a single sample, or any number)
+    double (*read)(void *data);
+    void (*read_samples)(MetricSamples *samples, void *data);
+    void *data;
+
+    // whichever the type needs
+    CounterShard *counter;
+    _Atomic int64_t gauge;
+    HistogramShard *histogram;
+};
+
+// every registered metric, registering is protected by the mutex
+Metric *metrics[MAX_METRICS];
+_Atomic int metrics_len = 0;
+pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// which shard each thread uses
+_Thread_local int thread_shard = -1;
+_Atomic int next_shard = 0;
+
+
+/***** Helper function prototypes
+ */
+
+Metric *metrics_new(MetricType type, char *name, char *labels, char *help);
+int get_shard(void);
+int bucket_of(uint64_t ns);
+uint64_t bucket_max(int bucket);
+int print_header(FILE *out, int i);
+void print_metric(FILE *out, Metric *metric);
+void print_labels(FILE *out, char *labels, char *extra);
+void print_histogram(FILE *out, Metric *metric);
+uint64_t histogram_merge(Metric *metric, uint64_t *buckets, uint64_t *sum);
+double histogram_quantile(uint64_t *buckets, uint64_t count, double q);
+void *metrics_server(void *plistener);
+
+
+/***** Public functions
+ */
+
+Metric *metrics_register(MetricType type, char *name, char *labels,
+        char *help) {
+    Metric *metric = metrics_new(type, name, labels, help);
+
+    switch (type) {
+        case METRIC_COUNTER:
+            metric->counter = (CounterShard *) aligned_alloc(CACHE_LINE,
+                    SHARDS * sizeof(CounterShard));
+            assert(metric->counter);
+            for (int i = 0; i < SHARDS; i++) {
+                atomic_init(&metric->counter[i].value, 0);
+            }
+            break;
+        case METRIC_GAUGE:
+            break;
+        case METRIC_HISTOGRAM:
+            metric->histogram = (HistogramShard *) aligned_alloc(CACHE_LINE,
+                    SHARDS * sizeof(HistogramShard));
+            assert(metric->histogram);
+            memset(metric->histogram, 0, SHARDS * sizeof(HistogramShard));
+            break;
+    }
+
+    return metric;
+}
+
+Metric *metrics_register_func(MetricType type, char *name, char *labels,
+        char *help, double (*read)(void *data), void *data) {
+    assert(type != METRIC_HISTOGRAM);
+
+    Metric *metric = metrics_new(type, name, labels, help);
+    metric->read = read;
+    metric->data = data;
+
+    return metric;
+}
+
+Metric *metrics_register_samples(MetricType type, char *name, char *help,
+        void (*read)(MetricSamples *samples, void *data), void *data) {
+    assert(type != METRIC_HISTOGRAM);
+
+    Metric *metric = metrics_new(type, name, "", help);
+    metric->read_samples = read;
+    metric->data = data;
+
+    return metric;
+}
+
+void metrics_sample(MetricSamples *samples, char *labels, double value) {
+    fprintf(samples->out, "%s", samples->metric->name);
+    print_labels(samples->out, labels, NULL);
+    fprintf(samples->out, " %.17g\n", value);
+}
+
+void metrics_add(Metric *metric, int64_t n) {
+    if (metric->type == METRIC_GAUGE) {
+        atomic_fetch_add_explicit(&metric->gauge, n, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&metric->counter[get_shard()].value, n,
+                memory_order_relaxed);
+    }
+}
+
+void metrics_set(Metric *metric, int64_t value) {
+    atomic_store_explicit(&metric->gauge, value, memory_order_relaxed);
+}
+
+void metrics_observe(Metric *metric, uint64_t ns) {
+    HistogramShard *shard = metric->histogram + get_shard();
+
+    atomic_fetch_add_explicit(&shard->buckets[bucket_of(ns)], 1,
+            memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->sum, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed);
+}
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_print(FILE *out) {
+    int len = atomic_load(&metrics_len);
+
+    // every metric of the same name goes together, under the first's header
+    for (int i = 0; i < len; i++) {
+        if (!print_header(out, i)) {
+            continue;
+        }
+        for (int j = i; j < len; j++) {
+            if (0 == strcmp(metrics[j]->name, metrics[i]->name)) {
+                print_metric(out, metrics[j]);
+            }
+        }
+    }
+}
+
+double metrics_quantile(Metric *metric, double q) {
+    uint64_t buckets[BUCKETS] = {0};
+    uint64_t sum;
+    uint64_t count = histogram_merge(metric, buckets, &sum);
+
+    return histogram_quantile(buckets, count, q);
+}
+
+int metrics_serve(int port) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("ERROR: opening metrics socket");
+        return 1;
+    }
+
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+    // only for this machine
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (0 != bind(listener, (struct sockaddr *) &addr, sizeof(addr))
+            || 0 != listen(listener, CONNECTION_BACKLOG)) {
+        perror("ERROR: listening for metrics");
+        close(listener);
+        return 1;
+    }
+
+    int *plistener = malloc(sizeof(int));
+    assert(plistener);
+    *plistener = listener;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    pthread_create(&tid, &attr, metrics_server, (void *) plistener);
+    pthread_attr_destroy(&attr);
+
+    return 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Registers a new metric, with nothing specific to its type set up.
+ */
+Metric *metrics_new(MetricType type, char *name, char *labels, char *help) {
+    Metric *metric = (Metric *) calloc(1, sizeof(Metric));
+    assert(metric);
+
+    metric->type = type;
+    metric->name = name;
+    metric->labels = labels;
+    metric->help = help;
+    atomic_init(&metric->gauge, 0);
+
+    pthread_mutex_lock(&metrics_mutex);
+    int len = atomic_load(&metrics_len);
+    assert(len < MAX_METRICS);
+    metrics[len] = metric;
+    atomic_store(&metrics_len, len + 1);
+    pthread_mutex_unlock(&metrics_mutex);
+
+    return metric;
+}
+
+/*
+ * Returns the calling thread's shard, picking one the first time.
+ */
+int get_shard(void) {
+    if (thread_shard < 0) {
+        thread_shard = atomic_fetch_add(&next_shard, 1) & (SHARDS - 1);
+    }
+    return thread_shard;
+}
+
+/*
+ * The histogram bucket the given value goes in.
+ */
+int bucket_of(uint64_t ns) {
+    if (ns >= (uint64_t) 1 << MAX_EXP) {
+        ns = ((uint64_t) 1 << MAX_EXP) - 1;
+    }
+    if (ns < SUB_COUNT) {
+        return ns;
+    }
+
+    int exp = 63 - __builtin_clzll(ns);
+    return (exp - SUB_BITS + 1) * SUB_COUNT
+        + ((ns >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/*
+ * The highest value that goes in the given histogram bucket.
+ */
+uint64_t bucket_max(int bucket) {
+    if (bucket < SUB_COUNT) {
+        return bucket;
+    }
+
+    int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+    uint64_t lower = (uint64_t) (SUB_COUNT + bucket % SUB_COUNT)
+        << (exp - SUB_BITS);
+    return lower + ((uint64_t) 1 << (exp - SUB_BITS)) - 1;
+}
+
+/*
+ * Prints the HELP and TYPE lines of the i-th metric, unless they've already
+ * been printed for another metric of the same name.
+ * Returns true if they were.
+ */
+int print_header(FILE *out, int i) {
+    for (int j = 0; j < i; j++) {
+        if (0 == strcmp(metrics[j]->name, metrics[i]->name)) {
+            return 0;
+        }
+    }
+
+    char *types[] = { "counter", "gauge", "summary" };
+    fprintf(out, "# HELP %s %s\n", metrics[i]->name, metrics[i]->help);
+    fprintf(out, "# TYPE %s %s\n", metrics[i]->name,
+            types[metrics[i]->type]);
+    return 1;
+}
+
+/*
+ * Prints the given metric's samples.
+ */
+void print_metric(FILE *out, Metric *metric) {
+    if (metric->type == METRIC_HISTOGRAM) {
+        print_histogram(out, metric);
+        return;
+    }
+    if (metric->read_samples != NULL) {
+        MetricSamples samples = { out, metric };
+        metric->read_samples(&samples, metric->data);
+        return;
+    }
+
+    fprintf(out, "%s", metric->name);
+    print_labels(out, metric->labels, NULL);
+
+    if (metric->read != NULL) {
+        fprintf(out, " %.17g\n", metric->read(metric->data));
+    } else if (metric->type == METRIC_GAUGE) {
+        fprintf(out, " %" PRId64 "\n", atomic_load(&metric->gauge));
+    } else {
+        int64_t value = 0;
+        for (int s = 0; s < SHARDS; s++) {
+            value += atomic_load_explicit(&metric->counter[s].value,
+                    memory_order_relaxed);
+        }
+        fprintf(out, " %" PRId64 "\n", value);
+    }
+}
+
+/*
+ * Prints the given labels (and the extra one if not NULL) in braces, or
+ * nothing if there are none.
+ */
+void print_labels(FILE *out, char *labels, char *extra) {
+    int has_labels = labels[0] != '\0';
+    if (!has_labels && extra == NULL) {
+        return;
+    }
+
+    fprintf(out, "{%s%s%s}", labels, has_labels && extra != NULL ? "," : "",
+            extra != NULL ? extra : "");
+}
+
+/*
+ * Prints the given histogram as a summary, with its quantiles in seconds.
+ */
+void print_histogram(FILE *out, Metric *metric) {
+    uint64_t buckets[BUCKETS] = {0};
+    uint64_t sum;
+    uint64_t count = histogram_merge(metric, buckets, &sum);
+
+    char quantile[32];
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(double); q++) {
+        snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", quantiles[q]);
+        fprintf(out, "%s", metric->name);
+        print_labels(out, metric->labels, quantile);
+        fprintf(out, " %.9g\n",
+                histogram_quantile(buckets, count, quantiles[q]));
+    }
+
+    fprintf(out, "%s_sum", metric->name);
+    print_labels(out, metric->labels, NULL);
+    fprintf(out, " %.9g\n", sum / 1e9);
+    fprintf(out, "%s_count", metric->name);
+    print_labels(out, metric->labels, NULL);
+    fprintf(out, " %" PRIu64 "\n", count);
+}
+
+/*
+ * Sums up every shard of the given histogram into buckets (which must start
+ * out zeroed), and sets sum.
+ * Returns the number of observations.
+ */
+uint64_t histogram_merge(Metric *metric, uint64_t *buckets, uint64_t *sum) {
+    uint64_t count = 0;
+    *sum = 0;
+
+    for (int s = 0; s < SHARDS; s++) {
+        HistogramShard *shard = metric->histogram + s;
+        for (int b = 0; b < BUCKETS; b++) {
+            buckets[b] += atomic_load_explicit(&shard->buckets[b],
+                    memory_order_relaxed);
+        }
+        *sum += atomic_load_explicit(&shard->sum, memory_order_relaxed);
+    }
+    for (int b = 0; b < BUCKETS; b++) {
+        count += buckets[b];
+    }
+
+    return count;
+}
+
+/*
+ * The value, in seconds, at least the given fraction of the observations in
+ * the buckets are at or below (the top of its bucket), 0 if there are none.
+ */
+double histogram_quantile(uint64_t *buckets, uint64_t count, double q) {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (q * count + 0.999999);
+    uint64_t seen = 0;
+    int b = 0;
+    while (b < BUCKETS - 1 && seen + buckets[b] < rank) {
+        seen += buckets[b++];
+    }
+
+    return bucket_max(b) / 1e9;
+}
+
+/*
+ * The admin thread, that answers every connection with the metrics.
+ */
+void *metrics_server(void *plistener) {
+    int listener = *((int *) plistener);
+    free(plistener);
+
+    while (1) {
+        int sockfd = accept(listener, NULL, NULL);
+        if (sockfd < 0) {
+            continue;
+        }
+
+        // don't let a quiet client hold the metrics up
+        struct timeval timeout = { 1, 0 };
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                sizeof(timeout));
+
+        // whatever the request was, it gets the metrics
+        char request[REQUEST_LEN];
+        recv(sockfd, request, REQUEST_LEN, 0);
+
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        assert(out);
+        metrics_print(out);
+        fclose(out);
+
+        char header[128];
+        int header_len = snprintf(header, sizeof(header),
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n\r\n", body_len);
+        send(sockfd, header, header_len, MSG_NOSIGNAL | MSG_MORE);
+        send(sockfd, body, body_len, MSG_NOSIGNAL);
+
+        free(body);
+        close(sockfd);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,112 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The metrics module. A registry of counters, gauges and latency histograms,
+ * that can be served in the Prometheus text format on a local admin port.
+ *
+ * Counters and histograms are sharded by thread (each shard on cache lines of
+ * its own), so updating them from the hot path never contends with another
+ * thread, and they are only summed up when they're read.
+ * Histograms are HDR style: log-linear buckets with 16 sub-buckets per power
+ * of two, so any latency (from 1ns to over an hour) is kept to within about
+ * 6%, and are served as quantiles.
+ *
+ * Metrics are registered once (eg. at startup) and then never freed.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+} MetricType;
+
+/*
+ * Struct for a single metric.
+ * Internals are private.
+ */
+typedef struct Metric Metric;
+
+/*
+ * Where the samples of a metric registered with metrics_register_samples are
+ * written to, while it's being read (see metrics_sample).
+ * Internals are private.
+ */
+typedef struct MetricSamples MetricSamples;
+
+/*
+ * Registers a new metric of the given type.
+ * name is the metric's name (metrics sharing one should have the same type
+ * and help), labels its labels (eg. "kernel=\"avx2\"", or "" for none) and
+ * help what it measures.
+ * Histograms take nanoseconds, and are served in seconds.
+ */
+Metric *metrics_register(MetricType type, char *name, char *labels,
+        char *help);
+
+/*
+ * Registers a metric whose value is read by calling read with data whenever
+ * the metrics are served (eg. for ones that another module keeps track of).
+ * Only for counters and gauges.
+ */
+Metric *metrics_register_func(MetricType type, char *name, char *labels,
+        char *help, double (*read)(void *data), void *data);
+
+/*
+ * Registers a metric with any number of samples (eg. one per connection,
+ * that come and go), that are read by calling read with data whenever the
+ * metrics are served. read calls metrics_sample once for each sample.
+ * Only for counters and gauges.
+ */
+Metric *metrics_register_samples(MetricType type, char *name, char *help,
+        void (*read)(MetricSamples *samples, void *data), void *data);
+
+/*
+ * Writes out a sample of the metric being read, with the given labels (eg.
+ * "client=\"3\"") and value.
+ */
+void metrics_sample(MetricSamples *samples, char *labels, double value);
+
+/*
+ * Adds n to the given counter or gauge.
+ */
+void metrics_add(Metric *metric, int64_t n);
+
+/*
+ * Sets the given gauge.
+ */
+void metrics_set(Metric *metric, int64_t value);
+
+/*
+ * Records a value, in nanoseconds, in the given histogram.
+ */
+void metrics_observe(Metric *metric, uint64_t ns);
+
+/*
+ * The value, in seconds, that at least the given fraction (eg. 0.99) of the
+ * given histogram's observations are at or below, to within a bucket.
+ */
+double metrics_quantile(Metric *metric, double q);
+
+/*
+ * The current (monotonic) time in nanoseconds, to measure latencies with.
+ */
+uint64_t metrics_now(void);
+
+/*
+ * Writes every metric out to the given file, in the Prometheus text format.
+ */
+void metrics_print(FILE *out);
+
+/*
+ * Serves the metrics (over HTTP, to any request) on the given port of the
+ * loopback interface, on a thread of its own.
+ * Returns non-zero if the port couldn't be listened on.
+ */
+int metrics_serve(int port);
@@ -0,0 +1,379 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Connection handling benchmarks.
+ *
+ * Runs a minimal PING -> PONG server on each of the server backends, and
+ * floods it with pipelined PINGs from a few client threads.
+ * Prints one "benchmark,value,unit" line per result (the same as
+ * hashcash-bench), for each backend:
+ *   ping/BACKEND/rate: the PONGs received per second
+ *   ping/BACKEND/syscalls: the server's networking syscalls per PONG
+ *
+ * Usage: ./sstp-ping-bench [-c CLIENTS] [-w WINDOW] [-i IO_THREADS] [-d MS]
+ *   CLIENTS: how many connections flood the server, defaults to 4.
+ *   WINDOW: how many PINGs each client sends before reading the PONGs,
+ *           defaults to 16.
+ *   IO_THREADS: the I/O threads given to epoll and uring, defaults to 2.
+ *   MS: roughly how long each backend is measured for, defaults to 1000.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "sstp-socket-wrapper.h"
+
+#define BASE_PORT 4620
+#define MAX_CLIENTS 256
+#define MAX_WINDOW 1024
+#define CONNECT_TRIES 200
+
+char *backends[] = { "threads", "epoll", "uring" };
+
+/*
+ * The server being benchmarked.
+ */
+typedef struct {
+    int backend;
+    int port;
+    volatile int failed; // set if the server couldn't be started
+} Bench;
+
+/*
+ * A single flooding client.
+ */
+typedef struct {
+    Bench *bench;
+    double seconds;
+    int window;
+    long pongs;
+} Flooder;
+
+int io_threads = 2;
+
+
+/***** Helper function prototypes
+ */
+
+double bench_backend(Bench *bench, int clients, int window, double seconds);
+void *flood(void *pflooder);
+int connect_to(Bench *bench);
+void *serve(void *pbench);
+void *ping_handler(void *pconn);
+void ping_spawner(Connection conn);
+void *ping_open(Connection conn);
+int ping_readable(Connection conn, void *data);
+int ping_received(Connection conn, void *data, char *buf, int len);
+int ping_writable(Connection conn, void *data);
+void ping_close(Connection conn, void *data);
+double now(void);
+
+
+/***** Main functions
+ */
+
+int main(int argc, char *argv[]) {
+    int clients = 4;
+    int window = 16;
+    double seconds = 1;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "c:w:i:d:"))) {
+        switch (opt) {
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'i':
+                io_threads = atoi(optarg);
+                break;
+            case 'd':
+                seconds = atoi(optarg) / 1000.0;
+                break;
+            default:
+                exit(1);
+        }
+    }
+    if (clients < 1 || clients > MAX_CLIENTS
+            || window < 1 || window > MAX_WINDOW) {
+        fprintf(stderr, "ERROR: clients must be 1-%d and window 1-%d\n",
+                MAX_CLIENTS, MAX_WINDOW);
+        exit(1);
+    }
+
+    printf("benchmark,value,unit\n");
+
+    char name[64];
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        Bench *bench = malloc(sizeof(Bench));
+        assert(bench);
+        bench->backend = i;
+        bench->port = BASE_PORT + i;
+        bench->failed = 0;
+
+        // the servers never return, so just leave them running
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t tid;
+        pthread_create(&tid, &attr, serve, (void *) bench);
+        pthread_attr_destroy(&attr);
+
+        uint64_t syscalls = server_syscalls();
+        double rate = bench_backend(bench, clients, window, seconds);
+        if (rate < 0) {
+            fprintf(stderr, "ERROR: %s unavailable\n", backends[i]);
+            continue;
+        }
+        syscalls = server_syscalls() - syscalls;
+
+        snprintf(name, sizeof(name), "ping/%s/rate", backends[i]);
+        printf("%s,%.6g,msgs/s\n", name, rate);
+        snprintf(name, sizeof(name), "ping/%s/syscalls", backends[i]);
+        printf("%s,%.6g,syscalls/msg\n", name,
+                syscalls / (rate * seconds));
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Floods the given server from the given number of clients, for about the
+ * given time.
+ * Returns the PONGs received per second, or -1 if the server isn't up.
+ */
+double bench_backend(Bench *bench, int clients, int window, double seconds) {
+    pthread_t tids[MAX_CLIENTS];
+    Flooder flooders[MAX_CLIENTS];
+
+    double start = now();
+    for (int i = 0; i < clients; i++) {
+        flooders[i].bench = bench;
+        flooders[i].seconds = seconds;
+        flooders[i].window = window;
+        flooders[i].pongs = 0;
+        pthread_create(tids + i, NULL, flood, (void *) (flooders + i));
+    }
+
+    long pongs = 0;
+    int failed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(tids[i], NULL);
+        if (flooders[i].pongs < 0) {
+            failed = 1;
+        }
+        pongs += flooders[i].pongs;
+    }
+
+    return failed ? -1 : pongs / (now() - start);
+}
+
+/*
+ * A client thread, that sends a window of PINGs at a time and waits for all
+ * of their PONGs, for the given time.
+ */
+void *flood(void *pflooder) {
+    Flooder *flooder = (Flooder *) pflooder;
+
+    int sockfd = connect_to(flooder->bench);
+    if (sockfd < 0) {
+        flooder->pongs = -1;
+        return NULL;
+    }
+
+    static const char ping[] = "PING\r\n";
+    int msg_len = sizeof(ping) - 1;
+    int len = flooder->window * msg_len;
+    char out[MAX_WINDOW * 6];
+    char in[MAX_WINDOW * 6];
+    for (int i = 0; i < flooder->window; i++) {
+        memcpy(out + i * msg_len, ping, msg_len);
+    }
+
+    double end = now() + flooder->seconds;
+    while (now() < end) {
+        if (len != send(sockfd, out, len, 0)) {
+            perror("ERROR: sending");
+            break;
+        }
+
+        // PONG\r\n is as long as PING\r\n
+        int got = 0;
+        while (got < len) {
+            int n = recv(sockfd, in + got, len - got, 0);
+            if (n <= 0) {
+                perror("ERROR: receiving");
+                close(sockfd);
+                return NULL;
+            }
+            got += n;
+        }
+        flooder->pongs += flooder->window;
+    }
+
+    close(sockfd);
+    return NULL;
+}
+
+/*
+ * Connects to the given server, waiting for it to come up.
+ * Returns the socket, or -1 if it doesn't.
+ */
+int connect_to(Bench *bench) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bench->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (int i = 0; i < CONNECT_TRIES && !bench->failed; i++) {
+        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (0 == connect(sockfd, (struct sockaddr *) &addr, sizeof(addr))) {
+            return sockfd;
+        }
+        close(sockfd);
+
+        struct timespec ts = { 0, 10 * 1000 * 1000 };
+        nanosleep(&ts, NULL);
+    }
+
+    return -1;
+}
+
+/*
+ * Runs the given server, which only returns if it can't be started.
+ */
+void *serve(void *pbench) {
+    Bench *bench = (Bench *) pbench;
+
+    ConnectionEvents events = {
+        ping_open, ping_readable, ping_received, ping_writable, ping_close
+    };
+    switch (bench->backend) {
+        case 0:
+            server(bench->port, ping_spawner);
+            break;
+        case 1:
+            server_reactor(bench->port, io_threads, &events);
+            break;
+        default:
+            server_uring(bench->port, io_threads, &events);
+            break;
+    }
+
+    bench->failed = 1;
+    return NULL;
+}
+
+/*
+ * Replies to a connection on a thread of its own.
+ */
+void *ping_handler(void *pconn) {
+    Connection conn = *((Connection *) pconn);
+    free(pconn);
+
+    SSTPSocketWrapper *sstp = sstp_init(conn.sockfd);
+
+    SSTPMsg msg;
+    while (0 < sstp_read(sstp, &msg)) {
+        if (sstp_has_input(sstp)) {
+            sstp_cork(sstp);
+            sstp_write(sstp, PONG, NULL);
+        } else {
+            sstp_write(sstp, PONG, NULL);
+            sstp_uncork(sstp);
+        }
+    }
+
+    sstp_destroy(sstp);
+    close(conn.sockfd);
+
+    return NULL;
+}
+
+/*
+ * Spawns a detached ping_handler thread for each connection.
+ */
+void ping_spawner(Connection conn) {
+    Connection *pconn = malloc(sizeof(Connection));
+    assert(pconn);
+    *pconn = conn;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    pthread_create(&tid, &attr, ping_handler, (void *) pconn);
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * The event callbacks, which reply PONG to every msg.
+ */
+void *ping_open(Connection conn) {
+    return sstp_init(conn.sockfd);
+}
+
+int ping_readable(Connection conn, void *data) {
+    (void)conn; // purposefully unused
+    SSTPSocketWrapper *sstp = (SSTPSocketWrapper *) data;
+
+    SSTPMsg msg;
+    int res;
+    sstp_cork(sstp);
+    while (0 < (res = sstp_try_read(sstp, &msg))) {
+        sstp_write(sstp, PONG, NULL);
+    }
+    return 0 == sstp_uncork(sstp) && res == SSTP_AGAIN;
+}
+
+int ping_received(Connection conn, void *data, char *buf, int len) {
+    (void)conn; // purposefully unused
+    SSTPSocketWrapper *sstp = (SSTPSocketWrapper *) data;
+
+    SSTPMsg msg;
+    sstp_cork(sstp);
+    while (SSTP_AGAIN != sstp_feed(sstp, &buf, &len, &msg)) {
+        sstp_write(sstp, PONG, NULL);
+    }
+    return 0 == sstp_uncork(sstp);
+}
+
+int ping_writable(Connection conn, void *data) {
+    (void)conn; // purposefully unused
+    return 0 == sstp_flush((SSTPSocketWrapper *) data);
+}
+
+void ping_close(Connection conn, void *data) {
+    sstp_destroy((SSTPSocketWrapper *) data);
+    close(conn.sockfd);
+}
+
+/*
+ * The current (monotonic) time in seconds.
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
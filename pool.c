@@ -0,0 +1,222 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pool.h"
+
+// how many pools there can be
+#define MAX_POOLS 32
+
+// how many objects are moved between a thread's and the shared list at once
+#define BATCH_LEN (POOL_CACHE_LEN / 2)
+
+// how much is taken from the heap at once (at least one object)
+#define SLAB_LEN (64 * 1024)
+
+
+/***** Private structs
+ */
+
+/*
+ * A thread's free list for one of the pools, each free object points to the
+ * next.
+ */
+typedef struct {
+    void *head;
+    int len;
+} PoolCache;
+
+// every pool that has been used, by id
+Pool *pool_table[MAX_POOLS];
+_Atomic int pool_count = 0;
+
+// each thread's free lists, by pool id
+_Thread_local PoolCache pool_caches[MAX_POOLS];
+_Thread_local int pool_thread_seen = 0;
+
+// for handing a thread's free lists back as it exits
+pthread_key_t pool_thread_key;
+pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+
+/***** Helper function prototypes
+ */
+
+PoolCache *pool_cache(Pool *pool);
+int pool_register(Pool *pool);
+void pool_key_init(void);
+void pool_thread_exit(void *_);
+void pool_refill(Pool *pool, PoolCache *cache);
+void pool_spill(Pool *pool, PoolCache *cache, int n);
+void pool_grow(Pool *pool);
+
+
+/***** Public functions
+ */
+
+void *pool_alloc(Pool *pool) {
+    PoolCache *cache = pool_cache(pool);
+    if (cache->head == NULL) {
+        pool_refill(pool, cache);
+    }
+
+    void *object = cache->head;
+    cache->head = *(void **) object;
+    cache->len--;
+
+    return object;
+}
+
+void pool_free(Pool *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+
+    PoolCache *cache = pool_cache(pool);
+    *(void **) object = cache->head;
+    cache->head = object;
+
+    if (++cache->len > POOL_CACHE_LEN) {
+        pool_spill(pool, cache, BATCH_LEN);
+    }
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Returns the calling thread's free list for the given pool, setting the
+ * pool (and thread) up the first time.
+ */
+PoolCache *pool_cache(Pool *pool) {
+    int id = atomic_load_explicit(&pool->id, memory_order_acquire);
+    if (id < 0) {
+        id = pool_register(pool);
+    }
+
+    if (!pool_thread_seen) {
+        pthread_once(&pool_key_once, pool_key_init);
+        pthread_setspecific(pool_thread_key, pool_caches);
+        pool_thread_seen = 1;
+    }
+
+    return pool_caches + id;
+}
+
+/*
+ * Gives the given pool an id, if it doesn't have one yet.
+ * Returns the pool's id.
+ */
+int pool_register(Pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+
+    int id = atomic_load(&pool->id);
+    if (id < 0) {
+        id = atomic_fetch_add(&pool_count, 1);
+        assert(id < MAX_POOLS);
+        pool_table[id] = pool;
+        atomic_store_explicit(&pool->id, id, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return id;
+}
+
+void pool_key_init(void) {
+    pthread_key_create(&pool_thread_key, pool_thread_exit);
+}
+
+/*
+ * Called as a thread exits, to hand its free lists back to their pools.
+ */
+void pool_thread_exit(void *_) {
+    (void)_; // purposefully unused, the free lists are the thread's own
+
+    int count = atomic_load(&pool_count);
+    for (int id = 0; id < count; id++) {
+        if (pool_caches[id].len > 0) {
+            pool_spill(pool_table[id], pool_caches + id, pool_caches[id].len);
+        }
+    }
+
+    // anything freed after this sets the thread up again
+    pool_thread_seen = 0;
+}
+
+/*
+ * Moves a batch of objects from the pool's shared list to the given (empty)
+ * free list, taking more from the heap if there are none.
+ */
+void pool_refill(Pool *pool, PoolCache *cache) {
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->shared == NULL) {
+        pool_grow(pool);
+    }
+
+    void *first = pool->shared;
+    void *last = first;
+    int n = 1;
+    while (n < BATCH_LEN && *(void **) last != NULL) {
+        last = *(void **) last;
+        n++;
+    }
+    pool->shared = *(void **) last;
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    *(void **) last = cache->head;
+    cache->head = first;
+    cache->len += n;
+}
+
+/*
+ * Moves the first n objects on the given free list to the pool's shared list.
+ */
+void pool_spill(Pool *pool, PoolCache *cache, int n) {
+    void *first = cache->head;
+    void *last = first;
+    for (int i = 1; i < n; i++) {
+        last = *(void **) last;
+    }
+    cache->head = *(void **) last;
+    cache->len -= n;
+
+    pthread_mutex_lock(&pool->mutex);
+    *(void **) last = pool->shared;
+    pool->shared = first;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Carves a new slab from the heap up into objects on the pool's shared list.
+ * Note: must be called with the pool's mutex held.
+ */
+void pool_grow(Pool *pool) {
+    // each free object holds a pointer to the next
+    size_t align = pool->align > _Alignof(void *)
+        ? pool->align : _Alignof(void *);
+    size_t stride = pool->size > sizeof(void *) ? pool->size : sizeof(void *);
+    stride = (stride + align - 1) / align * align;
+
+    size_t count = SLAB_LEN / stride > 0 ? SLAB_LEN / stride : 1;
+    char *slab = (char *) aligned_alloc(align, count * stride);
+    assert(slab);
+
+    for (size_t i = count; i-- > 0;) {
+        void *object = slab + i * stride;
+        *(void **) object = pool->shared;
+        pool->shared = object;
+    }
+}
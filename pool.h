@@ -0,0 +1,60 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The pool module. Fixed-size object pools, so the objects made and thrown
+ * away for every connection and msg (jobs, list nodes, connection state and
+ * the like) are recycled instead of going through the heap each time.
+ *
+ * Each thread keeps a free list of its own for every pool, so allocating and
+ * freeing is just a couple of pointer swaps, with no locking. Only when a
+ * thread's list runs dry (or grows past POOL_CACHE_LEN) is a batch of objects
+ * moved over from (or to) the pool's shared list, under its lock, and only if
+ * that is empty too are more objects carved out of a new slab from the heap.
+ * An object can be freed on a different thread to the one that allocated it
+ * (eg. a job is allocated by an I/O thread and freed by the work consumer),
+ * and the objects on a thread's list go back to the shared list when it
+ * exits.
+ *
+ * Pools never give their slabs back, so a pool holds on to as many objects
+ * as were ever in use at once (and pools are never freed).
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// how many free objects each thread keeps for a pool at most, half of them
+// are moved to (or from) the shared list at a time
+#define POOL_CACHE_LEN 64
+
+/*
+ * Struct for a pool, set up with POOL_INITIALIZER, eg.
+ *   Pool node_pool = POOL_INITIALIZER(sizeof(Node), _Alignof(Node));
+ * Internals are private.
+ */
+typedef struct {
+    size_t size;
+    size_t align;
+    _Atomic int id; // which of each thread's free lists is this pool's
+    pthread_mutex_t mutex;
+    void *shared; // the shared free list, protected by the mutex
+} Pool;
+
+#define POOL_INITIALIZER(size, align) \
+    { (size), (align), -1, PTHREAD_MUTEX_INITIALIZER, NULL }
+
+/*
+ * Allocates an object (of the pool's size and alignment) from the given
+ * pool, its contents are whatever was last left there.
+ */
+void *pool_alloc(Pool *pool);
+
+/*
+ * Hands the given object (from the given pool) back to it, does nothing if
+ * object is NULL.
+ */
+void pool_free(Pool *pool, void *object);
@@ -0,0 +1,277 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Work queue contention benchmarks.
+ *
+ * Has a number of producer threads enqueue as fast as they can, while the
+ * consumer threads dequeue, on both the lock-free queue module and the mutex,
+ * semaphore and linked list queue it replaced (kept here to compare against).
+ * Prints one "benchmark,value,unit" line per result (the same as
+ * hashcash-bench), for 1, 8 and 64 producers:
+ *   queue/lockfree/PRODUCERS: the elements through the queue per second
+ *   queue/locked/PRODUCERS: the same for the old queue
+ *
+ * Usage: ./work-queue-bench [-c CONSUMERS] [-n COUNT] [-l CAPACITY]
+ *   CONSUMERS: how many threads dequeue, defaults to 1 (as in the server).
+ *   COUNT: how many elements go through the queue per result, defaults to
+ *          1000000.
+ *   CAPACITY: how many elements the lock-free queue holds, defaults to 4096.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <assert.h>
+#include <time.h>
+
+#include "queue.h"
+#include "linked_list.h"
+
+#define MAX_THREADS 256
+
+int producer_counts[] = { 1, 8, 64 };
+
+/*
+ * The queue that queue.c replaced, a linked list behind a mutex and a
+ * semaphore.
+ */
+typedef struct {
+    LinkedList *ll;
+    pthread_mutex_t mutex;
+    sem_t count;
+} LockedQueue;
+
+/*
+ * The queue being benchmarked, as either implementation.
+ */
+typedef struct {
+    int locked;
+    Queue *queue;
+    LockedQueue *locked_queue;
+} Bench;
+
+/*
+ * A single producer or consumer thread.
+ */
+typedef struct {
+    Bench *bench;
+    long count;
+} Worker;
+
+
+/***** Helper function prototypes
+ */
+
+double bench_queue(int locked, int producers, int consumers, long count,
+        int capacity);
+void *produce(void *pworker);
+void *consume(void *pworker);
+void bench_enqueue(Bench *bench, void *data);
+void *bench_dequeue(Bench *bench);
+LockedQueue *locked_queue_init(void);
+void locked_queue_enqueue(LockedQueue *queue, void *data);
+void *locked_queue_dequeue(LockedQueue *queue);
+void locked_queue_destroy(LockedQueue *queue);
+double now(void);
+
+
+/***** Main functions
+ */
+
+int main(int argc, char *argv[]) {
+    int consumers = 1;
+    long count = 1000000;
+    int capacity = 4096;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "c:n:l:"))) {
+        switch (opt) {
+            case 'c':
+                consumers = atoi(optarg);
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'l':
+                capacity = atoi(optarg);
+                break;
+            default:
+                exit(1);
+        }
+    }
+    if (consumers < 1 || consumers > MAX_THREADS || count < 1
+            || capacity < 1) {
+        fprintf(stderr, "ERROR: consumers must be 1-%d, and count and "
+                "capacity positive\n", MAX_THREADS);
+        exit(1);
+    }
+
+    printf("benchmark,value,unit\n");
+
+    char *names[] = { "lockfree", "locked" };
+    for (size_t i = 0; i < sizeof(producer_counts) / sizeof(int); i++) {
+        for (int locked = 0; locked < 2; locked++) {
+            double rate = bench_queue(locked, producer_counts[i], consumers,
+                    count, capacity);
+            printf("queue/%s/%d,%.6g,msgs/s\n", names[locked],
+                    producer_counts[i], rate);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Pushes the given number of elements through either queue, split between
+ * the given numbers of producers and consumers.
+ * Returns the elements dequeued per second.
+ */
+double bench_queue(int locked, int producers, int consumers, long count,
+        int capacity) {
+    Bench bench;
+    bench.locked = locked;
+    bench.queue = locked ? NULL : queue_init(capacity);
+    bench.locked_queue = locked ? locked_queue_init() : NULL;
+
+    pthread_t producer_tids[MAX_THREADS];
+    pthread_t consumer_tids[MAX_THREADS];
+    Worker producer_workers[MAX_THREADS];
+    Worker consumer_workers[MAX_THREADS];
+
+    double start = now();
+    for (int i = 0; i < consumers; i++) {
+        consumer_workers[i].bench = &bench;
+        consumer_workers[i].count = count / consumers
+            + (i < count % consumers);
+        pthread_create(consumer_tids + i, NULL, consume,
+                (void *) (consumer_workers + i));
+    }
+    for (int i = 0; i < producers; i++) {
+        producer_workers[i].bench = &bench;
+        producer_workers[i].count = count / producers
+            + (i < count % producers);
+        pthread_create(producer_tids + i, NULL, produce,
+                (void *) (producer_workers + i));
+    }
+
+    for (int i = 0; i < producers; i++) {
+        pthread_join(producer_tids[i], NULL);
+    }
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(consumer_tids[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    if (locked) {
+        locked_queue_destroy(bench.locked_queue);
+    } else {
+        queue_destroy(bench.queue);
+    }
+
+    return count / elapsed;
+}
+
+/*
+ * A producer thread, enqueuing its share of the elements.
+ */
+void *produce(void *pworker) {
+    Worker *worker = (Worker *) pworker;
+
+    for (long i = 0; i < worker->count; i++) {
+        bench_enqueue(worker->bench, (void *) worker);
+    }
+
+    return NULL;
+}
+
+/*
+ * A consumer thread, dequeuing its share of the elements.
+ */
+void *consume(void *pworker) {
+    Worker *worker = (Worker *) pworker;
+
+    for (long i = 0; i < worker->count; i++) {
+        if (NULL == bench_dequeue(worker->bench)) {
+            fprintf(stderr, "ERROR: dequeued nothing\n");
+            exit(1);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Enqueues onto (or dequeues from) whichever queue is being benchmarked.
+ */
+void bench_enqueue(Bench *bench, void *data) {
+    if (bench->locked) {
+        locked_queue_enqueue(bench->locked_queue, data);
+    } else {
+        queue_enqueue(bench->queue, data);
+    }
+}
+
+void *bench_dequeue(Bench *bench) {
+    if (bench->locked) {
+        return locked_queue_dequeue(bench->locked_queue);
+    }
+    return queue_dequeue(bench->queue);
+}
+
+/*
+ * The old queue, as it was.
+ */
+LockedQueue *locked_queue_init(void) {
+    LockedQueue *queue = (LockedQueue *) malloc(sizeof(LockedQueue));
+    assert(queue);
+
+    queue->ll = linked_list_init();
+    pthread_mutex_init(&queue->mutex, NULL);
+    sem_init(&queue->count, 0, 0);
+
+    return queue;
+}
+
+void locked_queue_enqueue(LockedQueue *queue, void *data) {
+    pthread_mutex_lock(&queue->mutex);
+    linked_list_push_start(queue->ll, data);
+    sem_post(&queue->count);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+void *locked_queue_dequeue(LockedQueue *queue) {
+    sem_wait(&queue->count);
+
+    pthread_mutex_lock(&queue->mutex);
+    void *data = linked_list_pop_end(queue->ll);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return data;
+}
+
+void locked_queue_destroy(LockedQueue *queue) {
+    linked_list_destroy(queue->ll);
+    pthread_mutex_destroy(&queue->mutex);
+    sem_destroy(&queue->count);
+    free(queue);
+}
+
+/*
+ * The current (monotonic) time in seconds.
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -6,88 +6,248 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <assert.h>
-#include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "queue.h"
 
+#define CACHE_LINE 64
+
 
 /***** Private structs
  */
 
+/*
+ * A single element of the ring.
+ * seq is the position it can next be enqueued into at (seq == pos), or
+ * dequeued from at (seq == pos + 1).
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic size_t seq;
+    void *data;
+} Slot;
+
+/*
+ * Somewhere for threads to block on, flagging that they are there so that
+ * nobody has to wake it otherwise.
+ * The flag is cleared by whoever wakes them, so a burst of enqueues (or
+ * dequeues) only wakes everyone once, and anyone still blocked sets it again.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic uint32_t word;
+    _Atomic uint32_t waiters;
+} Futex;
+
 struct Queue {
-    LinkedList *ll;
-    pthread_mutex_t mutex;
-    sem_t count;
+    Slot *slots;
+    size_t mask;
+
+    // each on a line of their own, so producers and consumers don't bounce
+    // each other's lines around
+    _Alignas(CACHE_LINE) _Atomic size_t tail; // where the next enqueue goes
+    _Alignas(CACHE_LINE) _Atomic size_t head; // where the next dequeue is
+
+    Futex not_empty;
+    Futex not_full;
 };
 
 
+/***** Helper function prototypes
+ */
+
+int queue_is_empty(Queue *queue);
+int queue_is_full(Queue *queue);
+void queue_block(Queue *queue, Futex *futex, int (*blocked)(Queue *));
+void queue_wake(Futex *futex);
+
+
 /***** Public functions
  */
 
-Queue *queue_init() {
-    Queue *queue = (Queue *) malloc(sizeof(Queue));
+Queue *queue_init(int capacity) {
+    Queue *queue = (Queue *) aligned_alloc(CACHE_LINE, sizeof(Queue));
     assert(queue);
 
-    queue->ll = linked_list_init();
-    pthread_mutex_init(&queue->mutex, NULL);
-    sem_init(&queue->count, 0, 0);
+    size_t size = 2;
+    while (size < (size_t) capacity) {
+        size *= 2;
+    }
+
+    queue->slots = (Slot *) aligned_alloc(CACHE_LINE, size * sizeof(Slot));
+    assert(queue->slots);
+    queue->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->slots[i].seq, i);
+        queue->slots[i].data = NULL;
+    }
+
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->not_empty.word, 0);
+    atomic_init(&queue->not_empty.waiters, 0);
+    atomic_init(&queue->not_full.word, 0);
+    atomic_init(&queue->not_full.waiters, 0);
 
     return queue;
 }
 
-Node *queue_enqueue(Queue *queue, void *data) {
-    Node *new_node = NULL;
-
-    pthread_mutex_lock(&queue->mutex);
+void queue_enqueue(Queue *queue, void *data) {
+    while (!queue_try_enqueue(queue, data)) {
+        queue_block(queue, &queue->not_full, queue_is_full);
+    }
+}
 
-    new_node = linked_list_push_start(queue->ll, data);
+int queue_try_enqueue(Queue *queue, void *data) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    while (1) {
+        Slot *slot = queue->slots + (pos & queue->mask);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            // the slot is free, so try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos,
+                        pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                slot->data = data;
+                atomic_store_explicit(&slot->seq, pos + 1,
+                        memory_order_release);
+                queue_wake(&queue->not_empty);
+                return 1;
+            }
+        } else if (diff < 0) {
+            // the slot still holds the element from a lap ago
+            return 0;
+        } else {
+            // somebody else got there first
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+}
 
-    sem_post(&queue->count);
+void *queue_dequeue(Queue *queue) {
+    void *data;
+    while (!queue_try_dequeue(queue, &data)) {
+        queue_block(queue, &queue->not_empty, queue_is_empty);
+    }
 
-    pthread_mutex_unlock(&queue->mutex);
+    return data;
+}
 
-    return new_node;
+int queue_try_dequeue(Queue *queue, void **data) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    while (1) {
+        Slot *slot = queue->slots + (pos & queue->mask);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            // the slot is full, so try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos,
+                        pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *data = slot->data;
+                // free for the enqueue a lap from now
+                atomic_store_explicit(&slot->seq, pos + queue->mask + 1,
+                        memory_order_release);
+
+                // let the producers fill it up a bit at a time, rather than
+                // waking them for every slot
+                // (using the latest head, so whichever dequeue finishes last
+                // sees the queue empty, even if an earlier one was held up)
+                size_t head = atomic_load(&queue->head);
+                size_t used = atomic_load(&queue->tail) - head;
+                if (used <= (queue->mask + 1) / 2) {
+                    queue_wake(&queue->not_full);
+                }
+                return 1;
+            }
+        } else if (diff < 0) {
+            // nothing (finished being) enqueued here yet
+            return 0;
+        } else {
+            // somebody else got there first
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
 }
 
-void *queue_dequeue(Queue *queue) {
-    void *data = NULL;
+void queue_wait(Queue *queue) {
+    while (queue_is_empty(queue)) {
+        queue_block(queue, &queue->not_empty, queue_is_empty);
+    }
+}
 
-    // block until there is something on the queue
-    sem_wait(&queue->count);
+void queue_destroy(Queue *queue) {
+    free(queue->slots);
+    free(queue);
+}
 
-    pthread_mutex_lock(&queue->mutex);
 
-    data = linked_list_pop_end(queue->ll);
+/***** Helper functions
+ */
 
-    pthread_mutex_unlock(&queue->mutex);
+/*
+ * Returns true if there is nothing (finished being) enqueued at the head.
+ */
+int queue_is_empty(Queue *queue) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_acquire);
+    Slot *slot = queue->slots + (pos & queue->mask);
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
 
-    return data;
+    return (intptr_t) seq - (intptr_t) (pos + 1) < 0;
 }
 
-void queue_destroy(Queue *queue) {
-    pthread_mutex_lock(&queue->mutex);
-    linked_list_destroy(queue->ll);
-    pthread_mutex_unlock(&queue->mutex);
-
-    pthread_mutex_destroy(&queue->mutex);
-    sem_destroy(&queue->count);
+/*
+ * Returns true if the slot at the tail hasn't been dequeued from yet.
+ */
+int queue_is_full(Queue *queue) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    Slot *slot = queue->slots + (pos & queue->mask);
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
 
-    free(queue);
+    return (intptr_t) seq - (intptr_t) pos < 0;
 }
 
-void queue_iter(Queue *queue, void (*func)(void*, void*), void *second_param) {
-    if (func == NULL) {
-        return;
+/*
+ * Sleeps on the given futex, as long as the queue is blocked.
+ * Note: may return early, so the caller has to check again.
+ */
+void queue_block(Queue *queue, Futex *futex, int (*blocked)(Queue *)) {
+    // announce ourselves before the final check, so whoever unblocks the
+    // queue after it sees us (see queue_wake)
+    atomic_store(&futex->waiters, 1);
+    uint32_t word = atomic_load(&futex->word);
+
+    // if the queue is unblocked after this, the word will have moved on and
+    // the futex won't sleep
+    if (blocked(queue)) {
+        syscall(SYS_futex, (uint32_t *) &futex->word, FUTEX_WAIT_PRIVATE,
+                word, NULL, NULL, 0);
     }
+}
 
-    pthread_mutex_lock(&queue->mutex);
-
-    for (Node *n = queue->ll->head; n != NULL; n = n->next) {
-        func(n->data, second_param);
+/*
+ * Wakes every thread blocked on the given futex, if there are any.
+ */
+void queue_wake(Futex *futex) {
+    // pairs with the waiters flag in queue_block: either we see the waiter,
+    // or its check sees what we just did
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 == atomic_load_explicit(&futex->waiters, memory_order_relaxed)
+            || 0 == atomic_exchange(&futex->waiters, 0)) {
+        return;
     }
 
-    pthread_mutex_unlock(&queue->mutex);
+    atomic_fetch_add(&futex->word, 1);
+    syscall(SYS_futex, (uint32_t *) &futex->word, FUTEX_WAKE_PRIVATE, INT_MAX,
+            NULL, NULL, 0);
 }
@@ -2,16 +2,20 @@
  * COMP30023 Computer Systems Project 2
  * Ibrahim Athir Saleem (isaleem) (682989)
  *
- * A very basic thread safe queue module.
+ * A bounded, lock-free, thread safe (multi producer, multi consumer) queue
+ * module.
  *
- * Based on the example job queue from http://advancedlinuxprogramming.com
+ * The queue is a ring of slots, each with a sequence number saying whose turn
+ * it is to use it (see http://www.1024cores.net, bounded MPMC queue), so
+ * enqueuing and dequeuing is a single compare and swap on the tail or head in
+ * the common case, with nothing allocated.
+ * Only blocking (on an empty or full queue) goes to the kernel, through a
+ * futex, and only if somebody is actually blocked is the futex woken.
  *
  */
 
 #pragma once
 
-#include "linked_list.h"
-
 /*
  * Struct for a queue.
  * Internals are private.
@@ -19,32 +23,48 @@
 typedef struct Queue Queue;
 
 /*
- * Create a new empty queue.
+ * Create a new empty queue, that holds up to the given number of elements
+ * (rounded up to a power of two).
+ */
+Queue *queue_init(int capacity);
+
+/*
+ * Adds the given data onto the queue.
+ * Note: If the queue is full this will block until it has drained to half
+ *       full, so blocked producers are woken a batch of slots at a time
+ *       rather than racing for every slot as it's freed.
  */
-Queue *queue_init();
+void queue_enqueue(Queue *queue, void *data);
 
 /*
- * Adds a new node onto the queue.
- * Returns the new node.
+ * Adds the given data onto the queue, without blocking.
+ * Returns 1 if it was added, and 0 if the queue is full.
  */
-Node *queue_enqueue(Queue *queue, void *data);
+int queue_try_enqueue(Queue *queue, void *data);
 
 /*
- * Removes a node from the queue.
- * Returns the data stored in that node.
+ * Removes an element from the queue.
+ * Returns the data stored in that element.
  * Note: If the queue is empty this will block until there is something on the
  *       queue.
  */
 void *queue_dequeue(Queue *queue);
 
 /*
- * Used to deallocate the given queue.
- * Warning: This will not free the contents of Node->data.
+ * Removes an element from the queue, without blocking.
+ * Returns 1 and sets data to the data stored in that element if there was one,
+ * and 0 if the queue is empty.
  */
-void queue_destroy(Queue *queue);
+int queue_try_dequeue(Queue *queue, void **data);
 
 /*
- * Runs the given function on every element of the queue.
- * Passes second_param as the second parameter to the function.
+ * Blocks until there is something on the queue, without removing it.
+ * Note: only makes sense with a single consumer.
  */
-void queue_iter(Queue *queue, void (*func)(void*, void*), void *second_param);
+void queue_wait(Queue *queue);
+
+/*
+ * Used to deallocate the given queue.
+ * Warning: This will not free the data still on the queue.
+ */
+void queue_destroy(Queue *queue);
@@ -0,0 +1,527 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * SSTP capture replayer.
+ *
+ * Plays a capture (see capture.h, and the server's -c option) back against a
+ * running server: every connection is opened and closed, and every msg from
+ * the clients sent, at the same time into the run as it was originally (or
+ * SPEED times as fast), so the traffic has the same shape and concurrency.
+ * The replies are matched up with the msgs they answer, the same way for the
+ * original run (from the replies in the capture) and the replay, and the two
+ * compared.
+ * Prints one "benchmark,value,unit" line per result (the same as
+ * hashcash-bench), for each type of msg the clients sent:
+ *   replay/TYPE/RUN/rate: the TYPE msgs answered per second
+ *   replay/TYPE/RUN/p50 and p99: the latency from a TYPE msg to its reply
+ * where RUN is original, replay, or change (the replay's difference from the
+ * original, as a percentage). Then the same for every msg, as replay/all,
+ * and the number of msgs the replay didn't get a reply to.
+ * Note: the capture is taken by the server, so the original latency is from
+ *       the server reading the msg to it writing the reply, the replay's
+ *       includes the trip there and back (and any waiting in the socket).
+ * Note: MALFORMED msgs aren't captured as they were, so they are replayed as
+ *       PONGs, which the server answers the same way (with an ERRO).
+ *
+ * Usage: ./sstp-replay [-a ADDRESS] [-s SPEED] CAPTURE PORT
+ *   CAPTURE: the capture file to play back.
+ *   PORT: the port the server is listening on.
+ *   ADDRESS: the server's (ipv4) address, defaults to 127.0.0.1.
+ *   SPEED: how many times faster than the original to play it back, defaults
+ *          to 1.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sstp.h"
+#include "sstp-socket-wrapper.h"
+#include "capture.h"
+#include "linked_list.h"
+#include "metrics.h"
+
+#define MAX_EVENTS 64
+
+// how long to wait for the last replies once everything has been sent
+#define DRAIN_MS 2000
+
+// how many kinds of msgs there are (the last one being MALFORMED)
+#define MSG_TYPES (MALFORMED + 1)
+
+// what a SOLN reply has in common with its WORK, the difficulty and seed
+#define PREFIX_LEN (8 + 1 + 64)
+
+char *type_names[] = {
+    "PING", "PONG", "OKAY", "ERRO", "SOLN", "WORK", "ABRT", "MALFORMED"
+};
+
+/*
+ * A msg waiting for its reply.
+ */
+typedef struct {
+    SSTPMsgType type;
+    uint64_t sent_at;
+    char prefix[PREFIX_LEN]; // for WORK
+} Pending;
+
+/*
+ * A connection from the capture, and its replay.
+ */
+typedef struct {
+    int sockfd; // -1 if it isn't open
+    SSTPSocketWrapper *sstp;
+    LinkedList *pending; // in the order they were sent
+} ReplayConn;
+
+/*
+ * What was seen in one of the runs.
+ */
+typedef struct {
+    char *name;
+    Metric *latency[MSG_TYPES];
+    long replies[MSG_TYPES]; // by the type of msg they answered
+    long unanswered;
+    uint64_t duration;
+} Run;
+
+struct sockaddr_in server_addr;
+
+// the whole capture, and its connections (by id)
+CaptureRecord *records = NULL;
+size_t records_len = 0;
+ReplayConn *conns = NULL;
+size_t conns_len = 0;
+size_t conns_opened = 0;
+
+
+/***** Helper function prototypes
+ */
+
+void load_capture(char *path);
+void run_init(Run *run, char *name);
+void run_original(Run *run);
+void run_replay(Run *run, double speed);
+void replay_record(int epfd, CaptureRecord *record, uint64_t now);
+void replay_receive(Run *run, ReplayConn *conn, uint64_t now);
+void replay_close(ReplayConn *conn);
+void sent(ReplayConn *conn, SSTPMsgType type, char *payload, uint64_t now);
+void replied(Run *run, ReplayConn *conn, SSTPMsgType type, char *payload,
+        uint64_t now);
+void count_unanswered(Run *run);
+void print_change(char *name, char *unit, double original, double replay);
+
+
+/***** Main functions
+ */
+
+int main(int argc, char *argv[]) {
+    char *address = "127.0.0.1";
+    double speed = 1;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "a:s:"))) {
+        switch (opt) {
+            case 'a':
+                address = optarg;
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            default:
+                exit(1);
+        }
+    }
+
+    if (optind + 2 > argc) {
+        fprintf(stderr, "ERROR: no capture or port provided\n");
+        exit(1);
+    }
+    if (speed <= 0) {
+        fprintf(stderr, "ERROR: speed must be positive\n");
+        exit(1);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind + 1]));
+    if (1 != inet_pton(AF_INET, address, &server_addr.sin_addr)) {
+        fprintf(stderr, "ERROR: bad address\n");
+        exit(1);
+    }
+
+    // there could be a lot of connections
+    struct rlimit limit;
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit)
+            && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    load_capture(argv[optind]);
+
+    Run original, replay;
+    run_init(&original, "original");
+    run_init(&replay, "replay");
+    run_original(&original);
+    run_replay(&replay, speed);
+
+    printf("benchmark,value,unit\n");
+    printf("replay/connections,%zu,conns\n", conns_opened);
+
+    char name[64];
+    long original_replies = 0;
+    long replay_replies = 0;
+    for (int t = 0; t < MSG_TYPES; t++) {
+        if (original.replies[t] == 0 && replay.replies[t] == 0) {
+            continue;
+        }
+        original_replies += original.replies[t];
+        replay_replies += replay.replies[t];
+
+        snprintf(name, sizeof(name), "replay/%s/%%s/rate", type_names[t]);
+        print_change(name, "msgs/s", original.replies[t]
+                / (original.duration / 1e9), replay.replies[t]
+                / (replay.duration / 1e9));
+        snprintf(name, sizeof(name), "replay/%s/%%s/p50", type_names[t]);
+        print_change(name, "us",
+                metrics_quantile(original.latency[t], 0.5) * 1e6,
+                metrics_quantile(replay.latency[t], 0.5) * 1e6);
+        snprintf(name, sizeof(name), "replay/%s/%%s/p99", type_names[t]);
+        print_change(name, "us",
+                metrics_quantile(original.latency[t], 0.99) * 1e6,
+                metrics_quantile(replay.latency[t], 0.99) * 1e6);
+    }
+    print_change("replay/all/%s/rate", "msgs/s",
+            original_replies / (original.duration / 1e9),
+            replay_replies / (replay.duration / 1e9));
+    printf("replay/unanswered,%ld,msgs\n", replay.unanswered);
+
+    return 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Reads the whole capture in, and sets up its connections.
+ */
+void load_capture(char *path) {
+    FILE *file = capture_open(path);
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: not a capture\n");
+        exit(1);
+    }
+
+    size_t capacity = 1024;
+    records = malloc(capacity * sizeof(CaptureRecord));
+    assert(records);
+
+    int res;
+    while (1 == (res = capture_read(file, records + records_len))) {
+        // connection ids count up from 1, so they index the connections
+        uint64_t id = records[records_len].conn;
+        if (id >= conns_len) {
+            size_t len = id + 1 > 2 * conns_len ? id + 1 : 2 * conns_len;
+            conns = realloc(conns, len * sizeof(ReplayConn));
+            assert(conns);
+            for (size_t i = conns_len; i < len; i++) {
+                conns[i].sockfd = -1;
+                conns[i].sstp = NULL;
+                conns[i].pending = linked_list_init();
+            }
+            conns_len = len;
+        }
+        if (records[records_len].event == CAPTURE_OPEN) {
+            conns_opened++;
+        }
+
+        if (++records_len == capacity) {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(CaptureRecord));
+            assert(records);
+        }
+    }
+    if (res < 0) {
+        fprintf(stderr, "ERROR: capture is cut off, replaying what's there\n");
+    }
+    fclose(file);
+}
+
+/*
+ * Sets up the given run's results.
+ */
+void run_init(Run *run, char *name) {
+    memset(run, 0, sizeof(Run));
+    run->name = name;
+
+    char *labels = malloc(32);
+    assert(labels);
+    snprintf(labels, 32, "run=\"%s\"", name);
+    for (int t = 0; t < MSG_TYPES; t++) {
+        run->latency[t] = metrics_register(METRIC_HISTOGRAM,
+                "replay_latency_seconds", labels,
+                "Time from a msg to its reply.");
+    }
+}
+
+/*
+ * Matches up the replies in the capture, for the original run.
+ */
+void run_original(Run *run) {
+    for (size_t i = 0; i < records_len; i++) {
+        CaptureRecord *record = records + i;
+        ReplayConn *conn = conns + record->conn;
+
+        if (record->event == CAPTURE_IN) {
+            sent(conn, record->type, record->payload, record->ns);
+        } else if (record->event == CAPTURE_OUT) {
+            replied(run, conn, record->type, record->payload, record->ns);
+        }
+    }
+    run->duration = records_len > 0 ? records[records_len - 1].ns : 1;
+
+    count_unanswered(run);
+}
+
+/*
+ * Plays the capture back against the server, at the given speed.
+ */
+void run_replay(Run *run, double speed) {
+    int epfd = epoll_create1(0);
+    assert(epfd >= 0);
+    struct epoll_event events[MAX_EVENTS];
+
+    uint64_t start = metrics_now();
+    uint64_t drain_end = 0;
+    size_t next = 0;
+
+    while (1) {
+        uint64_t now = metrics_now();
+
+        // send off everything that's due
+        while (next < records_len
+                && now >= start + (uint64_t) (records[next].ns / speed)) {
+            replay_record(epfd, records + next++, now);
+            run->duration = now - start;
+        }
+
+        // then wait for the replies, and for the next one to be due
+        uint64_t wake_at;
+        if (next < records_len) {
+            wake_at = start + (uint64_t) (records[next].ns / speed);
+        } else {
+            if (drain_end == 0) {
+                drain_end = now + DRAIN_MS * (uint64_t) 1000000;
+            }
+            int waiting = 0;
+            for (size_t i = 0; i < conns_len && !waiting; i++) {
+                waiting = !linked_list_is_empty(conns[i].pending);
+            }
+            if (!waiting || now >= drain_end) {
+                break;
+            }
+            wake_at = drain_end;
+        }
+
+        int timeout = wake_at > now ? (wake_at - now + 999999) / 1000000 : 0;
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        now = metrics_now();
+        for (int i = 0; i < n; i++) {
+            ReplayConn *conn = (ReplayConn *) events[i].data.ptr;
+            if (conn->sockfd < 0) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                sstp_flush(conn->sstp);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                replay_receive(run, conn, now);
+                run->duration = now - start;
+            }
+        }
+    }
+
+    run->duration = run->duration > 0 ? run->duration : 1;
+    count_unanswered(run);
+
+    for (size_t i = 0; i < conns_len; i++) {
+        replay_close(conns + i);
+    }
+    close(epfd);
+}
+
+/*
+ * Replays a single record, as of now.
+ */
+void replay_record(int epfd, CaptureRecord *record, uint64_t now) {
+    ReplayConn *conn = conns + record->conn;
+
+    switch (record->event) {
+        case CAPTURE_OPEN: {
+            int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+            if (sockfd < 0 || 0 != connect(sockfd,
+                        (struct sockaddr *) &server_addr,
+                        sizeof(server_addr))) {
+                perror("ERROR: connecting");
+                if (sockfd >= 0) {
+                    close(sockfd);
+                }
+                return;
+            }
+            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+            conn->sockfd = sockfd;
+            conn->sstp = sstp_init(sockfd);
+
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = conn;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &event);
+            break;
+        }
+        case CAPTURE_IN:
+            if (conn->sockfd < 0) {
+                return;
+            }
+            sent(conn, record->type, record->payload, now);
+            if (record->type == MALFORMED) {
+                sstp_write(conn->sstp, PONG, NULL);
+            } else {
+                sstp_write(conn->sstp, record->type, record->payload);
+            }
+            break;
+        case CAPTURE_CLOSE:
+            // the replies already on their way can still be read
+            if (conn->sockfd >= 0) {
+                shutdown(conn->sockfd, SHUT_WR);
+            }
+            break;
+        case CAPTURE_OUT:
+            // only the server sends these
+            break;
+    }
+}
+
+/*
+ * Matches up every reply the connection has received so far.
+ */
+void replay_receive(Run *run, ReplayConn *conn, uint64_t now) {
+    SSTPMsg msg;
+
+    int res;
+    while (SSTP_AGAIN != (res = sstp_try_read(conn->sstp, &msg))) {
+        if (res <= 0) {
+            replay_close(conn);
+            return;
+        }
+        replied(run, conn, msg.type, msg.payload, now);
+    }
+}
+
+/*
+ * Closes the given connection's replay, if it's open.
+ */
+void replay_close(ReplayConn *conn) {
+    if (conn->sockfd < 0) {
+        return;
+    }
+
+    sstp_destroy(conn->sstp);
+    close(conn->sockfd);
+    conn->sockfd = -1;
+    conn->sstp = NULL;
+}
+
+/*
+ * Keeps track of a msg sent to the server, until it's replied to.
+ */
+void sent(ReplayConn *conn, SSTPMsgType type, char *payload, uint64_t now) {
+    Pending *pending = malloc(sizeof(Pending));
+    assert(pending);
+
+    pending->type = type;
+    pending->sent_at = now;
+    if (type == WORK) {
+        memcpy(pending->prefix, payload, PREFIX_LEN);
+    }
+
+    linked_list_push_end(conn->pending, pending);
+}
+
+/*
+ * Matches a reply up with the msg it answers.
+ */
+void replied(Run *run, ReplayConn *conn, SSTPMsgType type, char *payload,
+        uint64_t now) {
+    Node *n = conn->pending->head;
+
+    // a SOLN answers the WORK with the same seed, everything else is
+    // answered in the order it was sent
+    while (n != NULL) {
+        Pending *pending = (Pending *) n->data;
+        if (type == SOLN
+                ? pending->type == WORK
+                    && 0 == strncmp(pending->prefix, payload, PREFIX_LEN)
+                : pending->type != WORK) {
+            break;
+        }
+        n = n->next;
+    }
+    if (n == NULL) {
+        return;
+    }
+
+    Pending *pending = (Pending *) linked_list_pop(conn->pending, n);
+    metrics_observe(run->latency[pending->type], now - pending->sent_at);
+    run->replies[pending->type]++;
+
+    // and once an ABRT is answered, none of the WORK sent before it will be
+    if (pending->type == ABRT) {
+        while (!linked_list_is_empty(conn->pending)
+                && ((Pending *) conn->pending->head->data)->sent_at
+                    <= pending->sent_at) {
+            free(linked_list_pop_start(conn->pending));
+        }
+    }
+    free(pending);
+}
+
+/*
+ * Counts (and forgets) the msgs still waiting for replies at the end of a
+ * run.
+ */
+void count_unanswered(Run *run) {
+    for (size_t i = 0; i < conns_len; i++) {
+        while (!linked_list_is_empty(conns[i].pending)) {
+            free(linked_list_pop_start(conns[i].pending));
+            run->unanswered++;
+        }
+    }
+}
+
+/*
+ * Prints a result for both runs, and the difference between them.
+ * name has a %s for the run.
+ */
+void print_change(char *name, char *unit, double original, double replay) {
+    printf(name, "original");
+    printf(",%.6g,%s\n", original, unit);
+    printf(name, "replay");
+    printf(",%.6g,%s\n", replay, unit);
+    printf(name, "change");
+    printf(",%+.3g,%%\n",
+            original > 0 ? (replay - original) / original * 100 : 0);
+}
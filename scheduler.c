@@ -0,0 +1,329 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "linked_list.h"
+#include "pool.h"
+#include "scheduler.h"
+
+
+/***** Private structs
+ */
+
+/*
+ * A queued job.
+ */
+typedef struct {
+    void *data;
+    int threads;
+    double cost;
+    uint64_t seq; // the order jobs were queued in
+    int bypassed; // times a job was picked ahead of this one
+
+    // virtual start and finish times (FAIR_SHARE)
+    double start;
+    double finish;
+} Entry;
+
+/*
+ * A client's sub-queue.
+ */
+typedef struct {
+    uint64_t id;
+    LinkedList *jobs;
+
+    uint64_t turn; // when the client was last served (ROUND_ROBIN)
+    double finish; // virtual finish time of its last job (FAIR_SHARE)
+} Client;
+
+struct Scheduler {
+    SchedulerPolicy policy;
+    int max_bypass;
+
+    LinkedList *clients; // only clients with queued jobs
+
+    uint64_t seq; // jobs queued so far
+    uint64_t turns; // jobs handed out so far
+    double vtime; // virtual time (FAIR_SHARE)
+};
+
+// every scheduler's queued jobs and clients
+Pool sched_entry_pool = POOL_INITIALIZER(sizeof(Entry), _Alignof(Entry));
+Pool sched_client_pool = POOL_INITIALIZER(sizeof(Client), _Alignof(Client));
+
+
+/***** Helper function prototypes
+ */
+
+Node *find_client(Scheduler *sched, uint64_t id);
+int find_best(Scheduler *sched, int threads, Node **client_node,
+        Node **entry_node);
+int is_better(Scheduler *sched, Client *a, Entry *ea, Client *b, Entry *eb);
+void *take(Scheduler *sched, Node *client_node, Node *entry_node);
+void remove_client(Scheduler *sched, Node *client_node);
+
+
+/***** Public functions
+ */
+
+Scheduler *scheduler_init(SchedulerPolicy policy, int max_bypass) {
+    Scheduler *sched = (Scheduler *) malloc(sizeof(Scheduler));
+    assert(sched);
+
+    sched->policy = policy;
+    sched->max_bypass = max_bypass;
+    sched->clients = linked_list_init();
+    sched->seq = 0;
+    sched->turns = 0;
+    sched->vtime = 0;
+
+    return sched;
+}
+
+int scheduler_parse_policy(char *name) {
+    if (0 == strcmp(name, "rr")) {
+        return ROUND_ROBIN;
+    } else if (0 == strcmp(name, "wfq")) {
+        return FAIR_SHARE;
+    } else if (0 == strcmp(name, "sewf")) {
+        return SHORTEST_FIRST;
+    } else if (0 == strcmp(name, "oldest")) {
+        return OLDEST_FIRST;
+    } else {
+        return -1;
+    }
+}
+
+int scheduler_push(Scheduler *sched, uint64_t client, void *data,
+        int threads, double cost) {
+    Node *client_node = find_client(sched, client);
+    if (client_node == NULL) {
+        Client *c = (Client *) pool_alloc(&sched_client_pool);
+
+        c->id = client;
+        c->jobs = linked_list_init();
+        // new clients join the back of the round
+        c->turn = sched->turns;
+        c->finish = 0;
+
+        client_node = linked_list_push_end(sched->clients, c);
+    }
+    Client *c = (Client *) client_node->data;
+
+    Entry *entry = (Entry *) pool_alloc(&sched_entry_pool);
+
+    entry->data = data;
+    entry->threads = threads;
+    entry->cost = cost;
+    entry->seq = sched->seq++;
+    entry->bypassed = 0;
+
+    // a client that has been idle doesn't get to catch up on its share
+    entry->start = c->finish > sched->vtime ? c->finish : sched->vtime;
+    entry->finish = entry->start + cost;
+    c->finish = entry->finish;
+
+    linked_list_push_end(c->jobs, entry);
+
+    return c->jobs->len;
+}
+
+void *scheduler_pop(Scheduler *sched, int threads) {
+    Node *client_node, *entry_node;
+
+    // what the policy wants next, whether or not it fits
+    if (!find_best(sched, INT_MAX, &client_node, &entry_node)) {
+        return NULL;
+    }
+
+    Entry *best = (Entry *) entry_node->data;
+    if (best->threads <= threads) {
+        return take(sched, client_node, entry_node);
+    }
+
+    // otherwise backfill with the best job that does fit, for a while
+    if (best->bypassed >= sched->max_bypass
+            || !find_best(sched, threads, &client_node, &entry_node)) {
+        return NULL;
+    }
+
+    best->bypassed++;
+    return take(sched, client_node, entry_node);
+}
+
+void scheduler_drop(Scheduler *sched, uint64_t client,
+        void (*func)(void*, void*), void *second_param) {
+    Node *client_node = find_client(sched, client);
+    if (client_node == NULL) {
+        return;
+    }
+
+    // take the client out first, so func can queue the jobs up again
+    Client *c = (Client *) client_node->data;
+    linked_list_pop(sched->clients, client_node);
+
+    while (!linked_list_is_empty(c->jobs)) {
+        Entry *entry = (Entry *) linked_list_pop_start(c->jobs);
+        void *data = entry->data;
+        pool_free(&sched_entry_pool, entry);
+
+        if (func != NULL) {
+            func(data, second_param);
+        }
+    }
+
+    linked_list_destroy(c->jobs);
+    pool_free(&sched_client_pool, c);
+}
+
+int scheduler_depth(Scheduler *sched, uint64_t client) {
+    Node *client_node = find_client(sched, client);
+    if (client_node == NULL) {
+        return 0;
+    }
+
+    return ((Client *) client_node->data)->jobs->len;
+}
+
+void scheduler_iter(Scheduler *sched, void (*func)(uint64_t, int, void*),
+        void *second_param) {
+    for (Node *n = sched->clients->head; n != NULL; n = n->next) {
+        Client *c = (Client *) n->data;
+        func(c->id, c->jobs->len, second_param);
+    }
+}
+
+void scheduler_destroy(Scheduler *sched) {
+    while (!linked_list_is_empty(sched->clients)) {
+        Client *c = (Client *) sched->clients->head->data;
+        scheduler_drop(sched, c->id, NULL, NULL);
+    }
+
+    linked_list_destroy(sched->clients);
+    free(sched);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Returns the node of the client with the given id, or NULL if it has no
+ * queued jobs.
+ */
+Node *find_client(Scheduler *sched, uint64_t id) {
+    for (Node *n = sched->clients->head; n != NULL; n = n->next) {
+        if (((Client *) n->data)->id == id) {
+            return n;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Finds the job the policy would run next, out of the ones that need at most
+ * the given number of threads.
+ * Returns 1 and sets the client and entry nodes if there is one, 0 if not.
+ */
+int find_best(Scheduler *sched, int threads, Node **client_node,
+        Node **entry_node) {
+    Client *best_client = NULL;
+    Entry *best = NULL;
+
+    // round robin and fair share keep each client's jobs in order, so only
+    // the head of each sub-queue is a candidate
+    int heads_only = sched->policy == ROUND_ROBIN
+        || sched->policy == FAIR_SHARE;
+
+    for (Node *cn = sched->clients->head; cn != NULL; cn = cn->next) {
+        Client *c = (Client *) cn->data;
+
+        for (Node *en = c->jobs->head; en != NULL; en = en->next) {
+            Entry *e = (Entry *) en->data;
+
+            if (e->threads <= threads
+                    && (best == NULL || is_better(sched, c, e, best_client, best))) {
+                best_client = c;
+                best = e;
+                *client_node = cn;
+                *entry_node = en;
+            }
+
+            if (heads_only) {
+                break;
+            }
+        }
+    }
+
+    return best != NULL;
+}
+
+/*
+ * Whether the policy would run job a (of client a) before job b (of client b).
+ */
+int is_better(Scheduler *sched, Client *a, Entry *ea, Client *b, Entry *eb) {
+    switch (sched->policy) {
+        case ROUND_ROBIN:
+            if (a->turn != b->turn) {
+                return a->turn < b->turn;
+            }
+            break;
+        case FAIR_SHARE:
+            if (ea->finish != eb->finish) {
+                return ea->finish < eb->finish;
+            }
+            break;
+        case SHORTEST_FIRST:
+            if (ea->cost != eb->cost) {
+                return ea->cost < eb->cost;
+            }
+            break;
+        case OLDEST_FIRST:
+            break;
+    }
+
+    // ties go to the oldest job
+    return ea->seq < eb->seq;
+}
+
+/*
+ * Removes the given job from the scheduler and returns its data.
+ */
+void *take(Scheduler *sched, Node *client_node, Node *entry_node) {
+    Client *c = (Client *) client_node->data;
+    Entry *entry = (Entry *) linked_list_pop(c->jobs, entry_node);
+    void *data = entry->data;
+
+    c->turn = ++sched->turns;
+    if (entry->start > sched->vtime) {
+        sched->vtime = entry->start;
+    }
+
+    pool_free(&sched_entry_pool, entry);
+
+    if (linked_list_is_empty(c->jobs)) {
+        remove_client(sched, client_node);
+    }
+
+    return data;
+}
+
+/*
+ * Removes the given (empty) client.
+ */
+void remove_client(Scheduler *sched, Node *client_node) {
+    Client *c = (Client *) linked_list_pop(sched->clients, client_node);
+    linked_list_destroy(c->jobs);
+    pool_free(&sched_client_pool, c);
+}
@@ -0,0 +1,96 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Decides which queued job to run next.
+ *
+ * Each client gets its own sub-queue, so one client pipelining lots of jobs
+ * can't starve everyone else. Which client (and job) goes next depends on the
+ * policy:
+ *   ROUND_ROBIN: each client with queued jobs takes a turn.
+ *   FAIR_SHARE: weighted fair queuing, each client gets an equal share of the
+ *               hashing (jobs are weighted by their expected hash count).
+ *   SHORTEST_FIRST: the job with the smallest expected hash count, from any
+ *                   client.
+ *   OLDEST_FIRST: the job that has been queued the longest, from any client
+ *                 (ie. a plain FIFO).
+ *
+ * Jobs also need a number of solver threads, so the scheduler only hands out
+ * jobs that fit. The job the policy would pick can be passed over for ones
+ * that do fit only a limited number of times, so it can't starve.
+ *
+ * Not thread safe, the caller has to provide the locking.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    ROUND_ROBIN,
+    FAIR_SHARE,
+    SHORTEST_FIRST,
+    OLDEST_FIRST,
+} SchedulerPolicy;
+
+/*
+ * Struct for a scheduler.
+ * Internals are private.
+ */
+typedef struct Scheduler Scheduler;
+
+/*
+ * Create a new empty scheduler, using the given policy.
+ * max_bypass is how many times the job the policy picks can be passed over
+ * because it doesn't fit.
+ */
+Scheduler *scheduler_init(SchedulerPolicy policy, int max_bypass);
+
+/*
+ * Returns the policy with the given name (rr, wfq, sewf or oldest), or -1 if
+ * there isn't one.
+ */
+int scheduler_parse_policy(char *name);
+
+/*
+ * Queues a job for the given client.
+ * threads is how many solver threads it needs, and cost its expected hash
+ * count.
+ * Returns the client's queue depth, including the new job.
+ */
+int scheduler_push(Scheduler *sched, uint64_t client, void *data,
+        int threads, double cost);
+
+/*
+ * Removes and returns the next job to run that needs at most the given number
+ * of threads, or NULL if there isn't one (or the next one is being held
+ * back for).
+ */
+void *scheduler_pop(Scheduler *sched, int threads);
+
+/*
+ * Removes all of the given client's jobs, running func on each one (if not
+ * NULL) afterwards.
+ * Passes second_param as the second parameter to the function.
+ */
+void scheduler_drop(Scheduler *sched, uint64_t client,
+        void (*func)(void*, void*), void *second_param);
+
+/*
+ * The number of jobs queued for the given client.
+ */
+int scheduler_depth(Scheduler *sched, uint64_t client);
+
+/*
+ * Runs func on every client with queued jobs, with that client's id and queue
+ * depth, and second_param.
+ */
+void scheduler_iter(Scheduler *sched, void (*func)(uint64_t, int, void*),
+        void *second_param);
+
+/*
+ * Used to deallocate the given scheduler.
+ * Warning: This will not free the queued jobs.
+ */
+void scheduler_destroy(Scheduler *sched);
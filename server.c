@@ -6,26 +6,297 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_IO_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "trace.h"
+#include "pool.h"
 
 #include "server.h"
 
 #define CONNECTION_BACKLOG 10
+#define MAX_EVENTS 64
+
+// io_uring sizes, the buffer count needs to be a power of 2
+#define RING_ENTRIES 256
+#define BUFFER_COUNT 256
+#define BUFFER_LEN 4096
+#define BUFFER_GROUP 0
+
+// the low bits of each request's user_data say what it is for, the rest is a
+// RingConn pointer (which its pool aligns to 16) or a socket
+#define TAG_MASK 0xf
+#define RECV_TAG 0 // a connection's recv
+#define POLL_TAG 1 // a connection's writable poll
+#define ACCEPT_TAG 2 // the accept
+#define HANDOFF_TAG 3 // a socket handed over by the accepting ring
+#define SENT_TAG 4 // a socket handed over to another ring (if it fails)
+#define IGNORE_TAG 5 // requests whose completion doesn't matter
+
+
+/***** Private structs
+ */
+
+/*
+ * A connection being handled by the reactor.
+ */
+typedef struct {
+    Connection conn;
+    ConnectionEvents *events;
+    void *data;
+} ReactorConn;
+
+#ifdef HAVE_IO_URING
+/*
+ * An io_uring instance (one per I/O thread), with its mapped queues and the
+ * provided buffers recvs land in.
+ */
+typedef struct Ring Ring;
+struct Ring {
+    int fd;
+    int listener;
+    ConnectionEvents *events;
+
+    // every ring, which the first one hands the accepted sockets out to
+    Ring *rings;
+    int ring_count;
+    int next_ring;
+
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail; // includes the sqes not yet handed to the kernel
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // provided buffers
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    unsigned short buf_tail;
+};
+
+/*
+ * A connection being handled by an io_uring instance.
+ */
+typedef struct {
+    Connection conn;
+    void *data;
+    int closing; // waiting on the last completions before closing
+    int armed; // how many multishot requests (recv and poll) are still going
+} RingConn;
+#endif
+
+// every connection's state
+Pool reactor_conn_pool = POOL_INITIALIZER(sizeof(ReactorConn),
+        _Alignof(ReactorConn));
+#ifdef HAVE_IO_URING
+Pool ring_conn_pool = POOL_INITIALIZER(sizeof(RingConn), TAG_MASK + 1);
+#endif
+
+
+// networking syscalls made so far
+_Atomic uint64_t syscall_count = 0;
+
+// connections accepted so far, which gives each one its id
+_Atomic uint64_t connection_count = 0;
+
+
+/***** Helper function prototypes
+ */
+
+int listen_on(int port, int backlog);
+int accept_conn(int listener_socket, Connection *conn);
+void *reactor_thread(void *pepfd);
+void raise_fd_limit(void);
+#ifdef HAVE_IO_URING
+int ring_init(Ring *ring, int listener, ConnectionEvents *events);
+void *ring_thread(void *pring);
+void ring_handle(Ring *ring, struct io_uring_cqe *cqe);
+void ring_open(Ring *ring, int sockfd);
+void ring_hand_off(Ring *ring, int sockfd);
+void ring_arm_accept(Ring *ring);
+void ring_arm_recv(Ring *ring, RingConn *rc);
+void ring_arm_poll(Ring *ring, RingConn *rc);
+void ring_close(Ring *ring, RingConn *rc);
+void ring_add_buffer(Ring *ring, int bid);
+struct io_uring_sqe *ring_sqe(Ring *ring);
+int ring_enter(Ring *ring, unsigned wait);
+#endif
 
 
 /***** Public functions
  */
 
 int server(int port, ConnectionHandler handler) {
+    int listener_socket = listen_on(port, CONNECTION_BACKLOG);
+    if (listener_socket < 0) {
+        return 1;
+    }
+
+    // the infinite accept loop
+    // all incoming connections are handed off to the given handler
+    Connection conn;
+    while (1) {
+        if (0 != accept_conn(listener_socket, &conn)) {
+            continue;
+        }
+
+        // hand the socket to the handler
+        handler(conn);
+    }
+
+}
+
+int server_reactor(int port, int io_threads, ConnectionEvents *events) {
+    // every connection is a file descriptor, so allow as many as we can
+    raise_fd_limit();
+
+    int listener_socket = listen_on(port, SOMAXCONN);
+    if (listener_socket < 0) {
+        return 1;
+    }
+
+    // each I/O thread waits on its own epoll instance
+    if (io_threads < 1) {
+        io_threads = 1;
+    }
+    int *epfds = malloc(io_threads * sizeof(int));
+    assert(epfds);
+    for (int i = 0; i < io_threads; i++) {
+        epfds[i] = epoll_create1(0);
+        if (epfds[i] < 0) {
+            perror("ERROR: on epoll_create1");
+            return 1;
+        }
+
+        pthread_t tid;
+        pthread_create(&tid, NULL, reactor_thread, (void *) (epfds + i));
+    }
+
+    // the infinite accept loop
+    // incoming connections are spread over the I/O threads
+    Connection conn;
+    for (int next = 0; 1; next = (next + 1) % io_threads) {
+        if (0 != accept_conn(listener_socket, &conn)) {
+            continue;
+        }
+
+        int flags = fcntl(conn.sockfd, F_GETFL, 0);
+        fcntl(conn.sockfd, F_SETFL, flags | O_NONBLOCK);
+        server_count_syscalls(2);
+
+        ReactorConn *rc = (ReactorConn *) pool_alloc(&reactor_conn_pool);
+        rc->conn = conn;
+        rc->events = events;
+        rc->data = events->open(conn);
+
+        // anything that arrived before this still triggers an event
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = rc;
+        server_count_syscalls(1);
+        if (-1 == epoll_ctl(epfds[next], EPOLL_CTL_ADD, conn.sockfd, &event)) {
+            perror("ERROR: on epoll_ctl");
+            events->close(conn, rc->data);
+            pool_free(&reactor_conn_pool, rc);
+        }
+    }
+}
+
+
+#ifdef HAVE_IO_URING
+int server_uring(int port, int io_threads, ConnectionEvents *events) {
+    // every connection is a file descriptor, so allow as many as we can
+    raise_fd_limit();
+
+    int listener_socket = listen_on(port, SOMAXCONN);
+    if (listener_socket < 0) {
+        return 1;
+    }
+
+    if (io_threads < 1) {
+        io_threads = 1;
+    }
+    Ring *rings = calloc(io_threads, sizeof(Ring));
+    assert(rings);
+    for (int i = 0; i < io_threads; i++) {
+        if (0 != ring_init(rings + i, listener_socket, events)) {
+            // the kernel doesn't support it (or enough of it)
+            close(listener_socket);
+            return SERVER_UNSUPPORTED;
+        }
+        rings[i].rings = rings;
+        rings[i].ring_count = io_threads;
+        rings[i].next_ring = 0;
+    }
+
+    // the first ring accepts for all of them, the last one is on this thread
+    for (int i = 0; i < io_threads - 1; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, ring_thread, (void *) (rings + i));
+    }
+    ring_thread(rings + io_threads - 1);
+
+    return 0;
+}
+#else
+int server_uring(int port, int io_threads, ConnectionEvents *events) {
+    (void)port; (void)io_threads; (void)events;
+    return SERVER_UNSUPPORTED;
+}
+#endif
+
+void server_count_syscalls(int n) {
+    atomic_fetch_add_explicit(&syscall_count, n, memory_order_relaxed);
+}
+
+uint64_t server_syscalls(void) {
+    return atomic_load(&syscall_count);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Creates a tcp socket listening on the given port.
+ * Returns the socket, or -1 if an error occurs.
+ */
+int listen_on(int port, int backlog) {
     // create tcp socket
     int listener_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (listener_socket < 0) {
         perror("ERROR: opening socket");
-        return 1;
+        return -1;
     }
 
     // initialize server address struct
@@ -40,7 +311,7 @@ int server(int port, ConnectionHandler handler) {
     if (-1 == setsockopt(listener_socket,
                 SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int))) {
         perror("ERROR: on setsockopt");
-        return 1;
+        return -1;
     }
 
     // bind
@@ -48,38 +319,437 @@ int server(int port, ConnectionHandler handler) {
                 (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
         close(listener_socket);
         perror("ERROR: on binding");
-        return 1;
+        return -1;
     }
 
     // listen
-    if (-1 == listen(listener_socket, CONNECTION_BACKLOG)) {
+    if (-1 == listen(listener_socket, backlog)) {
         close(listener_socket);
         perror("ERROR: on listening");
-        return 1;
+        return -1;
     }
 
-    // the infinite accept loop
-    // all incoming connections are handed off to the given handler
+    return listener_socket;
+}
+
+/*
+ * Accepts the next connection on the given socket.
+ * Returns non-zero if an error occurs.
+ */
+int accept_conn(int listener_socket, Connection *conn) {
     struct sockaddr_in client_addr;
-    socklen_t client_addr_len;
-    Connection conn;
+    socklen_t client_addr_len = sizeof(client_addr);
+    conn->sockfd = accept(listener_socket,
+            (struct sockaddr *) &client_addr, &client_addr_len);
+    server_count_syscalls(1);
+
+    if (conn->sockfd == -1) {
+        // log the error, but then continue
+        perror("ERROR: on accept");
+        return 1;
+    }
+
+    conn->id = atomic_fetch_add(&connection_count, 1) + 1;
+    TRACE(accept, TRACE_INSTANT, conn->id);
+
+    // capture the client's ip
+    inet_ntop(client_addr.sin_family, &client_addr.sin_addr,
+        conn->ip, sizeof(conn->ip));
+
+    return 0;
+}
+
+/*
+ * The event loop each I/O thread runs, over the connections of its epoll
+ * instance.
+ */
+void *reactor_thread(void *pepfd) {
+    int epfd = *((int *) pepfd);
+    struct epoll_event events[MAX_EVENTS];
+
     while (1) {
-        client_addr_len = sizeof(client_addr);
-        conn.sockfd = accept(listener_socket,
-                (struct sockaddr *) &client_addr, &client_addr_len);
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        server_count_syscalls(1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("ERROR: on epoll_wait");
+            }
+            continue;
+        }
 
-        if (conn.sockfd == -1) {
-            // log the error, but then continue
-            perror("ERROR: on accept");
+        for (int i = 0; i < n; i++) {
+            ReactorConn *rc = (ReactorConn *) events[i].data.ptr;
+            uint32_t flags = events[i].events;
+
+            // hang ups and errors show up as the read failing
+            int open = 1;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                open = rc->events->readable(rc->conn, rc->data);
+            }
+            if (open && (flags & EPOLLOUT)) {
+                open = rc->events->writable(rc->conn, rc->data);
+            }
+
+            if (!open) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, rc->conn.sockfd, NULL);
+                server_count_syscalls(1);
+                rc->events->close(rc->conn, rc->data);
+                pool_free(&reactor_conn_pool, rc);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Raises the soft limit on open file descriptors to the hard limit.
+ */
+void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * Sets up an io_uring instance, with its buffer ring registered.
+ * Returns non-zero if the kernel doesn't support it.
+ */
+int ring_init(Ring *ring, int listener, ConnectionEvents *events) {
+    ring->listener = listener;
+    ring->events = events;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        return 1;
+    }
+
+    // map the queues
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char *cq = single_mmap ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+            IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return 1;
+    }
+
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // register the buffer ring, which needs to be page aligned
+    ring->buf_ring = mmap(NULL, BUFFER_COUNT * sizeof(struct io_uring_buf),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        close(ring->fd);
+        return 1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (0 != syscall(__NR_io_uring_register, ring->fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        close(ring->fd);
+        return 1;
+    }
+
+    ring->buffers = malloc(BUFFER_COUNT * BUFFER_LEN);
+    assert(ring->buffers);
+    ring->buf_tail = 0;
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        ring_add_buffer(ring, i);
+    }
+
+    return 0;
+}
+
+/*
+ * The event loop each I/O thread runs, over the completions of its ring.
+ */
+void *ring_thread(void *pring) {
+    Ring *ring = (Ring *) pring;
+
+    if (ring == ring->rings) {
+        ring_arm_accept(ring);
+    }
+
+    while (1) {
+        // hand over the new requests, and wait for at least one completion
+        if (ring_enter(ring, 1) < 0 && errno != EINTR) {
+            perror("ERROR: on io_uring_enter");
             continue;
         }
 
-        // capture the client's ip
-        inet_ntop(client_addr.sin_family, &client_addr.sin_addr,
-            conn.ip, sizeof(conn.ip));
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            ring_handle(ring, ring->cqes + (head & ring->cq_mask));
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
 
-        // hand the socket to the handler
-        handler(conn);
+    return NULL;
+}
+
+/*
+ * Handles a single completion.
+ */
+void ring_handle(Ring *ring, struct io_uring_cqe *cqe) {
+    int more = cqe->flags & IORING_CQE_F_MORE;
+
+    int tag = cqe->user_data & TAG_MASK;
+
+    switch (tag) {
+        case ACCEPT_TAG:
+            if (cqe->res >= 0) {
+                ring_hand_off(ring, cqe->res);
+            } else {
+                errno = -cqe->res;
+                perror("ERROR: on accept");
+            }
+
+            // multishot requests can stop, eg. if the ring gets too full
+            if (!more) {
+                ring_arm_accept(ring);
+            }
+            return;
+        case HANDOFF_TAG:
+            ring_open(ring, cqe->res);
+            return;
+        case SENT_TAG:
+            // the other ring never got it, so keep it
+            if (cqe->res < 0) {
+                ring_open(ring, cqe->user_data >> 4);
+            }
+            return;
+        case IGNORE_TAG:
+            return;
+    }
+
+    RingConn *rc = (RingConn *) (uintptr_t) (cqe->user_data & ~TAG_MASK);
+    if (tag == POLL_TAG) {
+        // the socket may have become writable
+        if (cqe->res > 0 && !rc->closing
+                && !ring->events->writable(rc->conn, rc->data)) {
+            ring_close(ring, rc);
+        }
+
+        if (!more) {
+            rc->armed--;
+            if (!rc->closing) {
+                ring_arm_poll(ring, rc);
+            }
+        }
+    } else {
+        if (cqe->res > 0) {
+            int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buf = ring->buffers + bid * BUFFER_LEN;
+
+            if (!rc->closing && !ring->events->received(rc->conn, rc->data,
+                        buf, cqe->res)) {
+                ring_close(ring, rc);
+            }
+
+            ring_add_buffer(ring, bid);
+        } else if (cqe->res != -ENOBUFS) {
+            // disconnected or an error, ENOBUFS just means it has to be
+            // re-armed now that buffers have been given back
+            ring_close(ring, rc);
+        }
+
+        if (!more) {
+            rc->armed--;
+            if (!rc->closing) {
+                ring_arm_recv(ring, rc);
+            }
+        }
+    }
+
+    // only once nothing refers to it anymore
+    if (rc->armed == 0) {
+        ring->events->close(rc->conn, rc->data);
+        pool_free(&ring_conn_pool, rc);
+    }
+}
+
+/*
+ * Sets up a newly accepted connection.
+ */
+void ring_open(Ring *ring, int sockfd) {
+    RingConn *rc = (RingConn *) pool_alloc(&ring_conn_pool);
+    assert(0 == ((uintptr_t) rc & TAG_MASK));
+
+    rc->conn.id = atomic_fetch_add(&connection_count, 1) + 1;
+    TRACE(accept, TRACE_INSTANT, rc->conn.id);
+    rc->conn.sockfd = sockfd;
+    rc->closing = 0;
+    rc->armed = 0;
+
+    // capture the client's ip
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+    getpeername(sockfd, (struct sockaddr *) &client_addr, &client_addr_len);
+    server_count_syscalls(1);
+    inet_ntop(client_addr.sin_family, &client_addr.sin_addr,
+        rc->conn.ip, sizeof(rc->conn.ip));
+
+    rc->data = ring->events->open(rc->conn);
+    ring_arm_recv(ring, rc);
+    ring_arm_poll(ring, rc);
+}
+
+/*
+ * Hands a newly accepted connection to the next ring in turn.
+ */
+void ring_hand_off(Ring *ring, int sockfd) {
+    Ring *target = ring->rings + ring->next_ring;
+    ring->next_ring = (ring->next_ring + 1) % ring->ring_count;
+
+    if (target == ring) {
+        ring_open(ring, sockfd);
+        return;
+    }
+
+    // posts a completion with the socket to the other ring
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_MSG_RING;
+    sqe->fd = target->fd;
+    sqe->len = sockfd;
+    sqe->off = HANDOFF_TAG;
+    sqe->user_data = (uint64_t) sockfd << 4 | SENT_TAG;
+}
+
+/*
+ * Queues a multishot accept on the listening socket.
+ */
+void ring_arm_accept(Ring *ring) {
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ring->listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = ACCEPT_TAG;
+}
+
+/*
+ * Queues a multishot recv on the given connection, into the provided buffers.
+ */
+void ring_arm_recv(Ring *ring, RingConn *rc) {
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = rc->conn.sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = (uint64_t) (uintptr_t) rc | RECV_TAG;
+    rc->armed++;
+}
+
+/*
+ * Queues a multishot poll for the given connection becoming writable.
+ */
+void ring_arm_poll(Ring *ring, RingConn *rc) {
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = rc->conn.sockfd;
+    sqe->poll32_events = POLLOUT;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t) (uintptr_t) rc | POLL_TAG;
+    rc->armed++;
+}
+
+/*
+ * Starts closing the given connection, by cancelling its requests.
+ */
+void ring_close(Ring *ring, RingConn *rc) {
+    if (rc->closing) {
+        return;
     }
+    rc->closing = 1;
 
+    // (a client can keep the recv going forever, even after a shutdown)
+    uint64_t tags[] = { RECV_TAG, POLL_TAG };
+    for (int i = 0; i < 2; i++) {
+        struct io_uring_sqe *sqe = ring_sqe(ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t) (uintptr_t) rc | tags[i];
+        sqe->user_data = IGNORE_TAG;
+    }
 }
+
+/*
+ * Gives the buffer with the given id (back) to the kernel.
+ */
+void ring_add_buffer(Ring *ring, int bid) {
+    struct io_uring_buf *buf =
+        ring->buf_ring->bufs + (ring->buf_tail & (BUFFER_COUNT - 1));
+    buf->addr = (uint64_t) (uintptr_t) (ring->buffers + bid * BUFFER_LEN);
+    buf->len = BUFFER_LEN;
+    buf->bid = bid;
+
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns a cleared submission queue entry to fill in, handing the queued
+ * ones to the kernel first if the queue is full.
+ */
+struct io_uring_sqe *ring_sqe(Ring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        ring_enter(ring, 0);
+    }
+
+    unsigned index = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+/*
+ * Hands the queued submissions to the kernel, waiting for the given number
+ * of completions.
+ * Returns the same as io_uring_enter.
+ */
+int ring_enter(Ring *ring, unsigned wait) {
+    unsigned submit = ring->sq_local_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    server_count_syscalls(1);
+    return syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+            wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+#endif
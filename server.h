@@ -7,16 +7,28 @@
  * Actual communication is handed off to a connection handler that the server
  * takes as an argument.
  *
+ * There are two flavours:
+ *   server: hands each connection off to the handler, which owns it from then
+ *           on (eg. to spawn a thread that blocks on it).
+ *   server_reactor: multiplexes non-blocking connections over a few I/O
+ *                   threads with edge-triggered epoll, calling the handler's
+ *                   callbacks as each connection opens, has input and closes.
+ *   server_uring: the same, but with io_uring (multishot accept, and
+ *                 multishot recv into a ring of provided buffers), so the I/O
+ *                 threads don't make a syscall per read.
+ *
  */
 
 #pragma once
 
+#include <stdint.h>
 #include <arpa/inet.h>
 
 /*
  * Struct for a single connection.
  */
 typedef struct {
+    uint64_t id; // never reused, unlike the socket
     int sockfd;
     char ip[INET_ADDRSTRLEN];
 } Connection;
@@ -33,3 +45,59 @@ typedef void (*ConnectionHandler)(Connection conn);
  * Returns non-zero if an error occurs.
  */
 int server(int port, ConnectionHandler handler);
+
+/*
+ * The callbacks used by server_reactor.
+ */
+typedef struct {
+    // called (on the accepting thread) for each new connection
+    // returns the data to pass to the other callbacks
+    void *(*open)(Connection conn);
+
+    // called (on the connection's I/O thread) whenever there's new input
+    // the socket is non-blocking and edge-triggered, so this needs to read
+    // until it would block
+    // returns zero once the connection should be closed
+    int (*readable)(Connection conn, void *data);
+
+    // called (on the connection's I/O thread) with the data that has been
+    // received for it, instead of readable, by server_uring
+    // returns zero once the connection should be closed
+    int (*received)(Connection conn, void *data, char *buf, int len);
+    // called (on the connection's I/O thread) when the socket may have
+    // become writable, after a send couldn't go through (and at other times)
+    // returns zero once the connection should be closed
+    int (*writable)(Connection conn, void *data);
+
+    // called (on the connection's I/O thread) once the connection is done,
+    // this owns the socket so should close it
+    void (*close)(Connection conn, void *data);
+} ConnectionEvents;
+
+/*
+ * The event driven server, takes the port to connect to, the number of I/O
+ * threads to spread the connections over and the callbacks to use.
+ * Returns non-zero if an error occurs.
+ */
+int server_reactor(int port, int io_threads, ConnectionEvents *events);
+
+/*
+ * The io_uring server, otherwise the same as server_reactor.
+ * Returns SERVER_UNSUPPORTED (before accepting anything) if io_uring isn't
+ * available, either in the build or the kernel, and non-zero if another
+ * error occurs.
+ */
+int server_uring(int port, int io_threads, ConnectionEvents *events);
+
+#define SERVER_UNSUPPORTED 2
+
+/*
+ * Counts networking syscalls (for server_syscalls).
+ */
+void server_count_syscalls(int n);
+
+/*
+ * The number of networking syscalls made so far, by this module and the sstp
+ * socket wrapper.
+ */
+uint64_t server_syscalls(void);
@@ -0,0 +1,582 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "hashcash.h"
+#include "metrics.h"
+#include "trace.h"
+#include "topology.h"
+
+#include "solver.h"
+
+// how many nonces a solver thread searches between checking for an abort
+// (or for another thread having found the solution), which bounds how long
+// an aborted job holds on to its threads
+#define SOLVER_BATCH 1024
+
+// the bounds on CHUNKED's chunk size, and how long each chunk should take
+#define CHUNK_MIN SOLVER_BATCH
+#define CHUNK_MAX (SOLVER_BATCH << 16)
+#define CHUNK_NS 20000000 // 20ms
+
+// marks that no solution has been found (yet)
+#define NO_SOLUTION UINT64_MAX
+
+#define MAX_KERNELS 8
+
+
+/***** Private structs
+ */
+
+/*
+ * A single thread of the pool, and the part of a job it has been given.
+ * Allocated by the thread itself, on a cache line of its own.
+ */
+typedef struct {
+    _Alignas(SOLVER_CACHE_LINE) pthread_t tid;
+    pthread_cond_t assigned;
+
+    SolverJob *job; // NULL when idle
+    int part;       // which of the job's threads this is
+} SolverThread;
+
+// the pool, everything is protected by the mutex
+SolverThread **threads = NULL;
+int threads_len = 0;
+int threads_ready = 0;
+int idle_count = 0;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idle_changed = PTHREAD_COND_INITIALIZER;
+pthread_cond_t job_finished = PTHREAD_COND_INITIALIZER;
+
+// where the threads go, only written before they're started
+SolverPlacement thread_placement = SPREAD;
+cpu_set_t thread_reserved;
+int *thread_cpus = NULL; // by thread, -1 if not pinned to one
+
+// the hashes computed by each kernel, registered the first time it's used
+Metric *kernel_hashes[MAX_KERNELS];
+char *kernel_names[MAX_KERNELS];
+int kernels_len = 0;
+pthread_mutex_t kernels_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/***** Helper function prototypes
+ */
+
+void place_threads(int *thread_count, cpu_set_t *usable);
+int place_spread_cmp(const void *a, const void *b);
+int place_compact_cmp(const void *a, const void *b);
+void *solver_thread(void *index);
+void solve_part(SolverJob *job, int part);
+int solve_strided(SolverJob *job, HashcashSearch *search, Metric *hashes,
+        uint64_t nonce, uint64_t stride, uint64_t *solution);
+int solve_chunked(SolverJob *job, HashcashSearch *search, Metric *hashes,
+        uint64_t *solution);
+Metric *get_kernel_hashes(void);
+void solve_keep_lowest(SolverJob *job, uint64_t offset);
+uint64_t now_ns(void);
+
+
+/***** Public functions
+ */
+
+int solver_set_placement(SolverPlacement placement, char *reserved) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (reserved != NULL && 0 != topology_parse_cpus(reserved, &cpus)) {
+        return -1;
+    }
+
+    thread_placement = placement;
+    thread_reserved = cpus;
+    return 0;
+}
+
+int solver_parse_placement(char *name) {
+    if (0 == strcmp(name, "spread")) {
+        return SPREAD;
+    } else if (0 == strcmp(name, "compact")) {
+        return COMPACT;
+    } else if (0 == strcmp(name, "none")) {
+        return FLOATING;
+    } else {
+        return -1;
+    }
+}
+
+void solver_init(int thread_count) {
+    if (threads != NULL) { return; }
+
+    cpu_set_t usable;
+    place_threads(&thread_count, &usable);
+
+    threads = calloc(thread_count, sizeof(SolverThread *));
+    assert(threads);
+    threads_len = thread_count;
+    idle_count = thread_count;
+
+    for (int i = 0; i < thread_count; i++) {
+        // keep each thread on its own cpu (or off the reserved ones)
+        cpu_set_t cpus = usable;
+        if (thread_cpus[i] >= 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(thread_cpus[i], &cpus);
+        }
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+        pthread_t tid;
+        int err = pthread_create(&tid, &attr, solver_thread,
+                (void *) (intptr_t) i);
+
+        pthread_attr_destroy(&attr);
+
+        // make do with the threads already started, if any
+        if (err != 0) {
+            errno = err;
+            perror("ERROR: on creating a solver thread");
+            if (i == 0) {
+                exit(1);
+            }
+            pthread_mutex_lock(&pool_mutex);
+            threads_len = idle_count = i;
+            pthread_mutex_unlock(&pool_mutex);
+            break;
+        }
+    }
+
+    // jobs can't be handed out until every thread has set itself up
+    pthread_mutex_lock(&pool_mutex);
+    while (threads_ready < threads_len) {
+        pthread_cond_wait(&idle_changed, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+int solver_thread_count(void) {
+    return threads_len;
+}
+
+int solver_thread_cpu(int thread) {
+    return thread >= 0 && thread < threads_len ? thread_cpus[thread] : -1;
+}
+
+int solver_idle_count(void) {
+    pthread_mutex_lock(&pool_mutex);
+    int count = idle_count;
+    pthread_mutex_unlock(&pool_mutex);
+    return count;
+}
+
+int solver_parse_balancing(char *name) {
+    if (0 == strcmp(name, "blocked")) {
+        return BLOCKED;
+    } else if (0 == strcmp(name, "interspersed")) {
+        return INTERSPERSED;
+    } else if (0 == strcmp(name, "chunked")) {
+        return CHUNKED;
+    } else {
+        return -1;
+    }
+}
+
+void solver_submit(SolverJob *job) {
+    atomic_init(&job->cursor, 0);
+    atomic_init(&job->best, NO_SOLUTION);
+
+    pthread_mutex_lock(&pool_mutex);
+
+    if (job->thread_count > threads_len) {
+        job->thread_count = threads_len;
+    }
+    if (job->thread_count < 1) {
+        job->thread_count = 1;
+    }
+
+    while (idle_count < job->thread_count) {
+        pthread_cond_wait(&idle_changed, &pool_mutex);
+    }
+
+    // hand a part of the job to each idle thread
+    job->remaining = job->thread_count;
+    int part = 0;
+    for (int i = 0; i < threads_len && part < job->thread_count; i++) {
+        if (threads[i]->job == NULL) {
+            threads[i]->job = job;
+            threads[i]->part = part++;
+            idle_count--;
+            pthread_cond_signal(&threads[i]->assigned);
+        }
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void solver_wait(SolverJob *job) {
+    pthread_mutex_lock(&pool_mutex);
+    while (job->remaining > 0) {
+        pthread_cond_wait(&job_finished, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void solver_abort(SolverJob *job) {
+    atomic_store_explicit(&job->abort, 1, memory_order_release);
+}
+
+int solver_aborted(SolverJob *job) {
+    return atomic_load_explicit(&job->abort, memory_order_acquire);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Picks the cpu each of the threads goes on (into thread_cpus), in placement
+ * order, and sets usable to the cpus that aren't reserved.
+ * A thread_count of 0 is set to the number of usable cpus.
+ */
+void place_threads(int *thread_count, cpu_set_t *usable) {
+    TopologyCpu *all;
+    int all_len = topology_cpus(&all);
+
+    TopologyCpu **cpus = malloc(all_len * sizeof(TopologyCpu *));
+    assert(cpus);
+    int cpus_len = 0;
+    for (int i = 0; i < all_len; i++) {
+        if (!CPU_ISSET(all[i].cpu, &thread_reserved)) {
+            cpus[cpus_len++] = all + i;
+        }
+    }
+    if (cpus_len == 0) {
+        // every cpu is reserved, so share them
+        for (int i = 0; i < all_len; i++) {
+            cpus[cpus_len++] = all + i;
+        }
+    }
+
+    CPU_ZERO(usable);
+    for (int i = 0; i < cpus_len; i++) {
+        CPU_SET(cpus[i]->cpu, usable);
+    }
+
+    if (thread_placement == SPREAD) {
+        qsort(cpus, cpus_len, sizeof(TopologyCpu *), place_spread_cmp);
+    } else if (thread_placement == COMPACT) {
+        qsort(cpus, cpus_len, sizeof(TopologyCpu *), place_compact_cmp);
+    }
+
+    if (*thread_count <= 0) {
+        *thread_count = cpus_len;
+    }
+
+    // any more threads than cpus wrap around
+    thread_cpus = malloc(*thread_count * sizeof(int));
+    assert(thread_cpus);
+    for (int i = 0; i < *thread_count; i++) {
+        thread_cpus[i] = thread_placement == FLOATING
+            ? -1 : cpus[i % cpus_len]->cpu;
+    }
+
+    free(cpus);
+}
+
+/*
+ * Orders cpus by sibling, then by node, package and core, for qsort.
+ */
+int place_spread_cmp(const void *a, const void *b) {
+    TopologyCpu *x = *(TopologyCpu **) a;
+    TopologyCpu *y = *(TopologyCpu **) b;
+
+    if (x->sibling != y->sibling) { return x->sibling - y->sibling; }
+    if (x->node != y->node) { return x->node - y->node; }
+    if (x->package != y->package) { return x->package - y->package; }
+    if (x->core != y->core) { return x->core - y->core; }
+    return x->cpu - y->cpu;
+}
+
+/*
+ * Orders cpus by node, package and core, then by sibling, for qsort.
+ */
+int place_compact_cmp(const void *a, const void *b) {
+    TopologyCpu *x = *(TopologyCpu **) a;
+    TopologyCpu *y = *(TopologyCpu **) b;
+
+    if (x->node != y->node) { return x->node - y->node; }
+    if (x->package != y->package) { return x->package - y->package; }
+    if (x->core != y->core) { return x->core - y->core; }
+    if (x->sibling != y->sibling) { return x->sibling - y->sibling; }
+    return x->cpu - y->cpu;
+}
+
+/*
+ * The loop each thread of the pool runs, waiting for parts of jobs to solve.
+ */
+void *solver_thread(void *index) {
+    // allocated here, now that the thread is on its cpu, so the memory is
+    // first touched (and so placed) on the cpu's NUMA node, like its stack
+    SolverThread *thread = aligned_alloc(SOLVER_CACHE_LINE,
+            sizeof(SolverThread));
+    assert(thread);
+    thread->tid = pthread_self();
+    pthread_cond_init(&thread->assigned, NULL);
+    thread->job = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    threads[(intptr_t) index] = thread;
+    threads_ready++;
+    pthread_cond_broadcast(&idle_changed);
+
+    while (1) {
+        while (thread->job == NULL) {
+            pthread_cond_wait(&thread->assigned, &pool_mutex);
+        }
+        SolverJob *job = thread->job;
+        int part = thread->part;
+        pthread_mutex_unlock(&pool_mutex);
+
+        TRACE(solve_start, TRACE_BEGIN, job->trace_id);
+        solve_part(job, part);
+        TRACE(solve_stop, TRACE_END, job->trace_id);
+
+        pthread_mutex_lock(&pool_mutex);
+        thread->job = NULL;
+        idle_count++;
+        pthread_cond_broadcast(&idle_changed);
+
+        // the last thread to finish signals the job's completion, with the
+        // lowest solution any of them found
+        if (--job->remaining == 0) {
+            uint64_t best = atomic_load(&job->best);
+            if (best != NO_SOLUTION && !solver_aborted(job)) {
+                job->solution_found = 1;
+                job->solution = job->start + best;
+            }
+
+            if (job->on_done != NULL) {
+                // the job might be freed by on_done, so it can't be touched
+                // after this
+                pthread_mutex_unlock(&pool_mutex);
+                job->on_done(job->data);
+                pthread_mutex_lock(&pool_mutex);
+            } else {
+                pthread_cond_broadcast(&job_finished);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Searches the given part of the job for a valid proof-of-work nonce value.
+ * The solution is picked once every thread is done.
+ */
+void solve_part(SolverJob *job, int part) {
+    uint64_t solution;
+    Metric *hashes = get_kernel_hashes();
+
+    // the search is only ever read, so each thread searches with a copy on
+    // its own stack (and so on its own NUMA node), instead of reading the
+    // job's wherever it was allocated
+    HashcashSearch search = job->search;
+
+    switch (job->balancing) {
+        case BLOCKED:
+            solve_strided(job, &search, hashes,
+                    job->start + part
+                        * ((UINT64_MAX - job->start) / job->thread_count),
+                    SOLVER_BATCH, &solution);
+            break;
+        case INTERSPERSED:
+            solve_strided(job, &search, hashes,
+                    job->start + part * (uint64_t) SOLVER_BATCH,
+                    (uint64_t) SOLVER_BATCH * job->thread_count, &solution);
+            break;
+        case CHUNKED:
+            solve_chunked(job, &search, hashes, &solution);
+            break;
+    }
+}
+
+/*
+ * Searches batches of nonces (with the given copy of the job's search),
+ * starting at the given nonce and moving on by stride each time, until a
+ * solution is found (by any thread) or the job is aborted.
+ * Returns 1 and sets solution if this thread found one, 0 otherwise.
+ */
+int solve_strided(SolverJob *job, HashcashSearch *search, Metric *hashes,
+        uint64_t nonce, uint64_t stride, uint64_t *solution) {
+    uint64_t count;
+
+    while (!atomic_load_explicit(&job->abort, memory_order_relaxed)
+            && NO_SOLUTION == atomic_load_explicit(&job->best,
+                memory_order_relaxed)) {
+        // don't search past the end of the nonce space
+        count = UINT64_MAX - nonce < SOLVER_BATCH
+            ? UINT64_MAX - nonce + 1
+            : SOLVER_BATCH;
+
+        if (hashcash_search(search, nonce, count, solution)) {
+            metrics_add(hashes, *solution - nonce + 1);
+            TRACE(solution_found, TRACE_ASYNC_STEP, job->trace_id);
+            // threads that find one at about the same time keep the lowest
+            solve_keep_lowest(job, *solution - job->start);
+            return 1;
+        }
+        metrics_add(hashes, count);
+
+        // stop if the nonce would roll over
+        if (UINT64_MAX - nonce < stride) {
+            break;
+        }
+        nonce += stride;
+    }
+
+    return 0;
+}
+
+/*
+ * Claims chunks from the job's cursor and searches them (with the given copy
+ * of the job's search), until the job is aborted or every chunk before the
+ * lowest solution found has been searched.
+ * Each solution found lowers the job's best (if it is lower), so once every
+ * thread is done best is the lowest valid nonce.
+ * Returns 1 and sets solution if this thread found one, 0 otherwise.
+ */
+int solve_chunked(SolverJob *job, HashcashSearch *search, Metric *hashes,
+        uint64_t *solution) {
+    // offsets from the start, the last nonce is at offset end
+    uint64_t end = UINT64_MAX - job->start;
+    uint64_t chunk = CHUNK_MIN;
+    int found = 0;
+
+    while (!atomic_load_explicit(&job->abort, memory_order_relaxed)) {
+        // claim the next chunk, unless they're all gone
+        uint64_t offset = atomic_load_explicit(&job->cursor, memory_order_relaxed);
+        uint64_t size;
+        do {
+            if (offset > end || offset >= atomic_load(&job->best)) {
+                return found;
+            }
+            size = end - offset < chunk ? end - offset + 1 : chunk;
+        } while (!atomic_compare_exchange_weak(&job->cursor, &offset,
+                    offset + size));
+
+        uint64_t chunk_start = now_ns();
+        uint64_t searched = 0;
+
+        // search it a batch at a time, giving up on the rest of the chunk
+        // once it's past a solution
+        for (uint64_t i = 0; i < size
+                && !atomic_load_explicit(&job->abort, memory_order_relaxed);
+                i += SOLVER_BATCH) {
+            if (offset + i >= atomic_load_explicit(&job->best,
+                        memory_order_relaxed)) {
+                break;
+            }
+
+            uint64_t count = size - i < SOLVER_BATCH ? size - i : SOLVER_BATCH;
+            uint64_t nonce;
+            if (hashcash_search(search, job->start + offset + i, count,
+                        &nonce)) {
+                searched += nonce - (job->start + offset + i) + 1;
+                metrics_add(hashes, nonce - (job->start + offset + i) + 1);
+                TRACE(solution_found, TRACE_ASYNC_STEP, job->trace_id);
+                solve_keep_lowest(job, nonce - job->start);
+                *solution = nonce;
+                found = 1;
+                break;
+            }
+            searched += count;
+            metrics_add(hashes, count);
+        }
+
+        // size the next chunk so it takes about CHUNK_NS, going by how much
+        // of this one was actually searched (not all of it, if it gave up)
+        uint64_t elapsed = now_ns() - chunk_start;
+        if (elapsed > 0 && searched > 0) {
+            double rate = (double) searched / elapsed;
+            chunk = (uint64_t) (rate * CHUNK_NS) / SOLVER_BATCH * SOLVER_BATCH;
+        }
+        if (chunk < CHUNK_MIN) {
+            chunk = CHUNK_MIN;
+        } else if (chunk > CHUNK_MAX) {
+            chunk = CHUNK_MAX;
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Lowers the job's best solution to the given offset, unless a lower one has
+ * already been found.
+ */
+void solve_keep_lowest(SolverJob *job, uint64_t offset) {
+    uint64_t best = atomic_load(&job->best);
+    while (offset < best
+            && !atomic_compare_exchange_weak(&job->best, &best, offset));
+}
+
+/*
+ * The hashes counter of the selected kernel.
+ */
+Metric *get_kernel_hashes(void) {
+    char *name = hashcash_kernel_name();
+    Metric *hashes = NULL;
+
+    pthread_mutex_lock(&kernels_mutex);
+    for (int i = 0; i < kernels_len; i++) {
+        if (0 == strcmp(kernel_names[i], name)) {
+            hashes = kernel_hashes[i];
+        }
+    }
+
+    if (hashes == NULL) {
+        assert(kernels_len < MAX_KERNELS);
+
+        // the labels have to outlive this
+        char *labels = malloc(strlen(name) + sizeof("kernel=\"\""));
+        assert(labels);
+        sprintf(labels, "kernel=\"%s\"", name);
+
+        hashes = metrics_register(METRIC_COUNTER, "solver_hashes_total",
+                labels, "Nonces hashed by the solver, by search kernel.");
+        kernel_names[kernels_len] = name;
+        kernel_hashes[kernels_len++] = hashes;
+    }
+    pthread_mutex_unlock(&kernels_mutex);
+
+    return hashes;
+}
+
+/*
+ * The current (monotonic) time in nanoseconds.
+ */
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
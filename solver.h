@@ -0,0 +1,190 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The solver module. A fixed pool of solver threads, each pinned to a cpu,
+ * that search for hashcash solutions.
+ * Jobs are handed to the pool through a SolverJob, which is split over as many
+ * of the pool's threads as it asks for.
+ *
+ * The threads are placed by the cpu topology (see topology.h), and a job's
+ * threads are taken in placement order, so a job with fewer threads than
+ * the pool spreads over as many physical cores as it can. Some cpus can be
+ * reserved (eg. for the I/O threads), which the solver threads then stay
+ * off. Each thread allocates its own state once it's running on its cpu, and
+ * searches with a copy of the job's search on its stack, so the memory it
+ * touches while hashing is on its local NUMA node. The rest of a SolverJob
+ * (the abort flag, cursor and best solution, that every thread shares) stays
+ * wherever its submitter allocated it.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hashcash.h"
+
+// the size of a cache line, that the fields the solver threads write to are
+// kept apart by
+#define SOLVER_CACHE_LINE 64
+
+/*
+ * How a job's nonce space is split between its threads.
+ *
+ * BLOCKED
+ * eg: (assuming a search space of size 1 byte)
+ *      thread 0:   0,   1,   2, ... (ie.   0-127)
+ *      thread 1: 128, 129, 130, ... (ie. 128-255)
+ *
+ * INTERSPERSED
+ * eg: (in batches of nonces, the search kernels work on runs of consecutive
+ *     nonces)
+ *      thread 0: batch 0, 2, 4, ... (ie. all even batches)
+ *      thread 1: batch 1, 3, 5, ... (ie. all odd batches)
+ *
+ * CHUNKED
+ *      each thread claims the next chunk of nonces from a shared cursor
+ *      whenever it finishes one, with the chunk size adapted to the thread's
+ *      hashrate. Always finds the lowest valid nonce, and a slow (or
+ *      preempted) thread only holds up the chunk it's on.
+ */
+typedef enum {
+    BLOCKED,
+    INTERSPERSED,
+    CHUNKED
+} SolverBalancing;
+
+/*
+ * Where the solver threads are pinned.
+ *
+ * SPREAD
+ *      one thread per physical core first, then on the cores' SMT siblings
+ *      once every core has one (which share the core's execution units, so
+ *      add little)
+ *
+ * COMPACT
+ *      filling each core's SMT siblings before moving on to the next core,
+ *      NUMA node by node
+ *
+ * FLOATING
+ *      not pinned to a single cpu, the scheduler moves them between the
+ *      (unreserved) cpus as it likes
+ */
+typedef enum {
+    SPREAD,
+    COMPACT,
+    FLOATING
+} SolverPlacement;
+
+/*
+ * The struct that describes a single search to the pool.
+ * Note: the struct is cache line aligned, so has to be allocated with
+ *       aligned_alloc (or on the stack).
+ */
+typedef struct {
+    // the search itself, only ever read by the solver threads
+    HashcashSearch search;
+    uint64_t start;
+    int thread_count; // clamped to the size of the pool
+    SolverBalancing balancing;
+
+    // the cancellation token, set (see solver_abort) to stop the search
+    // early, which the threads check once per batch of nonces
+    // (on a line of its own, so checking it doesn't share a line with
+    // anything that's written while searching)
+    _Alignas(SOLVER_CACHE_LINE) _Atomic int abort;
+
+    // the result, only set once every thread is done with the job
+    char solution_found;
+    uint64_t solution;
+
+    // if set, called (on a solver thread) once every thread is done with the
+    // job, instead of waking up solver_wait
+    void (*on_done)(void *data);
+    void *data;
+
+    // the id the job's tracepoints are recorded with (see trace.h)
+    uint64_t trace_id;
+
+    // private, how many of the job's threads are still searching
+    int remaining;
+
+    // private, for CHUNKED: the offset (from start) of the next unclaimed
+    // nonce
+    _Alignas(SOLVER_CACHE_LINE) _Atomic uint64_t cursor;
+
+    // private, the offset (from start) of the lowest solution found so far
+    _Alignas(SOLVER_CACHE_LINE) _Atomic uint64_t best;
+} SolverJob;
+
+/*
+ * Sets how the solver threads are placed, and the cpus (a cpu list, eg.
+ * "0-1", or NULL) they're kept off of, unless every cpu is reserved.
+ * Defaults to SPREAD over every cpu, only has an effect before solver_init.
+ * Returns 0 on success, and -1 if reserved isn't a cpu list.
+ */
+int solver_set_placement(SolverPlacement placement, char *reserved);
+
+/*
+ * Converts the name of a placement ("spread", "compact" or "none") to its
+ * value.
+ * Returns -1 if the name is unknown.
+ */
+int solver_parse_placement(char *name);
+
+/*
+ * Creates the pool of solver threads, waiting until each is on its cpu.
+ * thread_count of 0 creates one thread per unreserved cpu.
+ * If a thread can't be created the pool is left with the ones before it, and
+ * the process exits if there are none.
+ */
+void solver_init(int thread_count);
+
+/*
+ * The number of threads in the pool.
+ */
+int solver_thread_count(void);
+
+/*
+ * The cpu the given thread of the pool (by index, in placement order) is
+ * pinned to, or -1 if it isn't pinned to one.
+ */
+int solver_thread_cpu(int thread);
+
+/*
+ * Converts the name of a balancing method ("blocked", "interspersed" or
+ * "chunked") to its value.
+ * Returns -1 if the name is unknown.
+ */
+int solver_parse_balancing(char *name);
+
+/*
+ * The number of threads in the pool that currently don't have a job.
+ */
+int solver_idle_count(void);
+
+/*
+ * Hands the given job to the pool, waiting until enough threads are idle.
+ * The job must stay alive until it is done, ie. until solver_wait returns or
+ * on_done is called.
+ */
+void solver_submit(SolverJob *job);
+
+/*
+ * Waits for every thread working on the given job to finish.
+ * Only for jobs without an on_done.
+ */
+void solver_wait(SolverJob *job);
+
+/*
+ * Stops the given job's search, which doesn't find a solution after this.
+ * Safe to call from any thread, whether or not the job has been submitted.
+ */
+void solver_abort(SolverJob *job);
+
+/*
+ * Whether the given job has been aborted.
+ */
+int solver_aborted(SolverJob *job);
@@ -6,18 +6,29 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
-#include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 
 #include "sstp.h"
 #include "sstp-socket-wrapper.h"
+#include "server.h"
+#include "pool.h"
 
 #define DELIMITER "\r\n"
 #define DELIMITER_LEN 2
 #define HEADER_LEN 4
 #define MAX_MSG_LEN HEADER_LEN + 1 + MAX_PAYLOAD_LEN + DELIMITER_LEN
+#define IN_BUFFER_LEN 16384
+#define OUT_QUEUE_LEN 32768 // the high-water mark
 
 
 /***** Private structs
@@ -25,91 +36,123 @@
 
 struct SSTPSocketWrapper {
     int sockfd;
-    char buffer[MAX_MSG_LEN + 1];
-    int buffer_len;
+
+    // the framing state, kept between reads so a message can come in over
+    // any number of them (and a read can bring in any number of messages)
+    // the unframed data is buffer[start, end), the messages are parsed
+    // straight out of it
+    int start;
+    int end;
+    int scanned; // how much of the unframed data has no delimiter
+    int overflow; // how much of the current message has been thrown away
+
+    // the msgs waiting to be sent, a ring of out_len bytes from out_head
+    // (so whoever is writing never waits on the client reading)
+    pthread_mutex_t out_mutex;
+    int out_head;
+    int out_len;
+    int corked; // while corked, msgs are only queued
+    int full; // the queue overflowed and the client was cut off
+
+    // wakes up a blocking read to flush the queue, once there's been one
+    int wake_fd;
+
+    char buffer[IN_BUFFER_LEN];
+    char out[OUT_QUEUE_LEN];
 };
 
+// every stream, buffers and all
+Pool sstp_pool = POOL_INITIALIZER(sizeof(SSTPSocketWrapper),
+        _Alignof(SSTPSocketWrapper));
+
 
 /***** Helper function prototypes
  */
 
-char *strnstr(char *haystack, char *needle, int n);
-int sendall(int s, char *buf, int *len);
+int read_msg(SSTPSocketWrapper *stream, SSTPMsg *msg, int flags);
+int next_msg(SSTPSocketWrapper *stream, SSTPMsg *msg);
+int find_delimiter(char *data, int len, int from);
+void compact(SSTPSocketWrapper *stream);
+int wait_input(SSTPSocketWrapper *stream);
+int cut_off(SSTPSocketWrapper *stream);
+int flush_out(SSTPSocketWrapper *stream);
+int flush_or_wake(SSTPSocketWrapper *stream);
 
 
 /***** Public functions
  */
 
 SSTPSocketWrapper *sstp_init(int sockfd) {
-    SSTPSocketWrapper *stream = malloc(sizeof(SSTPSocketWrapper));
-    assert(NULL != stream);
+    SSTPSocketWrapper *stream =
+        (SSTPSocketWrapper *) pool_alloc(&sstp_pool);
 
     stream->sockfd = sockfd;
-    stream->buffer_len = 0;
+    stream->start = 0;
+    stream->end = 0;
+    stream->scanned = 0;
+    stream->overflow = 0;
+    pthread_mutex_init(&stream->out_mutex, NULL);
+    stream->out_head = 0;
+    stream->out_len = 0;
+    stream->corked = 0;
+    stream->full = 0;
+    stream->wake_fd = -1;
 
     return stream;
 }
 
 int sstp_read(SSTPSocketWrapper *stream, SSTPMsg *msg) {
-    char buffer[MAX_MSG_LEN + 1];
-    int buffer_len = 0;
-    int overflow = 0;
-    char *match = NULL;
-    int read_n;
-
-    // populate buffer with the previous call's buffer contents
-    if (stream->buffer_len > 0) {
-        strncpy(buffer, stream->buffer, stream->buffer_len);
-        buffer_len = stream->buffer_len;
-        stream->buffer_len = 0;
-    } else { // otherwise, buffer should start as an empty string
-        buffer[0] = '\0';
-    }
-
-    // read until hitting a delimiter
-    while (1) {
-        // look for the delimiter
-        match = strnstr(buffer, DELIMITER, buffer_len);
-        if (match != NULL) { // found it!
-            // include the delimiter in the match
-            match += DELIMITER_LEN;
+    return read_msg(stream, msg, 0);
+}
 
-            // keep the rest of the buffer for next call
-            strcpy(stream->buffer, match);
-            stream->buffer_len = buffer_len - (match - buffer);
-            buffer_len = match - buffer;
+int sstp_try_read(SSTPSocketWrapper *stream, SSTPMsg *msg) {
+    return read_msg(stream, msg, MSG_DONTWAIT);
+}
 
-            // terminate the match
-            buffer[match - buffer] = '\0';
+int sstp_feed(SSTPSocketWrapper *stream, char **data, int *len, SSTPMsg *msg) {
+    while (!next_msg(stream, msg)) {
+        if (*len == 0) {
+            return SSTP_AGAIN;
+        }
 
-            // stop reading and start processing the match
-            break;
+        // if nothing is pending, whole messages can be parsed straight out of
+        // the data
+        if (stream->start == stream->end && stream->overflow == 0) {
+            int msg_len = find_delimiter(*data,
+                    *len < MAX_MSG_LEN ? *len : MAX_MSG_LEN, 0);
+            if (msg_len > 0) {
+                sstp_parse(*data, msg_len, msg);
+                *data += msg_len;
+                *len -= msg_len;
+                return 1;
+            }
         }
 
-        // if buffer is completely filled up without a delimiter, then the
-        // message is too long
-        if (buffer_len == MAX_MSG_LEN) {
-            // so reset the buffer, but mark the message as having overflowed
-            overflow += buffer_len;
-            buffer_len = 0;
+        // otherwise move as much as fits into the buffer
+        compact(stream);
+        int n = IN_BUFFER_LEN - stream->end;
+        if (n > *len) {
+            n = *len;
         }
+        memcpy(stream->buffer + stream->end, *data, n);
+        stream->end += n;
 
-        // read in more data from the socket
-        read_n = recv(stream->sockfd, buffer + buffer_len, MAX_MSG_LEN - buffer_len, 0);
-        buffer_len += read_n;
+        *data += n;
+        *len -= n;
+    }
 
-        buffer[buffer_len] = '\0';
+    return 1;
+}
 
-        // stop if an error occurs
-        if (read_n <= 0) {
-            return read_n;
-        }
+int sstp_has_input(SSTPSocketWrapper *stream) {
+    if (stream->start < stream->end) {
+        return 1;
     }
 
-    // parse the read data into an SSTPMsg
-    sstp_parse(buffer, buffer_len + overflow, msg);
-
-    return 1; // success
+    // is the socket readable right now?
+    struct pollfd pfd = { stream->sockfd, POLLIN, 0 };
+    server_count_syscalls(1);
+    return 1 == poll(&pfd, 1, 0) && (pfd.revents & POLLIN);
 }
 
 int sstp_write(SSTPSocketWrapper *stream, SSTPMsgType type, char payload[]) {
@@ -126,11 +169,67 @@ int sstp_write(SSTPSocketWrapper *stream, SSTPMsgType type, char payload[]) {
     char buf[MAX_MSG_LEN+1];
     int len = sstp_build(&msg, buf);
 
-    return sendall(stream->sockfd, buf, &len);
+    pthread_mutex_lock(&stream->out_mutex);
+
+    if (stream->full) {
+        pthread_mutex_unlock(&stream->out_mutex);
+        return -1;
+    }
+
+    // make room if needed, cutting the client off if it isn't reading
+    if (stream->out_len + len > OUT_QUEUE_LEN) {
+        flush_out(stream);
+        if (stream->out_len + len > OUT_QUEUE_LEN) {
+            stream->full = 1;
+            shutdown(stream->sockfd, SHUT_RDWR);
+            pthread_mutex_unlock(&stream->out_mutex);
+            return SSTP_FULL;
+        }
+    }
+
+    // queue it, wrapping around the end of the ring
+    int tail = (stream->out_head + stream->out_len) % OUT_QUEUE_LEN;
+    int n = OUT_QUEUE_LEN - tail < len ? OUT_QUEUE_LEN - tail : len;
+    memcpy(stream->out + tail, buf, n);
+    memcpy(stream->out, buf + n, len - n);
+    stream->out_len += len;
+
+    int res = stream->corked ? 0 : flush_or_wake(stream);
+
+    pthread_mutex_unlock(&stream->out_mutex);
+
+    return res;
+}
+
+int sstp_flush(SSTPSocketWrapper *stream) {
+    pthread_mutex_lock(&stream->out_mutex);
+    int res = flush_out(stream);
+    pthread_mutex_unlock(&stream->out_mutex);
+
+    return res;
+}
+
+void sstp_cork(SSTPSocketWrapper *stream) {
+    pthread_mutex_lock(&stream->out_mutex);
+    stream->corked = 1;
+    pthread_mutex_unlock(&stream->out_mutex);
+}
+
+int sstp_uncork(SSTPSocketWrapper *stream) {
+    pthread_mutex_lock(&stream->out_mutex);
+    stream->corked = 0;
+    int res = flush_or_wake(stream);
+    pthread_mutex_unlock(&stream->out_mutex);
+
+    return res;
 }
 
 void sstp_destroy(SSTPSocketWrapper *stream) {
-    free(stream);
+    if (stream->wake_fd >= 0) {
+        close(stream->wake_fd);
+    }
+    pthread_mutex_destroy(&stream->out_mutex);
+    pool_free(&sstp_pool, stream);
 }
 
 
@@ -138,42 +237,245 @@ void sstp_destroy(SSTPSocketWrapper *stream) {
  */
 
 /*
- * Alternative to strstr that ignores \0 characters in the haystack and instead
- * scans upto n characters.
- * needle should still be a null-terminated string.
+ * Reads a single message, reading from the socket (with the given recv flags)
+ * until one is buffered.
+ * Returns the same as sstp_read, or SSTP_AGAIN if the socket is non-blocking
+ * (or MSG_DONTWAIT is given) and there isn't a whole message yet.
  */
-char *strnstr(char *haystack, char *needle, int n) {
-    char *p = haystack;
-    int needle_len = strlen(needle);
-    n -= needle_len - 1; // don't scan off the edge
+int read_msg(SSTPSocketWrapper *stream, SSTPMsg *msg, int flags) {
+    int read_n;
+
+    // read until hitting a delimiter
+    while (!next_msg(stream, msg)) {
+        // blocking reads still need to flush the queue in the meantime
+        if (!(flags & MSG_DONTWAIT) && 0 != wait_input(stream)) {
+            return -1;
+        }
 
-    while (p - haystack < n) {
-        if (0 == strncmp(p, needle, needle_len)) {
-            return p;
+        // a client that was cut off might never stop sending
+        if (cut_off(stream)) {
+            return 0;
+        }
+
+        // read in as much as fits from the socket
+        compact(stream);
+        read_n = recv(stream->sockfd, stream->buffer + stream->end,
+                IN_BUFFER_LEN - stream->end, flags);
+        server_count_syscalls(1);
+
+        // stop if an error occurs, or there's nothing more to read for now
+        if (read_n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return SSTP_AGAIN;
+        }
+        if (read_n <= 0) {
+            return read_n;
+        }
+
+        stream->end += read_n;
+    }
+
+    return 1; // success
+}
+
+/*
+ * Takes the next whole message out of the buffer, if there is one.
+ * Returns 1 and sets msg if there was, 0 if more data is needed.
+ */
+int next_msg(SSTPSocketWrapper *stream, SSTPMsg *msg) {
+    char *data = stream->buffer + stream->start;
+    int len = stream->end - stream->start;
+
+    int msg_len = find_delimiter(data, len, stream->scanned);
+    if (msg_len > 0) { // found it!
+        // parse it in place, counting whatever was thrown away of it
+        sstp_parse(data, msg_len + stream->overflow, msg);
+
+        // the rest is left for next call
+        stream->start += msg_len;
+        stream->scanned = 0;
+        stream->overflow = 0;
+        if (stream->start == stream->end) {
+            stream->start = stream->end = 0;
+        }
+
+        return 1;
+    }
+    stream->scanned = len;
+
+    // if a whole message's worth is buffered without a delimiter, then the
+    // message is too long
+    if (len >= MAX_MSG_LEN) {
+        // so throw it away, but mark the message as having overflowed
+        // (keeping a trailing \r, which could be the start of the delimiter)
+        int keep = data[len - 1] == '\r';
+        stream->overflow += len - keep;
+        stream->start = stream->end - keep;
+        stream->scanned = keep;
+    }
+
+    return 0;
+}
+
+/*
+ * Finds the first delimiter in the given data, starting from the given
+ * offset (everything before which is known to not have one).
+ * Returns the length of the message it ends (delimiter included), or 0 if
+ * there isn't one.
+ */
+int find_delimiter(char *data, int len, int from) {
+    char *p = data + from;
+    char *end = data + len;
+
+    // \n is rare, so look for it and check for the \r before it
+    while (p < end && NULL != (p = memchr(p, '\n', end - p))) {
+        if (p > data && p[-1] == '\r') {
+            return p + 1 - data;
         }
         p++;
     }
 
-    return NULL; // not found
+    return 0;
 }
 
 /*
- * Helper that makes sure that partial sends don't happen (if it can be helped).
- * source: https://beej.us/guide/bgnet/output/html/multipage/advanced.html#sendall
+ * Moves the unframed data to the front of the buffer, to make room to read
+ * into.
  */
-int sendall(int s, char *buf, int *len) {
-    int total = 0;        // how many bytes we've sent
-    int bytesleft = *len; // how many we have left to send
-    int n = 0;
+void compact(SSTPSocketWrapper *stream) {
+    if (stream->start == 0) {
+        return;
+    }
+
+    // never more than a message's worth, so this is cheap
+    stream->end -= stream->start;
+    memmove(stream->buffer, stream->buffer + stream->start, stream->end);
+    stream->start = 0;
+}
 
-    while (total < *len) {
-        n = send(s, buf+total, bytesleft, 0);
-        if (n == -1) { break; }
-        total += n;
-        bytesleft -= n;
+/*
+ * Waits until the socket has input, flushing the queue whenever the socket
+ * is writable, or a write leaves msgs queued.
+ * Returns 0 once there's input, -1 if an error occurs.
+ */
+int wait_input(SSTPSocketWrapper *stream) {
+    pthread_mutex_lock(&stream->out_mutex);
+    if (stream->wake_fd < 0) {
+        stream->wake_fd = eventfd(0, EFD_NONBLOCK);
+    }
+    pthread_mutex_unlock(&stream->out_mutex);
+    if (stream->wake_fd < 0) {
+        return -1;
     }
 
-    *len = total; // return number actually sent here
+    while (1) {
+        pthread_mutex_lock(&stream->out_mutex);
+        int queued = stream->out_len > 0 && !stream->corked;
+        pthread_mutex_unlock(&stream->out_mutex);
+
+        struct pollfd pfds[2] = {
+            { stream->sockfd, POLLIN | (queued ? POLLOUT : 0), 0 },
+            { stream->wake_fd, POLLIN, 0 }
+        };
+        server_count_syscalls(1);
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
 
-    return n == -1 ? -1 : 0; // return -1 on failure, 0 on success
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count;
+            server_count_syscalls(1);
+            if (read(stream->wake_fd, &count, sizeof(count))) {
+                // only there to clear it
+            }
+        }
+        if ((pfds[0].revents & POLLOUT) || (pfds[1].revents & POLLIN)) {
+            sstp_flush(stream);
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            return 0;
+        }
+    }
 }
+
+/*
+ * Returns true if the client was cut off for not reading.
+ */
+int cut_off(SSTPSocketWrapper *stream) {
+    pthread_mutex_lock(&stream->out_mutex);
+    int full = stream->full;
+    pthread_mutex_unlock(&stream->out_mutex);
+
+    return full;
+}
+
+/*
+ * Sends as much of the queue as the socket takes, without blocking.
+ * Note: must be called with out_mutex held.
+ * Returns 0 on success (even if some is left queued), -1 if an error occurs
+ * or the client was cut off.
+ */
+int flush_out(SSTPSocketWrapper *stream) {
+    if (stream->full) {
+        return -1;
+    }
+    if (stream->out_len == 0) {
+        return 0;
+    }
+
+    // the queue in (at most) two pieces, as it wraps around
+    int first = OUT_QUEUE_LEN - stream->out_head;
+    if (first > stream->out_len) {
+        first = stream->out_len;
+    }
+    struct iovec iov[2] = {
+        { stream->out + stream->out_head, first },
+        { stream->out, stream->out_len - first }
+    };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = stream->out_len > first ? 2 : 1;
+
+    ssize_t n = sendmsg(stream->sockfd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+    server_count_syscalls(1);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            n = 0; // the socket is full, so it waits for it to be writable
+        } else {
+            stream->out_len = 0;
+            return -1;
+        }
+    }
+
+    stream->out_head = (stream->out_head + n) % OUT_QUEUE_LEN;
+    stream->out_len -= n;
+    if (stream->out_len == 0) {
+        stream->out_head = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Flushes the queue, waking up a blocking reader to wait for the socket to be
+ * writable if it can't all be sent.
+ * Note: must be called with out_mutex held.
+ * Returns the same as flush_out.
+ */
+int flush_or_wake(SSTPSocketWrapper *stream) {
+    int res = flush_out(stream);
+
+    if (stream->out_len > 0 && stream->wake_fd >= 0) {
+        uint64_t one = 1;
+        server_count_syscalls(1);
+        if (write(stream->wake_fd, &one, sizeof(one))) {
+            // can only fail if it's already been woken up lots
+        }
+    }
+
+    return res;
+}
+
@@ -11,6 +11,9 @@
 
 #include "sstp.h"
 
+#define SSTP_AGAIN -2
+#define SSTP_FULL -3
+
 /*
  * The struct to store the state of the socket.
  * Internals are private.
@@ -31,14 +34,63 @@ SSTPSocketWrapper *sstp_init(int sockfd);
  */
 int sstp_read(SSTPSocketWrapper *stream, SSTPMsg *msg);
 
+/*
+ * Same as sstp_read, but never blocks waiting for the socket.
+ * Returns SSTP_AGAIN if there isn't a whole message yet, in which case the
+ * partial message is kept for the next call.
+ */
+int sstp_try_read(SSTPSocketWrapper *stream, SSTPMsg *msg);
+
+/*
+ * Frames data received some other way (eg. by io_uring), instead of reading
+ * from the socket.
+ * Moves data and len along past whatever was used up.
+ * Returns 1 and sets msg once there's a whole message, and SSTP_AGAIN once
+ * all of the data is used up without one (the partial message is kept for
+ * the next call).
+ */
+int sstp_feed(SSTPSocketWrapper *stream, char **data, int *len, SSTPMsg *msg);
+
+/*
+ * Returns true if there is more input waiting, either buffered or on the
+ * socket, ie. the client sent more along with the last message read.
+ */
+int sstp_has_input(SSTPSocketWrapper *stream);
+
 /*
  * Sends a single message of the given type and payload.
+ * It never waits for the client, whatever the socket doesn't take right away
+ * is queued, and sent by sstp_flush (or by sstp_read while it waits).
+ * If the client lets too much queue up, it is cut off (the socket is shut
+ * down, so reading from it finishes).
+ * Note: thread safe.
  * Returns
  *  0 on success
  * -1 if an error occurs
+ *  SSTP_FULL if the client has just been cut off (-1 after that)
  */
 int sstp_write(SSTPSocketWrapper *stream, SSTPMsgType type, char payload[]);
 
+/*
+ * Sends as much of the queued messages as the socket takes without waiting,
+ * eg. once it becomes writable.
+ * Returns 0 on success (even if some are still queued), -1 if an error
+ * occurs or the client was cut off.
+ */
+int sstp_flush(SSTPSocketWrapper *stream);
+
+/*
+ * Holds back the messages written from now on, so they can all be sent with
+ * a single syscall by sstp_uncork.
+ */
+void sstp_cork(SSTPSocketWrapper *stream);
+
+/*
+ * Sends off the messages held back since sstp_cork.
+ * Returns the same as sstp_write.
+ */
+int sstp_uncork(SSTPSocketWrapper *stream);
+
 /*
  * Destroys the given sstp stream.
  */
@@ -8,8 +8,16 @@
 
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "sstp.h"
 
+// a header as a single number, eg. to switch on
+#define HEADER(a, b, c, d) ((uint32_t) (a) << 24 | (uint32_t) (b) << 16 \
+        | (uint32_t) (c) << 8 | (uint32_t) (d))
+
 
 /***** Helper function prototypes
  */
@@ -17,6 +25,11 @@
 SSTPMsgType header_to_type(char *header);
 int type_to_payload_len(SSTPMsgType type);
 void copy_header(SSTPMsgType type, char *dst);
+int work_decode(char *src, SSTPWork *work, int has_worker_count);
+int hex_decode(char *src, int n, uint8_t *dst);
+int hex_decode16(char *src, uint8_t *dst);
+int hex_decode_scalar(char *src, int n, uint8_t *dst);
+uint64_t big_endian(uint8_t *bytes, int n);
 int min(int a, int b);
 
 
@@ -24,46 +37,42 @@ int min(int a, int b);
  */
 
 void sstp_parse(char *src, int len, SSTPMsg *msg) {
-    // start by clearing out the msg object
-    memset(msg, 0, sizeof(SSTPMsg));
+    msg->type = MALFORMED;
+    msg->payload_len = 0;
+    msg->payload[0] = '\0';
 
-    msg->type = header_to_type(src);
-    msg->payload_len = type_to_payload_len(msg->type);
+    // too short to have a header, or too long to be anything (which is
+    // checked first, as an overflowed message isn't all there)
+    if (len < HEADER_LEN + DELIMITER_LEN || len > MAX_MSG_LEN) {
+        return;
+    }
 
-    // verify payload
-    int is_malformed = 0;
+    SSTPMsgType type = header_to_type(src);
+    int payload_len = type_to_payload_len(type);
 
     // handle messages that are the wrong length
-    is_malformed = msg->payload_len == 0
+    int is_malformed = type == MALFORMED || (payload_len == 0
         // payload when there shouldn't be any
         ? (HEADER_LEN + DELIMITER_LEN) != len
         // if there is a payload it should be exactly the right length
-        : (HEADER_LEN + 1 + msg->payload_len + DELIMITER_LEN) != len;
-
-    // SOLN and WORK message should be properly delimited
-    src += HEADER_LEN + 1;
-    switch (msg->type) {
-        case WORK:
-            is_malformed = is_malformed || *(src + 8 + 1 + 64 + 1 + 16) != ' ';
-            // intentional fall-through
-        case SOLN:
-            is_malformed = is_malformed || *(src + 8 + 1 + 64) != ' ';
-            is_malformed = is_malformed || *(src + 8) != ' ';
-            break;
-        default:
-            break;
+        : (HEADER_LEN + 1 + payload_len + DELIMITER_LEN) != len);
+    if (is_malformed) {
+        return;
     }
 
-    if (is_malformed) {
-        msg->type = MALFORMED;
-        msg->payload_len = 0;
+    // SOLN and WORK message should be properly delimited hex numbers
+    src += HEADER_LEN + 1;
+    if ((type == WORK || type == SOLN)
+            && !work_decode(src, &msg->work, type == WORK)) {
         return;
     }
 
+    msg->type = type;
+    msg->payload_len = payload_len;
+
     // copy the payload (if any)
-    if (msg->payload_len != 0) {
-        memcpy(msg->payload, src, msg->payload_len);
-    }
+    memcpy(msg->payload, src, payload_len);
+    msg->payload[payload_len] = '\0';
 }
 
 int sstp_build(SSTPMsg *msg, char *dst) {
@@ -103,6 +112,23 @@ int sstp_build(SSTPMsg *msg, char *dst) {
 }
 
 
+void sstp_hex64(uint64_t value, char *dst) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 15; i >= 0; i--) {
+        dst[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+}
+
+void sstp_soln_payload(char *prefix, uint64_t solution, char *dst) {
+    memcpy(dst, prefix, WORK_PREFIX_LEN);
+    dst[WORK_PREFIX_LEN] = ' ';
+    sstp_hex64(solution, dst + WORK_PREFIX_LEN + 1);
+    dst[SOLN_PAYLOAD_LEN] = '\0';
+}
+
+
 /***** Helper functions
  */
 
@@ -111,22 +137,17 @@ int sstp_build(SSTPMsg *msg, char *dst) {
  * string.
  */
 SSTPMsgType header_to_type(char *header) {
-    if (0 == strncmp("PING", header, HEADER_LEN)) {
-        return PING;
-    } else if (0 == strncmp("PONG", header, HEADER_LEN)) {
-        return PONG;
-    } else if (0 == strncmp("OKAY", header, HEADER_LEN)) {
-        return OKAY;
-    } else if (0 == strncmp("ERRO", header, HEADER_LEN)) {
-        return ERRO;
-    } else if (0 == strncmp("SOLN", header, HEADER_LEN)) {
-        return SOLN;
-    } else if (0 == strncmp("WORK", header, HEADER_LEN)) {
-        return WORK;
-    } else if (0 == strncmp("ABRT", header, HEADER_LEN)) {
-        return ABRT;
-    } else {
-        return MALFORMED;
+    uint8_t *h = (uint8_t *) header;
+
+    switch (HEADER(h[0], h[1], h[2], h[3])) {
+        case HEADER('P', 'I', 'N', 'G'): return PING;
+        case HEADER('P', 'O', 'N', 'G'): return PONG;
+        case HEADER('O', 'K', 'A', 'Y'): return OKAY;
+        case HEADER('E', 'R', 'R', 'O'): return ERRO;
+        case HEADER('S', 'O', 'L', 'N'): return SOLN;
+        case HEADER('W', 'O', 'R', 'K'): return WORK;
+        case HEADER('A', 'B', 'R', 'T'): return ABRT;
+        default:                         return MALFORMED;
     }
 }
 
@@ -148,16 +169,129 @@ int type_to_payload_len(SSTPMsgType type) {
  * destination string.
  */
 void copy_header(SSTPMsgType type, char *dst) {
-    switch (type) {
-        case PING: strncpy(dst, "PING", HEADER_LEN); break;
-        case PONG: strncpy(dst, "PONG", HEADER_LEN); break;
-        case OKAY: strncpy(dst, "OKAY", HEADER_LEN); break;
-        case ERRO: strncpy(dst, "ERRO", HEADER_LEN); break;
-        case SOLN: strncpy(dst, "SOLN", HEADER_LEN); break;
-        case WORK: strncpy(dst, "WORK", HEADER_LEN); break;
-        case ABRT: strncpy(dst, "ABRT", HEADER_LEN); break;
-        case MALFORMED: break; // invalid so do nothing
+    static const char headers[][HEADER_LEN] = {
+        [PING] = "PING", [PONG] = "PONG",
+        [OKAY] = "OKAY", [ERRO] = "ERRO",
+        [SOLN] = "SOLN", [WORK] = "WORK", [ABRT] = "ABRT"
+    };
+
+    if (type != MALFORMED) { // invalid so do nothing
+        memcpy(dst, headers[type], HEADER_LEN);
+    }
+}
+
+/*
+ * Decodes the given WORK (or SOLN) payload, ie.
+ *   difficulty(8) seed(64) nonce(16) [worker count(2)]
+ * Returns 1 if it is properly delimited hex, and 0 otherwise.
+ */
+int work_decode(char *src, SSTPWork *work, int has_worker_count) {
+    uint8_t difficulty[4];
+    uint8_t nonce[8];
+
+    int ok = src[8] == ' ' && src[8 + 1 + 64] == ' '
+        && hex_decode(src, 8, difficulty)
+        && hex_decode(src + 8 + 1, 64, work->seed)
+        && hex_decode(src + 8 + 1 + 64 + 1, 16, nonce);
+
+    work->worker_count = 0;
+    if (has_worker_count) {
+        ok = ok && src[8 + 1 + 64 + 1 + 16] == ' '
+            && hex_decode(src + 8 + 1 + 64 + 1 + 16 + 1, 2,
+                    &work->worker_count);
+    }
+
+    work->difficulty = big_endian(difficulty, 4);
+    work->nonce = big_endian(nonce, 8);
+
+    return ok;
+}
+
+/*
+ * Decodes the given (even) number of hex digits (upper or lower case) into
+ * half as many bytes.
+ * Returns 1 if they were all hex, and 0 otherwise.
+ */
+int hex_decode(char *src, int n, uint8_t *dst) {
+    int ok = 1;
+
+    // as much as possible 16 at a time
+    for (; n >= 16; n -= 16, src += 16, dst += 8) {
+        ok &= hex_decode16(src, dst);
+    }
+
+    return hex_decode_scalar(src, n, dst) & ok;
+}
+
+/*
+ * Same as hex_decode, but a digit at a time (without branching).
+ */
+int hex_decode_scalar(char *src, int n, uint8_t *dst) {
+    uint8_t bad = 0;
+    for (int i = 0; i < n; i++) {
+        uint8_t c = src[i];
+        uint8_t digit = c - '0';
+        uint8_t letter = (c | 0x20) - 'a'; // lowercased
+        int is_digit = digit < 10;
+        int is_letter = letter < 6;
+
+        bad |= !(is_digit | is_letter);
+        uint8_t value = is_digit ? digit : letter + 10;
+
+        if (i % 2 == 0) {
+            dst[i / 2] = value << 4;
+        } else {
+            dst[i / 2] |= value;
+        }
+    }
+
+    return !bad;
+}
+
+/*
+ * Decodes exactly 16 hex digits into 8 bytes, all at once with SSE2.
+ * Returns 1 if they were all hex, and 0 otherwise.
+ */
+int hex_decode16(char *src, uint8_t *dst) {
+#ifdef __SSE2__
+    __m128i chars = _mm_loadu_si128((__m128i *) src);
+
+    // the value as a digit and as a (lowercased) letter, where anything out
+    // of range wraps around to a big (unsigned) number
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)),
+            _mm_set1_epi8('a'));
+    __m128i is_digit = _mm_cmpeq_epi8(
+            _mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_letter = _mm_cmpeq_epi8(
+            _mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+    __m128i value = _mm_or_si128(
+            _mm_and_si128(is_digit, digit),
+            _mm_and_si128(is_letter,
+                _mm_add_epi8(letter, _mm_set1_epi8(10))));
+
+    // each pair of digits is a 16 bit lane, the high digit in its low byte
+    __m128i pairs = _mm_or_si128(
+            _mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0xff)), 4),
+            _mm_srli_epi16(value, 8));
+    _mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(pairs, pairs));
+
+    return 0xffff == _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+#else
+    return hex_decode_scalar(src, 16, dst);
+#endif
+}
+
+/*
+ * Reads the given number of bytes as a big endian number.
+ */
+uint64_t big_endian(uint8_t *bytes, int n) {
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++) {
+        value = value << 8 | bytes[i];
     }
+    return value;
 }
 
 /*
@@ -9,11 +9,16 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #define HEADER_LEN 4
 
 #define ERRO_PAYLOAD_LEN 40
 #define SOLN_PAYLOAD_LEN 90 // 8 + 1 + 64 + 1 + 16
 #define WORK_PAYLOAD_LEN 93 // 8 + 1 + 64 + 1 + 16 + 1 + 2
+
+// the difficulty and seed at the start of a WORK (or SOLN) payload
+#define WORK_PREFIX_LEN 73 // 8 + 1 + 64
 #define MAX_PAYLOAD_LEN WORK_PAYLOAD_LEN
 
 #define DELIMITER "\r\n"
@@ -31,6 +36,17 @@ typedef enum {
     MALFORMED
 } SSTPMsgType;
 
+/*
+ * The decoded fields of a WORK or SOLN message.
+ * (a SOLN has no worker count, and its nonce is the solution)
+ */
+typedef struct {
+    uint32_t difficulty;
+    uint8_t seed[32];
+    uint64_t nonce;
+    uint8_t worker_count;
+} SSTPWork;
+
 /*
  * The struct that represents a message
  */
@@ -38,11 +54,14 @@ typedef struct {
     SSTPMsgType type;
     char payload[MAX_PAYLOAD_LEN + 1];
     int payload_len;
+    SSTPWork work; // only for WORK and SOLN messages
 } SSTPMsg;
 
 /*
  * Parses the given source string into the given SSTPMsg.
- * n is the length of src.
+ * n is the length of src, which needn't be null-terminated.
+ * WORK and SOLN messages are also decoded into msg->work, and are MALFORMED
+ * if any of their numbers aren't hex.
  */
 void sstp_parse(char *src, int n, SSTPMsg *msg);
 
@@ -55,3 +74,17 @@ void sstp_parse(char *src, int n, SSTPMsg *msg);
  * Returns the length of the final message or -1 if there is an error.
  */
 int sstp_build(SSTPMsg *msg, char *dst);
+
+/*
+ * Writes the given number as 16 lowercase hex digits (not null-terminated),
+ * eg. for the solution in a SOLN payload.
+ */
+void sstp_hex64(uint64_t value, char *dst);
+
+/*
+ * Writes the payload of the SOLN for a WORK, with the given solution, into
+ * dst (null-terminated), which must hold SOLN_PAYLOAD_LEN + 1.
+ * prefix is the WORK's difficulty and seed (its first WORK_PREFIX_LEN chars),
+ * which are echoed back as they were sent.
+ */
+void sstp_soln_payload(char *prefix, uint64_t solution, char *dst);
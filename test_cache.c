@@ -0,0 +1,213 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Checks the cache's LRU eviction, that cache_get refreshes an entry, that a
+ * duplicate cache_put keeps the first solution, and the hit and miss counts.
+ * Then checks it against a plain array kept in LRU order, over random gets
+ * and puts on more keys than fit (so entries are evicted out of shared hash
+ * buckets all the time).
+ *
+ * Usage: ./test_cache
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CAPACITY 4
+#define MODEL_CAPACITY 8
+#define MODEL_KEYS 24
+#define ROUNDS 100000
+
+
+/***** Helper function prototypes
+ */
+
+int check_eviction(void);
+int check_model(void);
+CacheKey make_key(int id);
+int expect_get(char *name, Cache *cache, int id, int found,
+        uint64_t solution);
+int expect_stats(char *name, Cache *cache, uint64_t hits, uint64_t misses);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    int failures = 0;
+
+    srand(30023);
+
+    failures += check_eviction();
+    failures += check_model();
+
+    printf("%s cache (%d rounds)\n", failures == 0 ? "PASS" : "FAIL", ROUNDS);
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Walks through filling the cache past capacity.
+ * Returns the number of failures.
+ */
+int check_eviction(void) {
+    Cache *cache = cache_init(CAPACITY);
+    int failures = 0;
+
+    for (int id = 0; id < CAPACITY; id++) {
+        CacheKey key = make_key(id);
+        cache_put(cache, &key, 100 + id);
+    }
+    failures += expect_stats("fill", cache, 0, 0);
+
+    // 0 is the oldest, until it's used
+    failures += expect_get("refresh", cache, 0, 1, 100);
+
+    // so 1 is evicted instead
+    CacheKey key = make_key(CAPACITY);
+    cache_put(cache, &key, 100 + CAPACITY);
+    failures += expect_get("evict", cache, 1, 0, 0);
+    failures += expect_get("evict", cache, 0, 1, 100);
+    failures += expect_get("evict", cache, 2, 1, 102);
+    failures += expect_get("evict", cache, 3, 1, 103);
+    failures += expect_get("evict", cache, CAPACITY, 1, 100 + CAPACITY);
+    failures += expect_stats("evict", cache, 5, 1);
+
+    // a duplicate keeps the first solution, and doesn't evict anything
+    key = make_key(2);
+    cache_put(cache, &key, 999);
+    failures += expect_get("duplicate", cache, 2, 1, 102);
+    failures += expect_get("duplicate", cache, 0, 1, 100);
+    failures += expect_get("duplicate", cache, 3, 1, 103);
+    failures += expect_get("duplicate", cache, CAPACITY, 1, 100 + CAPACITY);
+
+    // cycling through many more keys leaves only the last few
+    for (int id = 0; id < 64; id++) {
+        key = make_key(id);
+        cache_put(cache, &key, 100 + id);
+    }
+    for (int id = 0; id < 64; id++) {
+        int found = id >= 64 - CAPACITY;
+        failures += expect_get("cycle", cache, id, found, found ? 100 + id : 0);
+    }
+    failures += expect_stats("cycle", cache, 9 + CAPACITY, 1 + 64 - CAPACITY);
+
+    // an evicted key can be stored again
+    key = make_key(0);
+    cache_put(cache, &key, 7);
+    failures += expect_get("again", cache, 0, 1, 7);
+
+    cache_destroy(cache);
+    return failures;
+}
+
+/*
+ * Runs random gets and puts on both the cache and an array of key ids (most
+ * recently used first), which should agree on every get.
+ * Returns the number of failures.
+ */
+int check_model(void) {
+    Cache *cache = cache_init(MODEL_CAPACITY);
+    int model[MODEL_CAPACITY];
+    int model_len = 0;
+    uint64_t hits = 0, misses = 0;
+    int failures = 0;
+
+    for (int round = 0; round < ROUNDS && failures == 0; round++) {
+        int id = rand() % MODEL_KEYS;
+        CacheKey key = make_key(id);
+
+        int at = -1;
+        for (int i = 0; i < model_len; i++) {
+            if (model[i] == id) {
+                at = i;
+            }
+        }
+
+        if (rand() % 2) {
+            // a get refreshes the key, if it's there
+            failures += expect_get("model", cache, id, at >= 0, id * 1000);
+            if (at >= 0) {
+                memmove(model + 1, model, at * sizeof(int));
+                model[0] = id;
+                hits++;
+            } else {
+                misses++;
+            }
+        } else if (at < 0) {
+            // a new key goes in front, pushing the oldest out if full
+            cache_put(cache, &key, id * 1000);
+            if (model_len < MODEL_CAPACITY) {
+                model_len++;
+            }
+            memmove(model + 1, model, (model_len - 1) * sizeof(int));
+            model[0] = id;
+        } else {
+            // and a duplicate leaves everything as it is
+            cache_put(cache, &key, 1);
+        }
+    }
+    failures += expect_stats("model", cache, hits, misses);
+
+    cache_destroy(cache);
+    return failures;
+}
+
+/*
+ * A key that differs from every other id's in every field.
+ */
+CacheKey make_key(int id) {
+    CacheKey key;
+    key.difficulty = 0x1d00ffff + id;
+    for (int i = 0; i < 32; i++) {
+        key.seed[i] = id + i;
+    }
+    key.start = (uint64_t) id << 32;
+    return key;
+}
+
+/*
+ * Gets the given key, expecting it to be found (with the given solution) or
+ * not.
+ * Returns 0 if it matches and 1 otherwise.
+ */
+int expect_get(char *name, Cache *cache, int id, int found,
+        uint64_t solution) {
+    CacheKey key = make_key(id);
+    uint64_t got = 0;
+    int got_found = cache_get(cache, &key, &got);
+
+    if (got_found != found || (found && got != solution)) {
+        printf("FAIL %s (key %d): expected %s %lu, got %s %lu\n", name, id,
+                found ? "hit" : "miss", (unsigned long) solution,
+                got_found ? "hit" : "miss", (unsigned long) got);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Compares the cache's hit and miss counts against the expected ones.
+ * Returns 0 if they match and 1 otherwise.
+ */
+int expect_stats(char *name, Cache *cache, uint64_t hits, uint64_t misses) {
+    uint64_t got_hits, got_misses;
+    cache_stats(cache, &got_hits, &got_misses);
+
+    if (got_hits != hits || got_misses != misses) {
+        printf("FAIL %s: expected %lu hits and %lu misses, got %lu and %lu\n",
+                name, (unsigned long) hits, (unsigned long) misses,
+                (unsigned long) got_hits, (unsigned long) got_misses);
+        return 1;
+    }
+    return 0;
+}
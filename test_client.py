@@ -6,6 +6,7 @@ import time
 
 RECV_TIMEOUT = 10 # seconds
 BUFFER_SIZE = 1024
+ABRT_LATENCY = 0.25 # seconds, from ABRT to the next job being solved
 
 sstp_msg_lengths = {
     b'ERRO': 40,
@@ -62,6 +63,33 @@ if pytest.config.getoption('--digitalis'):
 elif pytest.config.getoption('--digitalis2'):
     addr = 'digitalis2.eng.unimelb.edu.au'
     recv_sleep = 1
+metrics_port = pytest.config.getoption('--metrics-port')
+
+def metric(name):
+    # scrape the server's metrics for the given (unlabelled) one
+    samples = metric_samples(name)
+    if '' not in samples:
+        raise RuntimeError('No metric ' + name)
+    return samples['']
+
+def metric_samples(name):
+    # scrape the server's metrics for every sample of the given one, by their
+    # labels ('' for none)
+    conn = socketlib.create_connection((addr, metrics_port), RECV_TIMEOUT)
+    conn.sendall(b'GET /metrics HTTP/1.0\r\n\r\n')
+    data = b''
+    while True:
+        chunk = conn.recv(65536)
+        if len(chunk) == 0:
+            break
+        data += chunk
+    conn.close()
+    samples = {}
+    for line in data.decode().split('\n'):
+        if line.startswith(name + ' ') or line.startswith(name + '{'):
+            labels, value = line[len(name):].rsplit(' ', 1)
+            samples[labels.strip('{} ')] = float(value)
+    return samples
 
 @pytest.fixture
 def socket():
@@ -184,6 +212,16 @@ def test_work_3(socket):
     socket.send(soln)
     assert socket.recv() == b'OKAY\r\n'
 
+def test_work_uppercase(socket):
+    # the difficulty and seed are echoed back as sent, both when solved and
+    # when cached
+    for _ in range(2):
+        socket.send(b'WORK 1EFFFFFF 0000000019D6689C085AE165831E934FF763AE46A218A6C172B3F1B60A8CE26F 1000000023212ABC 01\r\n')
+        soln = socket.recv()
+        assert soln.startswith(b'SOLN 1EFFFFFF 0000000019D6689C085AE165831E934FF763AE46A218A6C172B3F1B60A8CE26F ')
+        socket.send(soln)
+        assert socket.recv() == b'OKAY\r\n'
+
 @pytest.mark.skip
 def test_work_4(socket):
     socket.send(b'WORK 1dffffff 0000000019d6689c085ae165831e934ff763ae46a218a6c172b3f1b60a8ce26f 1000000023212399 01\r\n')
@@ -237,3 +275,76 @@ def test_abrt_msg(socket):
     assert soln.startswith(b'SOLN 1fffffff 0000000019d6689c085ae165831e934ff763ae46a218a6c172b3f1b60a8ce26f')
     socket.send(soln)
     assert socket.recv() == b'OKAY\r\n'
+
+def test_abrt_latency(socket):
+    # a job that would hold every solver thread for a long time
+    socket.send(b'WORK 1d29ffff 00000000a6ea0e5cd2c5bbf1ee1e10fd8af2dcb5bd5b3a8d17bc5e4d16fa8bd2 1000000023212399 ff\r\n')
+    time.sleep(0.5)
+
+    # once it's aborted, the threads should be free for the next job straight
+    # away, rather than after the search gets around to noticing
+    start = time.time()
+    socket.send(b'ABRT\r\n')
+    socket.send(b'WORK 1fffffff 00000000a6ea0e5cd2c5bbf1ee1e10fd8af2dcb5bd5b3a8d17bc5e4d16fa8bd2 1000000023212000 01\r\n')
+    reply = b''
+    while b'SOLN' not in reply or not reply.endswith(b'\r\n'):
+        reply += socket.socket.recv(BUFFER_SIZE)
+    latency = time.time() - start
+
+    assert reply.startswith(b'OKAY\r\n')
+    soln = reply.replace(b'OKAY\r\n', b'')
+    assert soln.startswith(b'SOLN 1fffffff 00000000a6ea0e5cd2c5bbf1ee1e10fd8af2dcb5bd5b3a8d17bc5e4d16fa8bd2')
+    assert latency < ABRT_LATENCY
+    socket.send(soln)
+    assert socket.recv() == b'OKAY\r\n'
+
+def test_client_queue_depths(socket):
+    if metrics_port is None:
+        pytest.skip('needs the metrics port, see --metrics-port')
+
+    other = Socket(socketlib.create_connection((addr, port)))
+    try:
+        # jobs that would each hold every solver thread for a long time, the
+        # first of which is searched while the rest wait
+        work = b'WORK 1d29ffff 00000000a6ea0e5cd2c5bbf1ee1e10fd8af2dcb5bd5b3a8d17bc5e4d16fa8bd2 %016x ff\r\n'
+        socket.send(work % 1 + work % 2 + work % 3)
+        time.sleep(0.2)
+        other.send(work % 4)
+        time.sleep(0.2)
+
+        depths = metric_samples('server_client_jobs_pending')
+        assert sorted(depths.values()) == [1, 2]
+        assert all(labels.startswith('client="') for labels in depths)
+        assert metric('server_jobs_pending') == 3
+    finally:
+        other.send(b'ABRT\r\n')
+        other.socket.close()
+        socket.send(b'ABRT\r\n')
+        assert socket.recv() == b'OKAY\r\n'
+
+def test_steady_state_allocations(socket):
+    if metrics_port is None:
+        pytest.skip('needs the metrics port, see --metrics-port')
+
+    def exchange(nonces):
+        # PINGs and WORKs (that are solved straight away) pipelined together
+        msg = b'PING\r\n' * 100
+        for nonce in nonces:
+            msg += b'WORK 1fffffff 0000000019d6689c085ae165831e934ff763ae46a218a6c172b3f1b60a8ce26f %016x 01\r\n' % nonce
+        socket.send(msg)
+        reply = b''
+        while reply.count(b'\r\n') < 100 + len(nonces):
+            reply += socket.socket.recv(BUFFER_SIZE)
+        assert reply.count(b'PONG\r\n') == 100
+        assert reply.count(b'SOLN ') == len(nonces)
+
+    # warm the pools up, both solving and replying from the cache, after
+    # which it's all recycled
+    for i in range(3):
+        exchange(range(1000 * i, 1000 * i + 300)) # solved
+        exchange(range(1000 * i, 1000 * i + 300)) # cached
+    before = metric('server_heap_allocations_total')
+
+    exchange(range(10000, 10100)) # solved
+    exchange(range(10000, 10100)) # cached
+    assert metric('server_heap_allocations_total') == before
@@ -0,0 +1,103 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Checks every search kernel the cpu supports against hashcash_verify.
+ *
+ * Usage: ./test_hashcash
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "hashcash.h"
+
+#define DIFFICULTY 0x2000ffff // easy enough to get plenty of solutions
+#define RANGE 5000
+
+char *kernels[] = { "scalar", "sse4", "avx2", "avx512" };
+
+
+/***** Helper function prototypes
+ */
+
+int check_range(HashcashSearch *search, BYTE *target, BYTE *seed,
+        uint64_t start, uint64_t count);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    BYTE seed[32];
+    BYTE target[32];
+    HashcashSearch search;
+    int failures = 0;
+
+    srand(30023);
+    for (int i = 0; i < 32; i++) {
+        seed[i] = rand() & 0xff;
+    }
+    hashcash_calc_target(target, DIFFICULTY);
+    hashcash_search_init(&search, target, seed);
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (0 != hashcash_kernel_select(kernels[i])) {
+            printf("SKIP %s (not supported)\n", kernels[i]);
+            continue;
+        }
+
+        // a range in the middle and one that runs off the end of the
+        // nonce space
+        int ok = check_range(&search, target, seed, 0x1000000023212399, RANGE)
+            && check_range(&search, target, seed, UINT64_MAX - RANGE + 7, RANGE - 7);
+
+        printf("%s %s\n", ok ? "PASS" : "FAIL", kernels[i]);
+        failures += !ok;
+    }
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Finds every solution in the given range with hashcash_search, and makes sure
+ * they are exactly the ones hashcash_verify accepts.
+ * Returns 1 if they match and 0 otherwise.
+ */
+int check_range(HashcashSearch *search, BYTE *target, BYTE *seed,
+        uint64_t start, uint64_t count) {
+    uint64_t solution;
+    uint64_t nonce = start;
+    uint64_t end = start + count;
+
+    while (nonce != end) {
+        if (!hashcash_search(search, nonce, end - nonce, &solution)) {
+            solution = end;
+        }
+
+        // every nonce before the solution must be invalid
+        for (; nonce != solution; nonce++) {
+            if (hashcash_verify(target, seed, nonce)) {
+                printf("missed solution %016" PRIx64 "\n", nonce);
+                return 0;
+            }
+        }
+
+        if (solution == end) {
+            break;
+        }
+        if (!hashcash_verify(target, seed, solution)) {
+            printf("bad solution %016" PRIx64 "\n", solution);
+            return 0;
+        }
+        nonce = solution + 1;
+    }
+
+    return 1;
+}
@@ -0,0 +1,344 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Checks the lock-free queue: FIFO order over many laps of the ring (so the
+ * positions wrap around the mask), try_enqueue and try_dequeue on a full and
+ * an empty queue, that enqueue blocks until the queue has drained to half
+ * full and dequeue until there is something on it, and that with several
+ * producers and consumers on a small ring every element comes out exactly
+ * once, in order per producer.
+ *
+ * Usage: ./test_queue
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+#define CAPACITY 4
+#define LAPS 1000
+
+// how long a blocked thread is given to (wrongly) get through
+#define BLOCK_MS 50
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define PER_PRODUCER 200000
+#define MPMC_CAPACITY 8
+
+// a deadlock fails the test (by SIGALRM) rather than hanging it
+#define TIMEOUT_S 60
+
+
+/***** Private structs
+ */
+
+/*
+ * A thread that blocks on the queue, and whether it has got through yet.
+ */
+typedef struct {
+    Queue *queue;
+    void *data;
+    _Atomic int done;
+} Blocker;
+
+/*
+ * What a single consumer saw, with the last element it got from each
+ * producer.
+ */
+typedef struct {
+    Queue *queue;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t last[PRODUCERS];
+    int out_of_order;
+} Consumer;
+
+// how many times each element was dequeued, by producer
+_Atomic unsigned char seen[PRODUCERS][PER_PRODUCER];
+
+
+/***** Helper function prototypes
+ */
+
+int check_laps(void);
+int check_blocking(void);
+int check_mpmc(void);
+void *blocked_enqueue(void *pblocker);
+void *blocked_dequeue(void *pblocker);
+void *produce(void *pqueue_id);
+void *consume(void *pconsumer);
+void sleep_ms(int ms);
+void *element(int producer, uint64_t i);
+int expect(char *name, int ok);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    int failures = 0;
+
+    alarm(TIMEOUT_S);
+
+    failures += check_laps();
+    failures += check_blocking();
+    failures += check_mpmc();
+
+    printf("%s queue\n", failures == 0 ? "PASS" : "FAIL");
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Fills and empties the queue lap after lap, half a lap out of step every
+ * other time, so the positions go around the ring (and the mask) many times.
+ * Returns the number of failures.
+ */
+int check_laps(void) {
+    Queue *queue = queue_init(CAPACITY - 1); // rounded up to CAPACITY
+    uint64_t next_in = 1, next_out = 1;
+    void *data;
+    int failures = 0;
+
+    failures += expect("empty", !queue_try_dequeue(queue, &data));
+
+    for (int lap = 0; lap < LAPS && failures == 0; lap++) {
+        for (int i = 0; i < CAPACITY; i++) {
+            failures += expect("fill", queue_try_enqueue(queue,
+                        (void *) (uintptr_t) next_in++));
+        }
+        failures += expect("full", !queue_try_enqueue(queue, (void *) 1));
+
+        int n = lap % 2 ? CAPACITY / 2 : CAPACITY;
+        for (int i = 0; i < n; i++) {
+            failures += expect("fifo", queue_try_dequeue(queue, &data)
+                    && (uintptr_t) data == next_out++);
+        }
+
+        // top it back up, then drain it
+        while (queue_try_enqueue(queue, (void *) (uintptr_t) next_in)) {
+            next_in++;
+        }
+        while (queue_try_dequeue(queue, &data)) {
+            failures += expect("wrap", (uintptr_t) data == next_out++);
+        }
+        failures += expect("drained", next_in == next_out);
+    }
+
+    queue_destroy(queue);
+    return failures;
+}
+
+/*
+ * Enqueues onto a full queue and dequeues from an empty one, on other
+ * threads, which shouldn't get through until the main thread makes room (or
+ * enqueues something).
+ * Returns the number of failures.
+ */
+int check_blocking(void) {
+    Queue *queue = queue_init(CAPACITY);
+    Blocker blocker = { queue, (void *) 99, 0 };
+    pthread_t tid;
+    void *data;
+    int failures = 0;
+
+    for (uintptr_t i = 1; i <= CAPACITY; i++) {
+        queue_enqueue(queue, (void *) i);
+    }
+    pthread_create(&tid, NULL, blocked_enqueue, &blocker);
+    sleep_ms(BLOCK_MS);
+    failures += expect("blocks when full", !atomic_load(&blocker.done));
+
+    // it's woken once the queue has drained to half full
+    for (uintptr_t i = 1; i < CAPACITY / 2; i++) {
+        data = queue_dequeue(queue);
+        failures += expect("blocked fifo", data == (void *) i);
+    }
+    sleep_ms(BLOCK_MS);
+    failures += expect("blocks until half full", !atomic_load(&blocker.done));
+
+    data = queue_dequeue(queue);
+    pthread_join(tid, NULL);
+    failures += expect("unblocks when half full", atomic_load(&blocker.done)
+            && data == (void *) (CAPACITY / 2));
+    for (uintptr_t i = CAPACITY / 2 + 1; i <= CAPACITY; i++) {
+        failures += expect("blocked fifo", queue_dequeue(queue) == (void *) i);
+    }
+    failures += expect("blocked fifo", queue_dequeue(queue) == (void *) 99);
+
+    // now empty
+    atomic_store(&blocker.done, 0);
+    blocker.data = NULL;
+    pthread_create(&tid, NULL, blocked_dequeue, &blocker);
+    sleep_ms(BLOCK_MS);
+    failures += expect("blocks when empty", !atomic_load(&blocker.done));
+
+    queue_enqueue(queue, (void *) 42);
+    pthread_join(tid, NULL);
+    failures += expect("unblocks when not empty", atomic_load(&blocker.done)
+            && blocker.data == (void *) 42);
+
+    queue_destroy(queue);
+    return failures;
+}
+
+/*
+ * Runs several producers and consumers through a small ring at once, then
+ * checks the counts, checksums and that nothing was dequeued twice (or out
+ * of order for its producer).
+ * Returns the number of failures.
+ */
+int check_mpmc(void) {
+    Queue *queue = queue_init(MPMC_CAPACITY);
+    pthread_t producers[PRODUCERS];
+    pthread_t consumers[CONSUMERS];
+    Consumer results[CONSUMERS];
+    int failures = 0;
+
+    // each producer gets the queue and its id
+    void *args[PRODUCERS][2];
+    for (int p = 0; p < PRODUCERS; p++) {
+        args[p][0] = queue;
+        args[p][1] = (void *) (uintptr_t) p;
+        pthread_create(producers + p, NULL, produce, args[p]);
+    }
+    for (int c = 0; c < CONSUMERS; c++) {
+        results[c] = (Consumer) { queue, 0, 0, { 0 }, 0 };
+        pthread_create(consumers + c, NULL, consume, results + c);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(producers[p], NULL);
+    }
+    // then tell each consumer to stop
+    for (int c = 0; c < CONSUMERS; c++) {
+        queue_enqueue(queue, NULL);
+    }
+    for (int c = 0; c < CONSUMERS; c++) {
+        pthread_join(consumers[c], NULL);
+    }
+
+    uint64_t count = 0, sum = 0, expected_sum = 0;
+    for (int c = 0; c < CONSUMERS; c++) {
+        count += results[c].count;
+        sum += results[c].sum;
+        failures += expect("producer order", !results[c].out_of_order);
+    }
+    for (int p = 0; p < PRODUCERS; p++) {
+        for (uint64_t i = 0; i < PER_PRODUCER; i++) {
+            expected_sum += (uintptr_t) element(p, i);
+            if (seen[p][i] != 1) {
+                printf("FAIL mpmc: element %d/%lu dequeued %d times\n", p,
+                        (unsigned long) i, seen[p][i]);
+                return failures + 1;
+            }
+        }
+    }
+    failures += expect("count", count == (uint64_t) PRODUCERS * PER_PRODUCER);
+    failures += expect("checksum", sum == expected_sum);
+
+    void *data;
+    failures += expect("empty after", !queue_try_dequeue(queue, &data));
+
+    queue_destroy(queue);
+    return failures;
+}
+
+/*
+ * Enqueues the blocker's data, flagging once it has.
+ */
+void *blocked_enqueue(void *pblocker) {
+    Blocker *blocker = (Blocker *) pblocker;
+    queue_enqueue(blocker->queue, blocker->data);
+    atomic_store(&blocker->done, 1);
+    return NULL;
+}
+
+/*
+ * Dequeues into the blocker's data, flagging once it has.
+ */
+void *blocked_dequeue(void *pblocker) {
+    Blocker *blocker = (Blocker *) pblocker;
+    blocker->data = queue_dequeue(blocker->queue);
+    atomic_store(&blocker->done, 1);
+    return NULL;
+}
+
+/*
+ * Enqueues every element of the given producer, in order.
+ */
+void *produce(void *pqueue_id) {
+    Queue *queue = ((void **) pqueue_id)[0];
+    int producer = (uintptr_t) ((void **) pqueue_id)[1];
+
+    for (uint64_t i = 0; i < PER_PRODUCER; i++) {
+        queue_enqueue(queue, element(producer, i));
+    }
+    return NULL;
+}
+
+/*
+ * Dequeues until a NULL, recording what it got.
+ */
+void *consume(void *pconsumer) {
+    Consumer *consumer = (Consumer *) pconsumer;
+    void *data;
+
+    while (NULL != (data = queue_dequeue(consumer->queue))) {
+        uintptr_t value = (uintptr_t) data;
+        int producer = value >> 32;
+        uint64_t i = (value & 0xffffffff) - 1;
+
+        // a consumer sees each producer's elements in the order enqueued
+        if (value <= consumer->last[producer]) {
+            consumer->out_of_order = 1;
+        }
+        consumer->last[producer] = value;
+
+        atomic_fetch_add(&seen[producer][i], 1);
+        consumer->count++;
+        consumer->sum += value;
+    }
+    return NULL;
+}
+
+/*
+ * Sleeps for the given number of milliseconds.
+ */
+void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * The i-th element of the given producer, never NULL.
+ */
+void *element(int producer, uint64_t i) {
+    return (void *) (((uintptr_t) producer << 32) | (i + 1));
+}
+
+/*
+ * Prints a failure if the check didn't hold.
+ * Returns 0 if it held and 1 otherwise.
+ */
+int expect(char *name, int ok) {
+    if (!ok) {
+        printf("FAIL %s\n", name);
+    }
+    return !ok;
+}
@@ -0,0 +1,195 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Checks the order each scheduling policy hands jobs out in, and that a job
+ * too wide to fit is only passed over max_bypass times.
+ *
+ * Jobs are named by their client and position, eg. "a2" is client a's second
+ * job, and each check pops jobs off and compares their names against the
+ * expected order (where NULL expects nothing to be handed out).
+ *
+ * Usage: ./test_scheduler
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "scheduler.h"
+
+#define MAX_BYPASS 2
+
+// client ids
+#define A 1
+#define B 2
+#define C 3
+
+
+/***** Helper function prototypes
+ */
+
+int check_round_robin(void);
+int check_fair_share(void);
+int check_shortest_first(void);
+int check_max_bypass(void);
+int expect_order(char *name, Scheduler *sched, int threads, char **order,
+        int len);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    int failures = 0;
+
+    failures += check_round_robin();
+    failures += check_fair_share();
+    failures += check_shortest_first();
+    failures += check_max_bypass();
+
+    printf("%s scheduler\n", failures == 0 ? "PASS" : "FAIL");
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Each client with queued jobs takes a turn, in the order they joined.
+ * Returns the number of failures.
+ */
+int check_round_robin(void) {
+    Scheduler *sched = scheduler_init(ROUND_ROBIN, MAX_BYPASS);
+    int failures = 0;
+
+    scheduler_push(sched, A, "a1", 1, 1);
+    scheduler_push(sched, A, "a2", 1, 1);
+    scheduler_push(sched, A, "a3", 1, 1);
+    scheduler_push(sched, B, "b1", 1, 1);
+    scheduler_push(sched, B, "b2", 1, 1);
+    failures += scheduler_depth(sched, A) != 3;
+    failures += scheduler_push(sched, C, "c1", 1, 1) != 1;
+
+    char *order[] = { "a1", "b1", "c1", "a2", "b2", "a3", NULL };
+    failures += expect_order("rr", sched, 1, order, 7);
+
+    scheduler_destroy(sched);
+    return failures;
+}
+
+/*
+ * Jobs go by virtual finish time, so clients get equal shares of the hashing,
+ * and a client that was idle can't catch up on the share it missed.
+ * Returns the number of failures.
+ */
+int check_fair_share(void) {
+    Scheduler *sched = scheduler_init(FAIR_SHARE, MAX_BYPASS);
+    int failures = 0;
+
+    // one expensive job doesn't get ahead of several cheap ones
+    scheduler_push(sched, A, "a1", 1, 100);
+    scheduler_push(sched, B, "b1", 1, 10);
+    scheduler_push(sched, B, "b2", 1, 10);
+    scheduler_push(sched, B, "b3", 1, 10);
+    char *order[] = { "b1", "b2", "b3", "a1", NULL };
+    failures += expect_order("wfq/cost", sched, 1, order, 5);
+    scheduler_destroy(sched);
+
+    // finish times 10, 20 and 30
+    sched = scheduler_init(FAIR_SHARE, MAX_BYPASS);
+    scheduler_push(sched, A, "a1", 1, 10);
+    scheduler_push(sched, A, "a2", 1, 10);
+    scheduler_push(sched, A, "a3", 1, 10);
+    char *order_a[] = { "a1", "a2" };
+    failures += expect_order("wfq/idle", sched, 1, order_a, 2);
+
+    // b was idle until now, so its jobs start at the virtual time (10),
+    // finishing at 20, 30 and 40, and it only gets ahead of a3 once
+    scheduler_push(sched, B, "b1", 1, 10);
+    scheduler_push(sched, B, "b2", 1, 10);
+    scheduler_push(sched, B, "b3", 1, 10);
+    char *order_b[] = { "b1", "a3", "b2", "b3", NULL };
+    failures += expect_order("wfq/idle", sched, 1, order_b, 5);
+
+    scheduler_destroy(sched);
+    return failures;
+}
+
+/*
+ * The cheapest job goes first, from any client and anywhere in its queue,
+ * with ties going to the oldest.
+ * Returns the number of failures.
+ */
+int check_shortest_first(void) {
+    Scheduler *sched = scheduler_init(SHORTEST_FIRST, MAX_BYPASS);
+    int failures = 0;
+
+    scheduler_push(sched, A, "a1", 1, 50);
+    scheduler_push(sched, B, "b1", 1, 10);
+    scheduler_push(sched, A, "a2", 1, 30);
+    scheduler_push(sched, C, "c1", 1, 10);
+    scheduler_push(sched, C, "c2", 1, 20);
+
+    char *order[] = { "b1", "c1", "c2", "a2", "a1", NULL };
+    failures += expect_order("sewf", sched, 1, order, 6);
+
+    scheduler_destroy(sched);
+    return failures;
+}
+
+/*
+ * A job that doesn't fit is passed over for ones that do max_bypass times,
+ * then everything is held back until it fits.
+ * Returns the number of failures.
+ */
+int check_max_bypass(void) {
+    Scheduler *sched = scheduler_init(OLDEST_FIRST, MAX_BYPASS);
+    int failures = 0;
+
+    scheduler_push(sched, A, "wide", 4, 1);
+    scheduler_push(sched, B, "n1", 1, 1);
+    scheduler_push(sched, B, "n2", 1, 1);
+    scheduler_push(sched, C, "n3", 2, 1);
+    scheduler_push(sched, C, "n4", 3, 1);
+
+    // n3 would fit too, but is held back once wide has been passed over
+    // twice
+    char *order[] = { "n1", "n2", NULL, NULL };
+    failures += expect_order("bypass", sched, 2, order, 4);
+
+    char *order_wide[] = { "wide", "n3" };
+    failures += expect_order("bypass/fits", sched, 4, order_wide, 2);
+
+    // n4 never fits in 2 threads
+    char *order_rest[] = { NULL, NULL };
+    failures += expect_order("bypass/rest", sched, 2, order_rest, 2);
+    char *order_last[] = { "n4", NULL };
+    failures += expect_order("bypass/last", sched, 3, order_last, 2);
+
+    scheduler_destroy(sched);
+    return failures;
+}
+
+/*
+ * Pops len jobs, with at most the given number of threads each, and compares
+ * them against the expected order.
+ * Returns the number of failures.
+ */
+int expect_order(char *name, Scheduler *sched, int threads, char **order,
+        int len) {
+    for (int i = 0; i < len; i++) {
+        char *job = (char *) scheduler_pop(sched, threads);
+        if (job != order[i] && (job == NULL || order[i] == NULL
+                    || 0 != strcmp(job, order[i]))) {
+            printf("FAIL %s (job %d): expected %s, got %s\n", name, i,
+                    order[i] == NULL ? "nothing" : order[i],
+                    job == NULL ? "nothing" : job);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Checks sstp_parse (and its hex decoding) against sscanf, and sstp_build and
+ * sstp_hex64 against snprintf, on random messages. Also that
+ * sstp_soln_payload gives back the SOLN payloads it parsed.
+ *
+ * Usage: ./test_sstp
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sstp.h"
+
+#define ROUNDS 100000
+
+char *hex_digits = "0123456789abcdefABCDEF";
+
+
+/***** Helper function prototypes
+ */
+
+int check_headers(void);
+int check_work(int round);
+int check_build(int round);
+void random_work(char *dst, int worker_count);
+int expect(char *name, int round, int ok);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    int failures = 0;
+
+    srand(30023);
+
+    failures += check_headers();
+    for (int round = 0; round < ROUNDS; round++) {
+        failures += check_work(round);
+        failures += check_build(round);
+    }
+
+    printf("%s sstp (%d rounds)\n", failures == 0 ? "PASS" : "FAIL", ROUNDS);
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Makes sure every header parses, and that wrong lengths don't.
+ * Returns the number of failures.
+ */
+int check_headers(void) {
+    char *headers[] = { "PING", "PONG", "OKAY", "ABRT" };
+    SSTPMsgType types[] = { PING, PONG, OKAY, ABRT };
+    SSTPMsg msg;
+    char buf[MAX_MSG_LEN + 1];
+    int failures = 0;
+
+    for (int i = 0; i < 4; i++) {
+        snprintf(buf, sizeof(buf), "%s\r\n", headers[i]);
+        sstp_parse(buf, 6, &msg);
+        failures += expect(headers[i], 0, msg.type == types[i]);
+
+        // with a payload it shouldn't have
+        snprintf(buf, sizeof(buf), "%s x\r\n", headers[i]);
+        sstp_parse(buf, 8, &msg);
+        failures += expect(headers[i], 1, msg.type == MALFORMED);
+    }
+
+    sstp_parse("ERRO", 4, &msg);
+    failures += expect("short", 0, msg.type == MALFORMED);
+    sstp_parse("\r\n", 2, &msg);
+    failures += expect("short", 1, msg.type == MALFORMED);
+    sstp_parse("PINK\r\n", 6, &msg);
+    failures += expect("unknown", 0, msg.type == MALFORMED);
+
+    // an overflowed message, only the end of which is still there
+    sstp_parse("PING\r\n", 6 + MAX_MSG_LEN, &msg);
+    failures += expect("overflow", 0, msg.type == MALFORMED);
+
+    memset(buf, '\0', sizeof(buf));
+    memcpy(buf, "ERRO reserved", 13);
+    memcpy(buf + HEADER_LEN + 1 + ERRO_PAYLOAD_LEN, "\r\n", 2);
+    sstp_parse(buf, HEADER_LEN + 1 + ERRO_PAYLOAD_LEN + 2, &msg);
+    failures += expect("ERRO", 0, msg.type == ERRO
+            && 0 == strcmp(msg.payload, "reserved"));
+
+    return failures;
+}
+
+/*
+ * Parses a random WORK and SOLN msg, and the same with a non-hex digit in a
+ * random spot.
+ * Returns the number of failures.
+ */
+int check_work(int round) {
+    char buf[MAX_MSG_LEN + 1];
+    SSTPMsg msg;
+    int failures = 0;
+
+    for (int is_work = 0; is_work < 2; is_work++) {
+        char *header = is_work ? "WORK " : "SOLN ";
+        int payload_len = is_work ? WORK_PAYLOAD_LEN : SOLN_PAYLOAD_LEN;
+        int len = HEADER_LEN + 1 + payload_len + DELIMITER_LEN;
+
+        memcpy(buf, header, HEADER_LEN + 1);
+        random_work(buf + HEADER_LEN + 1, is_work);
+        memcpy(buf + len - DELIMITER_LEN, "\r\n", DELIMITER_LEN);
+        buf[len] = '\0';
+
+        // what it should parse to
+        char *payload = buf + HEADER_LEN + 1;
+        uint32_t difficulty;
+        uint64_t nonce;
+        unsigned worker_count = 0;
+        uint8_t seed[32];
+        sscanf(payload, "%" SCNx32, &difficulty);
+        for (int i = 0; i < 32; i++) {
+            unsigned byte;
+            sscanf(payload + 8 + 1 + 2 * i, "%2x", &byte);
+            seed[i] = byte;
+        }
+        sscanf(payload + 8 + 1 + 64 + 1, "%16" SCNx64, &nonce);
+        if (is_work) {
+            sscanf(payload + 8 + 1 + 64 + 1 + 16 + 1, "%2x", &worker_count);
+        }
+
+        sstp_parse(buf, len, &msg);
+        failures += expect(header, round, msg.type == (is_work ? WORK : SOLN)
+                && msg.work.difficulty == difficulty
+                && 0 == memcmp(msg.work.seed, seed, 32)
+                && msg.work.nonce == nonce
+                && msg.work.worker_count == worker_count
+                && 0 == memcmp(msg.payload, payload, payload_len));
+
+        // break one of the digits (skipping over the spaces)
+        int spot = rand() % (payload_len - 2 - is_work);
+        spot += (spot >= 8) + (spot >= 8 + 64) + (spot >= 8 + 64 + 16);
+        char bad[] = "gGxz/:@`\xff \0";
+        payload[spot] = bad[rand() % (sizeof(bad) - 1)];
+
+        sstp_parse(buf, len, &msg);
+        failures += expect("non-hex", round, msg.type == MALFORMED);
+    }
+
+    return failures;
+}
+
+/*
+ * Builds a random SOLN msg, and makes sure it parses back.
+ * Returns the number of failures.
+ */
+int check_build(int round) {
+    SSTPMsg msg;
+    SSTPMsg parsed;
+    char buf[MAX_MSG_LEN + 1];
+    char expected[32];
+
+    uint64_t value = (uint64_t) rand() << 40 ^ (uint64_t) rand() << 20 ^ rand();
+    char hex[16];
+    sstp_hex64(value, hex);
+    snprintf(expected, sizeof(expected), "%016" PRIx64, value);
+    int failures = expect("sstp_hex64", round, 0 == memcmp(hex, expected, 16));
+
+    msg.type = SOLN;
+    random_work(msg.payload, 0);
+    msg.payload_len = SOLN_PAYLOAD_LEN;
+
+    int len = sstp_build(&msg, buf);
+    sstp_parse(buf, len, &parsed);
+    failures += expect("sstp_build", round, len == 4 + 1 + 90 + 2
+            && parsed.type == SOLN
+            && 0 == memcmp(parsed.payload, msg.payload, SOLN_PAYLOAD_LEN));
+
+    // and back again, with the difficulty and seed exactly as they were
+    // (the solution is always lowercase)
+    char soln[SOLN_PAYLOAD_LEN + 1];
+    sstp_soln_payload(parsed.payload, parsed.work.nonce, soln);
+    sstp_hex64(parsed.work.nonce, msg.payload + WORK_PREFIX_LEN + 1);
+    failures += expect("sstp_soln_payload", round,
+            0 == memcmp(soln, msg.payload, SOLN_PAYLOAD_LEN)
+            && soln[SOLN_PAYLOAD_LEN] == '\0');
+
+    return failures;
+}
+
+/*
+ * Fills in a random WORK (or SOLN) payload, with mixed case hex digits.
+ */
+void random_work(char *dst, int worker_count) {
+    int len = worker_count ? WORK_PAYLOAD_LEN : SOLN_PAYLOAD_LEN;
+
+    for (int i = 0; i < len; i++) {
+        dst[i] = hex_digits[rand() % strlen(hex_digits)];
+    }
+    dst[8] = ' ';
+    dst[8 + 1 + 64] = ' ';
+    if (worker_count) {
+        dst[8 + 1 + 64 + 1 + 16] = ' ';
+    }
+}
+
+/*
+ * Prints out a failure.
+ * Returns 1 if it did fail, 0 if ok.
+ */
+int expect(char *name, int round, int ok) {
+    if (!ok) {
+        printf("FAIL %s (round %d)\n", name, round);
+    }
+    return !ok;
+}
@@ -0,0 +1,182 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Differential test of the limb based u256.h against the byte-wise uint256.h
+ * on random inputs.
+ *
+ * Note: the byte-wise functions don't carry between bytes properly (uint256_add
+ * carries towards the least significant byte and uint256_sl drops the carry
+ * for shifts that aren't whole bytes), so the inputs are restricted to the
+ * cases that don't need those carries. Those are the cases the original
+ * hashcash_calc_target relied on.
+ *
+ * Usage: ./test_uint256
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uint256.h"
+#include "u256.h"
+#include "hashcash.h"
+
+#define ROUNDS 100000
+
+
+/***** Helper function prototypes
+ */
+
+void random_bytes(BYTE *bytes);
+void calc_target_bytewise(BYTE *target, uint32_t difficulty);
+void shr_bitwise(BYTE *dst, BYTE *src, unsigned shift);
+int check(char *name, int round, BYTE *expected, BYTE *actual);
+
+
+/***** Main functions
+ */
+
+int main(void) {
+    BYTE a[32], b[32];
+    BYTE expected[32], actual[32];
+    int failures = 0;
+
+    srand(30023);
+
+    for (int round = 0; round < ROUNDS && failures == 0; round++) {
+        random_bytes(a);
+        random_bytes(b);
+        U256 la = u256_from_bytes(a);
+
+        // bytes round trip
+        u256_to_bytes(la, actual);
+        failures += check("bytes", round, a, actual);
+
+        // addition, without any carries
+        for (int i = 0; i < 32; i++) {
+            b[i] &= ~a[i];
+        }
+        uint256_add(expected, a, b);
+        u256_to_bytes(u256_add(la, u256_from_bytes(b)), actual);
+        failures += check("add", round, expected, actual);
+
+        // shift left by whole bytes
+        BYTE shift = (rand() & 0xff) & ~7;
+        uint256_init(expected);
+        uint256_sl(expected, a, shift);
+        u256_to_bytes(u256_shl(la, shift), actual);
+        failures += check("shl", round, expected, actual);
+
+        // multiply by a power of 256
+        BYTE power[32];
+        uint256_init(power);
+        power[rand() % 32] = 1;
+        uint256_mul(expected, a, power);
+        u256_to_bytes(u256_mul(la, u256_from_bytes(power)), actual);
+        failures += check("mul", round, expected, actual);
+
+        // powers of two
+        BYTE two[32];
+        uint32_t exp = rand() % 300;
+        uint256_init(two);
+        two[31] = 2;
+        uint256_exp(expected, two, exp);
+        u256_to_bytes(u256_exp(u256_from_u64(2), exp), actual);
+        failures += check("exp", round, expected, actual);
+
+        // hashcash targets, over every exponent
+        uint32_t difficulty = ((round & 0xff) << 24) | (rand() & 0xffffff);
+        calc_target_bytewise(expected, difficulty);
+        hashcash_calc_target(actual, difficulty);
+        failures += check("hashcash_calc_target", round, expected, actual);
+
+        // hex round trip
+        char hex[65];
+        U256 parsed;
+        u256_to_hex(la, hex);
+        if (0 != u256_from_hex(hex, &parsed)) {
+            parsed = u256_from_u64(0);
+        }
+        u256_to_bytes(parsed, actual);
+        failures += check("hex", round, a, actual);
+
+        // shift right, by any number of bits (including past the end)
+        unsigned bits = rand() % 260;
+        shr_bitwise(expected, a, bits);
+        u256_to_bytes(u256_shr(la, bits), actual);
+        failures += check("shr", round, expected, actual);
+    }
+
+    printf("%s u256 (%d rounds)\n", failures == 0 ? "PASS" : "FAIL", ROUNDS);
+
+    return failures != 0;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Fills the given uint256 with random bytes.
+ * Some are left with leading zero bytes, to cover the small values too.
+ */
+void random_bytes(BYTE *bytes) {
+    int zeros = rand() % 2 ? rand() % 32 : 0;
+    for (int i = 0; i < 32; i++) {
+        bytes[i] = i < zeros ? 0 : rand() & 0xff;
+    }
+}
+
+/*
+ * The original byte-wise hashcash_calc_target.
+ */
+void calc_target_bytewise(BYTE *target, uint32_t difficulty) {
+    BYTE alpha[32];
+    BYTE beta[32];
+    BYTE two[32];
+
+    uint256_init(beta);
+    beta[29] = (difficulty >> 16) & 0xff;
+    beta[30] = (difficulty >> 8) & 0xff;
+    beta[31] = difficulty & 0xff;
+
+    uint256_init(two);
+    two[31] = 2;
+    uint256_exp(alpha, two, 8 * ((difficulty >> 24) - 3));
+
+    uint256_mul(target, beta, alpha);
+}
+
+/*
+ * Shifts the given big-endian uint256 right a bit at a time, as a reference
+ * for u256_shr (uint256.h has no right shift).
+ */
+void shr_bitwise(BYTE *dst, BYTE *src, unsigned shift) {
+    uint256_init(dst);
+
+    // bit i counts up from the least significant bit
+    for (unsigned i = 0; i + shift < 256; i++) {
+        unsigned from = i + shift;
+        if ((src[31 - from / 8] >> (from % 8)) & 1) {
+            dst[31 - i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+/*
+ * Compares the expected and actual results, printing them if they differ.
+ * Returns 0 if they match and 1 otherwise.
+ */
+int check(char *name, int round, BYTE *expected, BYTE *actual) {
+    if (0 == memcmp(expected, actual, 32)) {
+        return 0;
+    }
+
+    printf("FAIL %s (round %d)\n", name, round);
+    printf("  expected: ");
+    print_uint256(expected);
+    printf("  actual:   ");
+    print_uint256(actual);
+    return 1;
+}
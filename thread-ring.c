@@ -0,0 +1,90 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "thread-ring.h"
+
+
+/***** Helper function prototypes
+ */
+
+void thread_ring_release(void *pring);
+
+
+/***** Public functions
+ */
+
+void thread_rings_init(ThreadRings *rings) {
+    pthread_key_create(&rings->key, thread_ring_release);
+}
+
+void *thread_ring_get(ThreadRings *rings) {
+    ThreadRing *ring = (ThreadRing *) pthread_getspecific(rings->key);
+    if (ring != NULL) {
+        return ring;
+    }
+
+    // the size is rounded up to a whole number of alignments
+    size_t size = (rings->size + THREAD_RING_ALIGN - 1)
+        & ~(size_t) (THREAD_RING_ALIGN - 1);
+    ring = (ThreadRing *) aligned_alloc(THREAD_RING_ALIGN, size);
+    assert(ring);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->dead, 0);
+    ring->tid = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&rings->mutex);
+    ring->next = rings->list;
+    rings->list = ring;
+    pthread_mutex_unlock(&rings->mutex);
+
+    pthread_setspecific(rings->key, ring);
+
+    return ring;
+}
+
+size_t thread_rings_drain(ThreadRings *rings, size_t (*drain)(void *ring)) {
+    size_t drained = 0;
+
+    ThreadRing **prev = &rings->list;
+    while (*prev != NULL) {
+        ThreadRing *ring = *prev;
+
+        // only once it's dead can nothing be added to it after draining
+        int dead = atomic_load(&ring->dead);
+        drained += drain(ring);
+
+        if (dead) {
+            *prev = ring->next;
+            free(ring);
+        } else {
+            prev = &ring->next;
+        }
+    }
+
+    return drained;
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Called as a thread exits, so the drainer frees its ring once it's drained.
+ */
+void thread_ring_release(void *pring) {
+    atomic_store(&((ThreadRing *) pring)->dead, 1);
+}
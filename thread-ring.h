@@ -0,0 +1,78 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The thread ring module. Keeps track of a ring buffer per thread, that only
+ * its thread appends to and a single drainer (eg. a background writer) takes
+ * from, so recording something never takes a lock. Used by both the logger
+ * (see log.h) and the trace recorder (see trace.h).
+ *
+ * What goes in a ring is up to its user, which embeds a ThreadRing at the
+ * start of its own ring struct, eg.
+ *   typedef struct {
+ *       ThreadRing base;
+ *       Event events[RING_LEN];
+ *   } TraceRing;
+ * and moves the ThreadRing's tail on as it appends (and the head as it
+ * drains). A thread's ring is set up the first time it asks for it, and is
+ * freed by the next drain after the thread exits.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define THREAD_RING_ALIGN 64
+
+/*
+ * The start of every ring, with where the thread and the drainer are up to.
+ */
+typedef struct ThreadRing {
+    _Alignas(THREAD_RING_ALIGN) _Atomic size_t head; // moved on by the drainer
+    _Alignas(THREAD_RING_ALIGN) _Atomic size_t tail; // moved on by the thread
+    _Atomic uint64_t dropped; // since the drainer last looked
+    _Atomic int dead; // the thread has exited
+    int tid;
+    struct ThreadRing *next;
+} ThreadRing;
+
+/*
+ * Struct for every thread's ring, set up with THREAD_RINGS_INITIALIZER (with
+ * the size of the whole ring struct), eg.
+ *   ThreadRings trace_rings = THREAD_RINGS_INITIALIZER(sizeof(TraceRing));
+ * then thread_rings_init before it's used.
+ * The mutex must be held while draining, and can also guard whatever the
+ * drainer writes the rings out to. The other internals are private.
+ */
+typedef struct {
+    size_t size;
+    pthread_mutex_t mutex;
+    pthread_key_t key;
+    ThreadRing *list; // protected by the mutex
+} ThreadRings;
+
+#define THREAD_RINGS_INITIALIZER(size) \
+    { (size), PTHREAD_MUTEX_INITIALIZER, 0, NULL }
+
+/*
+ * Sets up the given rings, before any thread asks for its ring.
+ */
+void thread_rings_init(ThreadRings *rings);
+
+/*
+ * Returns the calling thread's ring (the whole ring struct), setting one up
+ * the first time with nothing in it.
+ */
+void *thread_ring_get(ThreadRings *rings);
+
+/*
+ * Calls drain on every ring, then frees the rings of threads that had exited
+ * before it was called (so nothing can have been added since).
+ * Returns the sum of what drain returned.
+ * Note: must be called with rings->mutex held.
+ */
+size_t thread_rings_drain(ThreadRings *rings, size_t (*drain)(void *ring));
@@ -0,0 +1,255 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "topology.h"
+
+#define CPU_PATH "/sys/devices/system/cpu"
+#define NODE_PATH "/sys/devices/system/node"
+#define MAX_PATH_LEN 512
+
+// the longest cpu list that's read from /sys
+#define MAX_LIST_LEN 4096
+
+// every cpu the process can run on, read once
+TopologyCpu *topology = NULL;
+int topology_len = 0;
+pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+
+/***** Helper function prototypes
+ */
+
+void topology_read(void);
+void topology_read_nodes(void);
+int topology_read_int(char *path, int fallback);
+int topology_read_cpus(char *path, cpu_set_t *set);
+
+
+/***** Public functions
+ */
+
+int topology_cpus(TopologyCpu **cpus) {
+    pthread_once(&topology_once, topology_read);
+
+    *cpus = topology;
+    return topology_len;
+}
+
+TopologyCpu *topology_cpu(int cpu) {
+    pthread_once(&topology_once, topology_read);
+
+    for (int i = 0; i < topology_len; i++) {
+        if (topology[i].cpu == cpu) {
+            return topology + i;
+        }
+    }
+
+    return NULL;
+}
+
+int topology_parse_cpus(char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    char *s = list;
+    while (*s != '\0' && *s != '\n') {
+        // either a single cpu or a range of them
+        char *end;
+        long first = strtol(s, &end, 10);
+        if (end == s || first < 0) {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s != '\0' && *s != '\n') {
+            return -1;
+        }
+    }
+
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+void topology_format_cpus(cpu_set_t *set, char *dst, int len) {
+    int n = 0;
+    dst[0] = '\0';
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < len; cpu++) {
+        if (!CPU_ISSET(cpu, set)) {
+            continue;
+        }
+
+        // runs of cpus are written as ranges
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+            last++;
+        }
+        if (last > cpu) {
+            n += snprintf(dst + n, len - n, "%s%d-%d", n > 0 ? "," : "", cpu,
+                    last);
+        } else {
+            n += snprintf(dst + n, len - n, "%s%d", n > 0 ? "," : "", cpu);
+        }
+        cpu = last;
+    }
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * Reads the topology of every cpu the process can run on.
+ */
+void topology_read(void) {
+    cpu_set_t allowed, online;
+    if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        // assume every cpu is allowed
+        CPU_ZERO(&allowed);
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+    if (0 == topology_read_cpus(CPU_PATH "/online", &online)) {
+        CPU_AND(&allowed, &allowed, &online);
+    }
+    if (CPU_COUNT(&allowed) == 0) {
+        CPU_SET(0, &allowed);
+    }
+
+    topology_len = CPU_COUNT(&allowed);
+    topology = (TopologyCpu *) calloc(topology_len, sizeof(TopologyCpu));
+    assert(topology);
+
+    char path[MAX_PATH_LEN];
+    int i = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && i < topology_len; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        TopologyCpu *c = topology + i++;
+        c->cpu = cpu;
+        snprintf(path, MAX_PATH_LEN,
+                CPU_PATH "/cpu%d/topology/physical_package_id", cpu);
+        c->package = topology_read_int(path, 0);
+        snprintf(path, MAX_PATH_LEN, CPU_PATH "/cpu%d/topology/core_id", cpu);
+        c->core = topology_read_int(path, cpu);
+        c->node = 0;
+    }
+
+    // a core's siblings are numbered in cpu order
+    for (i = 0; i < topology_len; i++) {
+        topology[i].sibling = 0;
+        for (int j = 0; j < i; j++) {
+            if (topology[j].package == topology[i].package
+                    && topology[j].core == topology[i].core) {
+                topology[i].sibling++;
+            }
+        }
+    }
+
+    topology_read_nodes();
+}
+
+/*
+ * Reads which NUMA node each cpu is on, from each node's cpu list.
+ */
+void topology_read_nodes(void) {
+    DIR *dir = opendir(NODE_PATH);
+    if (dir == NULL) {
+        return;
+    }
+
+    char path[MAX_PATH_LEN];
+    struct dirent *entry;
+    while (NULL != (entry = readdir(dir))) {
+        int node;
+        char rest;
+        if (1 != sscanf(entry->d_name, "node%d%c", &node, &rest)) {
+            continue;
+        }
+
+        cpu_set_t cpus;
+        snprintf(path, MAX_PATH_LEN, NODE_PATH "/%s/cpulist", entry->d_name);
+        if (0 != topology_read_cpus(path, &cpus)) {
+            continue; // eg. a node with only memory
+        }
+
+        for (int i = 0; i < topology_len; i++) {
+            if (CPU_ISSET(topology[i].cpu, &cpus)) {
+                topology[i].node = node;
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+/*
+ * Reads a single number from the given file.
+ * Returns it, or fallback if it couldn't be read.
+ */
+int topology_read_int(char *path, int fallback) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return fallback;
+    }
+
+    int value;
+    if (1 != fscanf(file, "%d", &value)) {
+        value = fallback;
+    }
+    fclose(file);
+
+    return value;
+}
+
+/*
+ * Reads the cpu list in the given file into set.
+ * Returns 0 on success, and -1 if it couldn't be read.
+ */
+int topology_read_cpus(char *path, cpu_set_t *set) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char list[MAX_LIST_LEN];
+    int res = NULL != fgets(list, MAX_LIST_LEN, file)
+        ? topology_parse_cpus(list, set) : -1;
+    fclose(file);
+
+    return res;
+}
@@ -0,0 +1,55 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The topology module. Reads which cpus are SMT siblings of the same
+ * physical core, and which NUMA node each is on, from /sys, so threads can
+ * be placed on them.
+ *
+ * Only the cpus the process is allowed to run on (eg. under taskset) are
+ * included. Anything /sys doesn't say is guessed, ie. each cpu is taken to be
+ * a core of its own, on node 0.
+ * Note: cpu_set_t needs _GNU_SOURCE defined before anything is included.
+ *
+ */
+
+#pragma once
+
+#include <sched.h>
+
+/*
+ * Where a single cpu is.
+ */
+typedef struct {
+    int cpu;
+    int package; // the physical package (socket) it's in
+    int core; // its physical core's id, within the package
+    int sibling; // which of its core's SMT siblings it is, 0 for the first
+    int node; // the NUMA node it's on
+} TopologyCpu;
+
+/*
+ * Gets every cpu the process is allowed to run on, in cpu order, reading the
+ * topology the first time it's called.
+ * Returns how many there are.
+ * Note: the allowed cpus are the calling thread's, so the first call must be
+ *       made before any thread narrows its own affinity.
+ */
+int topology_cpus(TopologyCpu **cpus);
+
+/*
+ * Looks up the given cpu.
+ * Returns NULL if the process isn't allowed to run on it.
+ */
+TopologyCpu *topology_cpu(int cpu);
+
+/*
+ * Parses a cpu list (as /sys and taskset -c use), eg. "0-3,8", into set.
+ * Returns 0 on success, and -1 if it isn't a cpu list.
+ */
+int topology_parse_cpus(char *list, cpu_set_t *set);
+
+/*
+ * Writes the given set out as a cpu list, into dst (which holds len bytes).
+ */
+void topology_format_cpus(cpu_set_t *set, char *dst, int len);
@@ -0,0 +1,207 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Please see the corresponding header file for documentation on the module.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "thread-ring.h"
+
+#include "trace.h"
+
+// how many events each thread can have recorded before they're written out
+// (a power of two)
+#define RING_LEN 8192
+
+// how often the events are written out
+#define FLUSH_MS 50
+
+
+/***** Private structs
+ */
+
+/*
+ * A single recorded event.
+ */
+typedef struct {
+    char *name;
+    uint64_t id;
+    uint64_t ns; // when it happened
+    char phase;
+} Event;
+
+/*
+ * A thread's events waiting to be written out, only ever appended to by its
+ * thread and drained by the background thread.
+ */
+typedef struct {
+    ThreadRing base;
+    Event events[RING_LEN];
+} TraceRing;
+
+int trace_enabled = 0;
+
+// where the events go
+FILE *trace_file = NULL;
+int trace_pid = 0;
+
+// every thread's ring, whose mutex also guards the file
+ThreadRings trace_rings = THREAD_RINGS_INITIALIZER(sizeof(TraceRing));
+
+
+/***** Helper function prototypes
+ */
+
+void *trace_writer(void *_);
+size_t trace_ring_drain(void *pring);
+void trace_write_event(int tid, Event *event);
+uint64_t trace_now(void);
+
+
+/***** Public functions
+ */
+
+int trace_init(char *path) {
+    if (trace_enabled) { return 0; }
+
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        perror("ERROR: opening trace file");
+        return 1;
+    }
+    trace_pid = getpid();
+
+    // the closing ] is optional, so the file can be opened at any point
+    fprintf(trace_file, "[\n");
+
+    thread_rings_init(&trace_rings);
+    trace_enabled = 1;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, trace_writer, NULL);
+    atexit(trace_flush);
+
+    return 0;
+}
+
+void trace_event(char *name, TracePhase phase, uint64_t id) {
+    TraceRing *ring = (TraceRing *) thread_ring_get(&trace_rings);
+
+    size_t tail = atomic_load_explicit(&ring->base.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->base.head, memory_order_acquire);
+    if (tail - head >= RING_LEN) {
+        atomic_fetch_add_explicit(&ring->base.dropped, 1,
+                memory_order_relaxed);
+        return;
+    }
+
+    Event *event = ring->events + (tail & (RING_LEN - 1));
+    event->name = name;
+    event->id = id;
+    event->ns = trace_now();
+    event->phase = phase;
+
+    atomic_store_explicit(&ring->base.tail, tail + 1, memory_order_release);
+}
+
+void trace_flush(void) {
+    if (!trace_enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace_rings.mutex);
+    thread_rings_drain(&trace_rings, trace_ring_drain);
+    fflush(trace_file);
+    pthread_mutex_unlock(&trace_rings.mutex);
+}
+
+
+/***** Helper functions
+ */
+
+/*
+ * The background thread, which writes out every ring every so often.
+ */
+void *trace_writer(void *_) {
+    (void)_; // purposefully unused, so silence the compiler
+
+    struct timespec interval = { 0, FLUSH_MS * 1000000L };
+    while (1) {
+        nanosleep(&interval, NULL);
+        trace_flush();
+    }
+
+    return NULL;
+}
+
+/*
+ * Writes out everything in the given ring.
+ * Returns the number of events written out.
+ */
+size_t trace_ring_drain(void *pring) {
+    TraceRing *ring = (TraceRing *) pring;
+    int tid = ring->base.tid;
+    size_t head = atomic_load_explicit(&ring->base.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->base.tail, memory_order_acquire);
+    size_t start = head;
+
+    for (; head != tail; head++) {
+        trace_write_event(tid, ring->events + (head & (RING_LEN - 1)));
+    }
+    atomic_store_explicit(&ring->base.head, head, memory_order_release);
+
+    uint64_t dropped = atomic_exchange(&ring->base.dropped, 0);
+    if (dropped > 0) {
+        Event event = {
+            "events_dropped", dropped, trace_now(), TRACE_INSTANT
+        };
+        trace_write_event(tid, &event);
+    }
+
+    return tail - start;
+}
+
+/*
+ * Writes out a single event (on the thread with the given id).
+ * A job's async begin and end are both named "job" (so they're paired up),
+ * with the tracepoint in the event's args.
+ */
+void trace_write_event(int tid, Event *event) {
+    int async = event->phase == TRACE_ASYNC_BEGIN
+        || event->phase == TRACE_ASYNC_STEP || event->phase == TRACE_ASYNC_END;
+    int span = event->phase == TRACE_ASYNC_BEGIN
+        || event->phase == TRACE_ASYNC_END;
+
+    fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"sstp\",\"ph\":\"%c\","
+            "\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":%d,\"tid\":%d,",
+            span ? "job" : event->name, event->phase, event->ns / 1000,
+            event->ns % 1000, trace_pid, tid);
+    if (async) {
+        fprintf(trace_file, "\"id\":\"0x%" PRIx64 "\",", event->id);
+    } else if (event->phase == TRACE_INSTANT) {
+        fprintf(trace_file, "\"s\":\"t\",");
+    }
+    fprintf(trace_file, "\"args\":{\"point\":\"%s\",\"id\":%" PRIu64 "}},\n",
+            event->name, event->id);
+}
+
+/*
+ * The current (monotonic) time in nanoseconds.
+ */
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
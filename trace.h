@@ -0,0 +1,76 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * The tracing module. Static tracepoints on the hot paths, that can both be
+ * probed from outside (as USDT probes) and recorded in-process.
+ *
+ * Each TRACE point is a USDT probe (provider sstp) if built with sys/sdt.h,
+ * eg. `bpftrace -e 'usdt:./server:sstp:work_enqueue { ... }'`, which is just
+ * a nop until something attaches to it, and compiles to nothing without it.
+ *
+ * The recorder (off unless trace_init is called) has each thread append its
+ * events to a ring of its own (see thread-ring.h), which a background thread
+ * writes out every so often in the Chrome trace event format, eg. to be
+ * opened in Perfetto or chrome://tracing. A job's events are all async events
+ * with the job's id (a sequence number, not its address, since jobs are
+ * recycled), so its whole lifetime shows up as one track, across every thread
+ * that touched it.
+ * If a thread's ring is full its events are dropped, rather than waiting.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, id) DTRACE_PROBE1(sstp, name, id)
+#else
+#define TRACE_PROBE(name, id) do {} while (0)
+#endif
+
+/*
+ * A tracepoint, with the (eg. job or connection) id it's about.
+ */
+#define TRACE(name, phase, id) do { \
+        TRACE_PROBE(name, id); \
+        if (trace_enabled) { \
+            trace_event(#name, phase, (uint64_t) (id)); \
+        } \
+    } while (0)
+
+/*
+ * The kinds of events, as in the Chrome trace event format.
+ */
+typedef enum {
+    TRACE_BEGIN = 'B',       // the start of something on this thread
+    TRACE_END = 'E',         // and its end
+    TRACE_INSTANT = 'i',     // something that happened on this thread
+    TRACE_ASYNC_BEGIN = 'b', // the start of a job (on any thread)
+    TRACE_ASYNC_STEP = 'n',  // something that happened to a job
+    TRACE_ASYNC_END = 'e'    // and its end
+} TracePhase;
+
+// whether the recorder is on
+extern int trace_enabled;
+
+/*
+ * Starts recording every TRACE point, to the given file.
+ * Returns non-zero if the file couldn't be opened.
+ * Note: must be called before any other threads are started.
+ */
+int trace_init(char *path);
+
+/*
+ * Records an event, use TRACE instead.
+ */
+void trace_event(char *name, TracePhase phase, uint64_t id);
+
+/*
+ * Writes out everything recorded so far, without waiting for the background
+ * thread.
+ * Note: also done at exit.
+ */
+void trace_flush(void);
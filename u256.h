@@ -0,0 +1,188 @@
+/*
+ * COMP30023 Computer Systems Project 2
+ * Ibrahim Athir Saleem (isaleem) (682989)
+ *
+ * Unsigned 256 bit integers stored as four native 64 bit limbs.
+ * All the arithmetic is modulo 2^256, same as the byte-wise functions in
+ * uint256.h, which these replace.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+// gcc/clang's 128 bit integers, used to get the high half of a 64x64 multiply
+__extension__ typedef unsigned __int128 u128;
+
+/*
+ * A 256 bit unsigned integer.
+ * limb[0] is the least significant.
+ */
+typedef struct {
+    uint64_t limb[4];
+} U256;
+
+/*
+ * Creates a U256 with the given value.
+ */
+static inline U256 u256_from_u64(uint64_t value) {
+    U256 res = { { value, 0, 0, 0 } };
+    return res;
+}
+
+/*
+ * Reads a U256 from 32 big-endian bytes (ie. the uint256.h representation).
+ */
+static inline U256 u256_from_bytes(const BYTE *bytes) {
+    U256 res;
+    for (int i = 0; i < 4; i++) {
+        uint64_t limb = 0;
+        for (int j = 0; j < 8; j++) {
+            limb = (limb << 8) | bytes[(3 - i) * 8 + j];
+        }
+        res.limb[i] = limb;
+    }
+    return res;
+}
+
+/*
+ * Writes the given U256 out as 32 big-endian bytes.
+ */
+static inline void u256_to_bytes(U256 a, BYTE *bytes) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t limb = a.limb[i];
+        for (int j = 7; j >= 0; j--) {
+            bytes[(3 - i) * 8 + j] = limb & 0xff;
+            limb >>= 8;
+        }
+    }
+}
+
+/*
+ * Compares a and b.
+ * Returns -1 if a < b, 0 if they're equal and 1 if a > b.
+ */
+static inline int u256_cmp(U256 a, U256 b) {
+    for (int i = 3; i >= 0; i--) {
+        if (a.limb[i] != b.limb[i]) {
+            return a.limb[i] < b.limb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static inline U256 u256_add(U256 a, U256 b) {
+    U256 res;
+    uint64_t carry = 0;
+    for (int i = 0; i < 4; i++) {
+        u128 sum = (u128) a.limb[i] + b.limb[i] + carry;
+        res.limb[i] = (uint64_t) sum;
+        carry = (uint64_t) (sum >> 64);
+    }
+    return res;
+}
+
+static inline U256 u256_mul(U256 a, U256 b) {
+    U256 res = { { 0, 0, 0, 0 } };
+    // schoolbook, dropping everything from 2^256 up
+    for (int i = 0; i < 4; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; i + j < 4; j++) {
+            u128 product = (u128) a.limb[i] * b.limb[j]
+                + res.limb[i + j] + carry;
+            res.limb[i + j] = (uint64_t) product;
+            carry = (uint64_t) (product >> 64);
+        }
+    }
+    return res;
+}
+
+/*
+ * Shifts left, anything shifted past the top bit is lost.
+ */
+static inline U256 u256_shl(U256 a, unsigned shift) {
+    U256 res = { { 0, 0, 0, 0 } };
+    if (shift >= 256) {
+        return res;
+    }
+    int limbs = shift / 64;
+    int bits = shift % 64;
+    for (int i = 3; i >= limbs; i--) {
+        res.limb[i] = a.limb[i - limbs] << bits;
+        if (bits != 0 && i - limbs - 1 >= 0) {
+            res.limb[i] |= a.limb[i - limbs - 1] >> (64 - bits);
+        }
+    }
+    return res;
+}
+
+static inline U256 u256_shr(U256 a, unsigned shift) {
+    U256 res = { { 0, 0, 0, 0 } };
+    if (shift >= 256) {
+        return res;
+    }
+    int limbs = shift / 64;
+    int bits = shift % 64;
+    for (int i = 0; i + limbs < 4; i++) {
+        res.limb[i] = a.limb[i + limbs] >> bits;
+        if (bits != 0 && i + limbs + 1 < 4) {
+            res.limb[i] |= a.limb[i + limbs + 1] << (64 - bits);
+        }
+    }
+    return res;
+}
+
+/*
+ * base to the power of exp, by repeated squaring.
+ */
+static inline U256 u256_exp(U256 base, uint32_t exp) {
+    U256 res = u256_from_u64(1);
+    while (exp > 0) {
+        if (exp & 1) {
+            res = u256_mul(res, base);
+        }
+        base = u256_mul(base, base);
+        exp >>= 1;
+    }
+    return res;
+}
+
+/*
+ * Writes the given U256 as 64 lowercase hex digits plus a null terminator.
+ */
+static inline void u256_to_hex(U256 a, char *dst) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 64; i++) {
+        int nibble = 63 - i;
+        dst[i] = digits[(a.limb[nibble / 16] >> (4 * (nibble % 16))) & 0xf];
+    }
+    dst[64] = '\0';
+}
+
+/*
+ * Reads a U256 from exactly 64 hex digits (either case).
+ * Returns 0 on success and -1 if there is a non hex digit.
+ */
+static inline int u256_from_hex(const char *src, U256 *a) {
+    U256 res = { { 0, 0, 0, 0 } };
+    for (int i = 0; i < 64; i++) {
+        char c = src[i];
+        uint64_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        int pos = 63 - i;
+        res.limb[pos / 16] |= nibble << (4 * (pos % 16));
+    }
+    *a = res;
+    return 0;
+}